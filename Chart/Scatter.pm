@@ -17,6 +17,52 @@ use Data::Dumper;
 #  public methods go here  #
 #<<<<<<<<<<<<<<<<<<<<<<<<<<#
 
+## @method add_density($coords, %params)
+# plot a large set of points as a binned image, so the drawing time depends on the size
+# of the chart rather than the number of points.
+# $coords is an ML::Matrix or an array of [x, y] rows.  With labels (one cluster number per
+# point) each pixel takes the colour of the cluster with most points in it, otherwise the
+# colour of the first dataset, shaded by the number of points.  overlay is an optional list of
+# [x, y] points (e.g. centroids) drawn as an ordinary dataset on top.
+# Sets up the datasets itself, one per cluster and then the overlay, for the axes and legend.
+sub add_density
+{
+    my $self   = shift;
+    my $coords = shift;
+    my %params = @_;
+
+    require ML::Matrix;
+    $coords = ML::Matrix->from_array($coords) unless ref($coords) eq 'ML::Matrix';
+    my $bounds = $coords->bounds() or croak "add_density needs at least one row of x, y coordinates";
+    my $clusters = $params{'clusters'};
+    if ( !defined($clusters) )
+    {
+        $clusters = 1;
+        foreach my $label ( @{ $params{'labels'} || [] } )
+        {
+            $clusters = $label + 1 if $label >= $clusters;
+        }
+    }
+    my $overlay = $params{'overlay'} || [];
+
+    # the first cluster's dataset holds the corners of the data, which sets the axes, the others
+    # are empty and only there for the legend
+    $self->add_dataset( $bounds->[0], $bounds->[1], map { $_->[0] } @$overlay );
+    $self->add_dataset( $bounds->[2], $bounds->[3], (undef) x @$overlay );
+    foreach my $i ( 2 .. $clusters )
+    {
+        $self->add_dataset( (undef) x ( 2 + @$overlay ) );
+    }
+    $self->add_dataset( undef, undef, map { $_->[1] } @$overlay ) if @$overlay;
+
+    $self->{'density'} = {
+        'coords'   => $coords,
+        'labels'   => $params{'labels'},
+        'clusters' => $clusters,
+    };
+    return $self;
+}
+
 #>>>>>>>>>>>>>>>>>>>>>>>>>>>#
 #  private methods go here  #
 #<<<<<<<<<<<<<<<<<<<<<<<<<<<#
@@ -107,9 +153,26 @@ sub _draw_data
        }
     }
     my $x_range = $x_max_value - $x_min_value;
+
+    # the binned points from add_density, mapped to pixels the same way as the points below
+    if ( $self->{'density'} )
+    {
+        if ( $self->true( $self->{'xy_plot'} ) )
+        {
+            $self->_draw_density( $x1 + $zero_offset, $delta_num, $y1 + $mod * $map, -$map );
+        }
+        else
+        {
+            my $x_scale = $width / ( $x_range || 1 );
+            $self->_draw_density( $x1 - $x_min_value * $x_scale, $x_scale, $y1 + $mod * $map, -$map );
+        }
+    }
+
     # draw the points
     for $i ( 1 .. $self->{'num_datasets'} )
     {
+        # the datasets standing in for the binned clusters have nothing to draw
+        next if $self->{'density'} && $i <= $self->{'density'}{'clusters'};
 
         # get the color for this dataset, and set the brush
         $color = $self->_color_role_to_index( 'dataset' . ( $i - 1 ) );
@@ -159,5 +222,59 @@ sub _draw_data
 
 }
 
+## @fn private _draw_density
+# paint the pixels with points in them, pixel x = $x0 + $x_scale * x, pixel y = $y0 + $y_scale * y
+sub _draw_density
+{
+    my ( $self, $x0, $x_scale, $y0, $y_scale ) = @_;
+    my $density = $self->{'density'};
+    my $gd      = $self->{'gd_obj'};
+    my $left    = int( $self->{'curr_x_min'} );
+    my $top     = int( $self->{'curr_y_min'} );
+    my $width   = int( $self->{'curr_x_max'} ) - $left;
+    my $height  = int( $self->{'curr_y_max'} ) - $top;
+    return if $width < 1 || $height < 1;
+
+    my $cells = $density->{'coords'}->density(
+        labels    => $density->{'labels'},
+        clusters  => $density->{'clusters'},
+        width     => $width,
+        height    => $height,
+        transform => [ $x0 - $left, $x_scale, $y0 - $top, $y_scale ]
+    ) or croak "Chart::Scatter: failed to bin the density data";
+
+    my @colors;
+    if ( $density->{'labels'} )
+    {
+        # majority cluster colours
+        @colors = map { $self->_color_role_to_index( 'dataset' . $_ ) } 0 .. $density->{'clusters'} - 1;
+    }
+    else
+    {
+        # 16 shades from the background to the first dataset's colour, by log of the count
+        my @from = $gd->rgb( $self->_color_role_to_index('background') );
+        my @to   = $gd->rgb( $self->_color_role_to_index('dataset0') );
+        foreach my $level ( 1 .. 16 )
+        {
+            push @colors, $gd->colorResolve( map { int( $from[$_] + ( $to[$_] - $from[$_] ) * $level / 16 ) } 0 .. 2 );
+        }
+    }
+    my $max = 1;
+    for ( my $c = 2 ; $c < @$cells ; $c += 3 )
+    {
+        $max = $cells->[$c] if $cells->[$c] > $max;
+    }
+    for ( my $c = 0 ; $c < @$cells ; $c += 3 )
+    {
+        my ( $pixel, $cluster, $count ) = @$cells[ $c .. $c + 2 ];
+        my $color =
+          $density->{'labels'}
+          ? $colors[$cluster]
+          : $colors[ int( 15 * log( 1 + $count ) / log( 1 + $max ) ) ];
+        $gd->setPixel( $left + $pixel % $width, $top + int( $pixel / $width ), $color );
+    }
+    return;
+}
+
 1; # be a good module and return 1
 
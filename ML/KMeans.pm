@@ -2,15 +2,22 @@ package ML::KMeans;
 
 use Modern::Perl;
 
-use List::Util qw(zip);
+use List::Util qw(max zip);
+use Time::HiRes qw(gettimeofday tv_interval);
 use Data::Dumper;
 use Text::CSV qw(csv);
 use Cwd qw(abs_path);
+use ML::Matrix;
 
 
 my $code;
 BEGIN {
    $code = <<'EOCODE';
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+
 // This section is boilerplace code to move data from Perl -> C and back again
 
 #define HAVE_PERL_VERSION(R, V, S) \
@@ -125,13 +132,14 @@ void print_2D_array(float *foo, int rows, int cols) {
     printf("\n");
 }
 
+// the clustering itself is done by the host library's k-means engine, these functions move the
+// data in and out of it
 float  *host_centroids;
-float  *host_centroids_work_area;
 float  *host_data;
-float  *host_distances;
-size_t *host_cluster_map;
 size_t CH, CW, DH, DW;
-size_t *host_cluster_point_count;
+host_kmeans_t *engine = NULL;
+
+int clean_me_up_im_dirty();
 
 int get_me_in_the_mood(SV *perl_centroids, SV *perl_data) {
    AV *av;
@@ -140,6 +148,8 @@ int get_me_in_the_mood(SV *perl_centroids, SV *perl_data) {
           *DWs = NULL, 
           i,j,insize;
    SV *subav, *subsubav, **ssubav;
+
+   clean_me_up_im_dirty(); // in case clusterise is called more than once on the same object
    if( array_numelts_2D(perl_centroids, &CH, &CWs) ){
        fprintf(stderr, "initialise_me_freddo() : error, call to array_numelts_2D() has failed for input matrix centroids.\n");
        return 1;
@@ -150,31 +160,21 @@ int get_me_in_the_mood(SV *perl_centroids, SV *perl_data) {
    }
    CW = CWs[0];
    DW = DWs[0];
-
-   if( (host_centroids=(float *)malloc(CW*CH*sizeof(float))) == NULL ){
-      fprintf(stderr, "initialise_me_freddo() : error, failed to allocate %zu bytes for %zu items for host_centroid.\n", CH*CW*sizeof(float), CH*CW);
-      return 1;
-   }
-   if( (host_centroids_work_area=(float *)malloc(CW*CH*sizeof(float))) == NULL ){
-      fprintf(stderr, "initialise_me_freddo() : error, failed to allocate %zu bytes for %zu items for host_centroid_work_area.\n", CH*CW*sizeof(float), CH*CW);
+   free(CWs);
+   free(DWs);
+   if( CW != DW ){
+      fprintf(stderr, "initialise_me_freddo() : error, centroids have %zu columns but the data has %zu.\n", CW, DW);
       return 1;
    }
-   if( (host_cluster_point_count=(size_t *)malloc(CH*sizeof(size_t))) == NULL ){
-      fprintf(stderr, "initialise_me_freddo() : error, failed to allocate %zu bytes for %zu items for host_cluster_point_count.\n", CH*sizeof(float), CH);
+
+   if( (host_centroids=(float *)host_alloc(CW*CH*sizeof(float))) == NULL ){
+      fprintf(stderr, "initialise_me_freddo() : error, failed to allocate %zu bytes for %zu items for host_centroid.\n", CH*CW*sizeof(float), CH*CW);
       return 1;
    }
-   if( (host_data=(float *)malloc(DW*DH*sizeof(float))) == NULL ){
+   if( (host_data=(float *)host_alloc(DW*DH*sizeof(float))) == NULL ){
       fprintf(stderr, "initialise_me_freddo() : error, failed to allocate %zu bytes for %zu items for host_data.\n", DH*DW*sizeof(float), DH*DW);
       return 1;
    }
-   if( (host_distances=(float *)malloc(DH*CH*sizeof(float))) == NULL ){ // 1 distance per centroid per data row
-      fprintf(stderr, "initialise_me_freddo() : error, failed to allocate %zu bytes for %zu items for host_distances.\n", DH*CW*sizeof(float), DH*CW);
-      return 1;
-   }
-   if( (host_cluster_map=(size_t *)malloc(DH*1*sizeof(size_t))) == NULL ){
-      fprintf(stderr, "initialise_me_freddo() : error, failed to allocate %zu bytes for %zu items for host_cluster_map.\n", DH*1*sizeof(int), DH*CW);
-      return 1;
-   }
 
    pd = &(host_centroids[0]);
    av = (AV *)SvRV(perl_centroids);
@@ -188,6 +188,8 @@ int get_me_in_the_mood(SV *perl_centroids, SV *perl_data) {
        }
    }
 
+   HOST_PROFILE_BEGIN(marshal, "marshal.rows_in");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * (DH * DW + CH * CW));
    pd = &(host_data[0]);
    av = (AV *)SvRV(perl_data);
 
@@ -199,58 +201,137 @@ int get_me_in_the_mood(SV *perl_centroids, SV *perl_data) {
           pd++;
        }
    }
+   HOST_PROFILE_END(marshal);
+
+   if( (engine=host_kmeans_create(host_data, DH, DW, CH)) == NULL ){
+      fprintf(stderr, "initialise_me_freddo() : error, failed to create the k-means engine.\n");
+      return 1;
+   }
+   host_kmeans_set_centroids(engine, host_centroids);
    return 0;
 }
 
-int bring_me_closer() {
-   for (size_t i = 0; i < (CH * CW); i++) {
-      host_centroids_work_area[i] = 0;
+int get_me_in_the_mood_packed(void *m_ptr, int clusters) {
+   // the engine over the data of an ML::Matrix, which the Perl side keeps alive, with its
+   // centroids left for run_to_deadline to find
+   host_matrix_t *m = (host_matrix_t *)m_ptr;
+
+   clean_me_up_im_dirty();
+   if( clusters < 1 || (size_t)clusters > m->rows ){
+      fprintf(stderr, "get_me_in_the_mood_packed() : error, can't make %d clusters from %zu rows.\n", clusters, m->rows);
+      return 1;
    }
-   for (size_t i = 0; i < CH ; i++) {
-      host_cluster_point_count[i] = 0;
+   DH = m->rows;
+   DW = m->cols;
+   CH = clusters;
+   CW = m->cols;
+   if( (engine=host_kmeans_create(m->data, DH, DW, CH)) == NULL ){
+      fprintf(stderr, "get_me_in_the_mood_packed() : error, failed to create the k-means engine.\n");
+      return 1;
    }
-   for (size_t i = 0; i < DH; i++) {
-      host_cluster_point_count[ host_cluster_map[ i ] ]++;
-      for (size_t j = 0; j < DW; j++ ) {
-         host_centroids_work_area[ host_cluster_map[ i ] * CW + j ] += host_data[ i * DW + j ];
-      }
+   return 0;
+}
+
+int run_to_deadline(int maxiter, double budget_ms, int seed, SV *perl_stats) {
+   host_kmeans_anytime_t result;
+   HV *hv;
+
+   if( ! SvROK(perl_stats) || SvTYPE(SvRV(perl_stats)) != SVt_PVHV ){
+      fprintf(stderr, "run_to_deadline() : error, expecting a hash reference.\n");
+      return 1;
    }
-   for (size_t i = 0; i < CH; i++) {
-      for (size_t j = 0; j < CW; j++ ) {
-         host_centroids[ i * CW + j] = host_centroids_work_area[ i * CW + j ] / host_cluster_point_count[ i ]; 
-      }
+   if( host_kmeans_run_deadline(engine, maxiter, budget_ms, seed, &result) ){
+      fprintf(stderr, "run_to_deadline() : error, the k-means run has failed.\n");
+      return 1;
    }
+   hv = (HV *)SvRV(perl_stats);
+   hv_store(hv, "iterations", 10, newSVuv(result.iterations), 0);
+   hv_store(hv, "changes", 7, newSVuv(result.changes), 0);
+   hv_store(hv, "converged", 9, newSViv(result.converged), 0);
+   hv_store(hv, "deadline_hit", 12, newSViv(result.deadline_hit), 0);
+   hv_store(hv, "sample_rows", 11, newSVuv(result.sample_rows), 0);
+   hv_store(hv, "sample_iterations", 17, newSVuv(result.sample_iterations), 0);
+   hv_store(hv, "inertia", 7, newSVnv(result.inertia), 0);
+   hv_store(hv, "elapsed_ms", 10, newSVnv(result.elapsed_ms), 0);
+   return 0;
+}
+
+int bring_me_closer() {
+   host_kmeans_update(engine);
    return 0;
 }
 
 int are_we_there_yet() {
-   size_t changes = 0; 
-   for (size_t i = 0; i < DH; i++) { // for each data item
-      for (size_t j = 0; j < CH; j++) { // for each centroid
-         float distance = 0;
-         for (size_t k = 0; k < CW; k++) { // for each dimension
-            distance += powf( host_data[ DW * i + k] - host_centroids[ CW * j + k] ,2 )  ;
-         }
-         distance = sqrt( distance );
-         host_distances[ i * CH + j ] = distance;
-      }
-      size_t minidx = 0;
-      float min = host_distances[i * CH];
-      for (size_t m = 0; m < CH; m++) {
-         if (host_distances[i * CH + m] < min) {
-            min = host_distances[i * CH + m];
-            minidx = m;
-         }
-      }
-      if (host_cluster_map[i] != minidx) {
-         changes++;
-         host_cluster_map[i] = minidx;
-      }
+   return host_kmeans_assign(engine);
+}
+
+int set_index(int lists, double recall, int audit) {
+   return host_kmeans_set_index(engine, lists, recall, audit);
+}
+
+int index_stats(SV *perl_stats) {
+   HV *hv;
+   host_kmeans_index_t *index = engine->index;
+
+   if( ! SvROK(perl_stats) || SvTYPE(SvRV(perl_stats)) != SVt_PVHV ){
+      fprintf(stderr, "index_stats() : error, expecting a hash reference.\n");
+      return 1;
    }
-   return changes;
+   if( index == NULL ){
+      fprintf(stderr, "index_stats() : error, the clusters aren't indexed.\n");
+      return 1;
+   }
+   hv = (HV *)SvRV(perl_stats);
+   hv_store(hv, "lists", 5, newSVuv(index->lists), 0);
+   hv_store(hv, "probes", 6, newSVuv(index->probes), 0);
+   hv_store(hv, "sampled", 7, newSVuv(index->sampled), 0);
+   hv_store(hv, "sample_mismatches", 17, newSVuv(index->sample_mismatches), 0);
+   hv_store(hv, "estimated_mismatches", 20, newSVnv(index->sampled ? (double)index->sample_mismatches * DH / index->sampled : 0), 0);
+   if( index->exact_mismatches >= 0 ){
+      hv_store(hv, "exact_mismatches", 16, newSViv(index->exact_mismatches), 0);
+   }
+   return 0;
 }
 
-int take_me_home(SV *perl_R) {
+int sweep_matrix(void *m_ptr, SV *perl_ks, int maxiter, int seed, int sample, SV *perl_results) {
+   host_matrix_t *m = (host_matrix_t *)m_ptr;
+   AV *av;
+   HV *hv;
+   size_t i, nks;
+
+   if( ! is_array_ref(perl_ks, &nks) || nks == 0 ){
+      fprintf(stderr, "sweep_matrix() : error, expecting an array of cluster counts.\n");
+      return 1;
+   }
+   if( ! is_array_ref(perl_results, &i) ){
+      fprintf(stderr, "sweep_matrix() : error, expecting an array reference for the results.\n");
+      return 1;
+   }
+   std::vector<size_t> ks(nks);
+   std::vector<host_kmeans_score_t> scores(nks);
+   av = (AV *)SvRV(perl_ks);
+   for(i=0;i<nks;i++){
+      ks[i] = SvUV(*av_fetch(av, i, FALSE));
+   }
+   if( host_kmeans_sweep(m->data, m->rows, m->cols, ks.data(), nks, maxiter, seed, sample, scores.data()) ){
+      fprintf(stderr, "sweep_matrix() : error, the sweep has failed.\n");
+      return 1;
+   }
+   av = (AV *)SvRV(perl_results);
+   for(i=0;i<nks;i++){
+      hv = newHV();
+      hv_store(hv, "clusters", 8, newSVuv(scores[i].clusters), 0);
+      hv_store(hv, "iterations", 10, newSVuv(scores[i].iterations), 0);
+      hv_store(hv, "changes", 7, newSVuv(scores[i].changes), 0);
+      hv_store(hv, "inertia", 7, newSVnv(scores[i].inertia), 0);
+      hv_store(hv, "davies_bouldin", 14, newSVnv(scores[i].davies_bouldin), 0);
+      hv_store(hv, "silhouette", 10, newSVnv(scores[i].silhouette), 0);
+      av_push(av, newRV_noinc((SV *)hv));
+   }
+   return 0;
+}
+
+static int labels_into_perl(host_kmeans_t *km, SV *perl_R) {
    AV *av, *av2;
    size_t *pd;
    size_t j,RH,RW, asz;
@@ -270,10 +351,10 @@ int take_me_home(SV *perl_R) {
             sv_setrv(perl_R, (SV *)av);
    }
 
-   RH = DH;
+   RH = km->rows;
    RW = 1;
 
-   pd = &(host_cluster_map[0]);
+   pd = &(km->cluster_map[0]);
    av = (AV *)SvRV(perl_R);
    for(int i=0;i<RH;i++){ // for each row
       av_push(av, newSVnv(*pd));
@@ -282,7 +363,7 @@ int take_me_home(SV *perl_R) {
    return 0;
 }
 
-int get_centroids(SV *perl_R) {
+static int centroids_into_perl(host_kmeans_t *km, SV *perl_R) {
    AV *av, *av2;
    float *pd;
    size_t j,RH,RW, asz;
@@ -302,10 +383,10 @@ int get_centroids(SV *perl_R) {
             sv_setrv(perl_R, (SV *)av);
    } 
 
-   RH = CH;
-   RW = CW;
+   RH = km->clusters;
+   RW = km->cols;
 
-   pd = &(host_centroids[0]);
+   pd = &(km->centroids[0]);
    av = (AV *)SvRV(perl_R);
    for(int i=0;i<RH;i++){ // for each row
       av2 = newAV();
@@ -318,13 +399,96 @@ int get_centroids(SV *perl_R) {
    }
    return 0;
 }
+
+int take_me_home(SV *perl_R) {
+   return labels_into_perl(engine, perl_R);
+}
+
+int get_centroids(SV *perl_R) {
+   return centroids_into_perl(engine, perl_R);
+}
+
+// clusterise_async: each handle has its own engine, over the data of an ML::Matrix which the Perl
+// side keeps alive, and runs on a thread of its own
+typedef struct kmeans_async {
+   host_kmeans_t *km;
+   host_kmeans_job_t *job;
+} kmeans_async_t;
+
+void *kmeans_async_start(void *m_ptr, int clusters, int maxiter, int seed) {
+   host_matrix_t *m = (host_matrix_t *)m_ptr;
+   kmeans_async_t *h;
+
+   if( clusters < 1 || (size_t)clusters > m->rows ){
+      fprintf(stderr, "kmeans_async_start() : error, can't make %d clusters from %zu rows.\n", clusters, m->rows);
+      return NULL;
+   }
+   if( (h=(kmeans_async_t *)calloc(1, sizeof(kmeans_async_t))) == NULL ){
+      return NULL;
+   }
+   if( (h->km=host_kmeans_create(m->data, m->rows, m->cols, clusters)) == NULL ||
+       (h->job=host_kmeans_start(h->km, maxiter, seed)) == NULL ){
+      fprintf(stderr, "kmeans_async_start() : error, failed to start the k-means job.\n");
+      host_kmeans_free(h->km);
+      free(h);
+      return NULL;
+   }
+   return h;
+}
+
+int kmeans_async_poll(void *h_ptr, SV *perl_progress) {
+   kmeans_async_t *h = (kmeans_async_t *)h_ptr;
+   HV *hv;
+   size_t iteration, changes;
+   int done, cancelled;
+
+   if( ! SvROK(perl_progress) || SvTYPE(SvRV(perl_progress)) != SVt_PVHV ){
+      fprintf(stderr, "kmeans_async_poll() : error, expecting a hash reference.\n");
+      return 1;
+   }
+   done = host_kmeans_job_poll(h->job, &iteration, &changes, &cancelled);
+   hv = (HV *)SvRV(perl_progress);
+   hv_store(hv, "iteration", 9, newSVuv(iteration), 0);
+   hv_store(hv, "changes", 7, newSVuv(changes), 0);
+   hv_store(hv, "done", 4, newSViv(done), 0);
+   hv_store(hv, "cancelled", 9, newSViv(cancelled), 0);
+   return 0;
+}
+
+void kmeans_async_cancel(void *h_ptr) {
+   host_kmeans_job_cancel(((kmeans_async_t *)h_ptr)->job);
+}
+
+int kmeans_async_wait(void *h_ptr) {
+   return host_kmeans_job_wait(((kmeans_async_t *)h_ptr)->job);
+}
+
+int kmeans_async_fd(void *h_ptr) {
+   return host_kmeans_job_fd(((kmeans_async_t *)h_ptr)->job);
+}
+
+int kmeans_async_labels(void *h_ptr, SV *perl_R) {
+   return labels_into_perl(((kmeans_async_t *)h_ptr)->km, perl_R);
+}
+
+int kmeans_async_centroids(void *h_ptr, SV *perl_R) {
+   return centroids_into_perl(((kmeans_async_t *)h_ptr)->km, perl_R);
+}
+
+void kmeans_async_free(void *h_ptr) {
+   kmeans_async_t *h = (kmeans_async_t *)h_ptr;
+   host_kmeans_job_free(h->job); // cancels the run and waits for its thread
+   host_kmeans_free(h->km);
+   free(h);
+}
+
 int clean_me_up_im_dirty() {
-   free(host_centroids);
-   free(host_centroids_work_area);
-   free(host_data);
-   free(host_distances);
-   free(host_cluster_map);
-   free(host_cluster_point_count);
+   host_kmeans_free(engine);
+   host_free(host_centroids);
+   host_free(host_data);
+   engine = NULL;
+   host_centroids = NULL;
+   host_data = NULL;
    return 0;   
 }
 EOCODE
@@ -389,8 +553,8 @@ use Inline CPP => Config =>
         force_build => 0,
         clean_after_build => 0,
         warnings => 0,
-        INC => "-I" . abs_path("./inc") . " -I" . abs_path("./amd_kernel"),
-        LIBS => "-L" . abs_path("./amd_kernel") . " -lKernels"
+        INC => "-I" . abs_path(substr(__FILE__,0,-1*(length("/ML/KMeans.pm"))) . "/inc")  . " -I" . abs_path("./inc") . " ",
+        LIBS => "-L" . abs_path(substr(__FILE__,0,-1*(length("/ML/KMeans.pm"))) . "/lib") . " -L" . abs_path("./lib") . " -lHostKernel "
 ;
 
 use Inline CPP => $code;
@@ -490,6 +654,7 @@ sub clusterise {
    my $changes = 0;
    my $iteration = 0;
    $args{maxiter} = 100 unless defined($args{maxiter}) and $args{maxiter} =~ /^\d+$/;
+   return $self->_clusterise_deadline(%args) if defined($args{deadline_ms}) or defined($args{time_budget});
    my $centroids = $self->init_centroids( $args{ data } , $args{ clusters });
 #say "centoids = " . Dumper($centroids);
    if (defined($args{coords_key})) {
@@ -501,11 +666,29 @@ sub clusterise {
    }
 
    get_me_in_the_mood($centroids, $data) && die;
-   $changes = are_we_there_yet();
+   # index => { recall => 0.95, lists => N, audit => 1 } makes each assignment an approximate
+   # nearest centroid search, for very large numbers of clusters; see stats() for how far off it is
+   my $index = $args{index};
+   if ($index) {
+      set_index($index->{lists} // 0, $index->{recall} // 0.95, $index->{audit} ? 1 : 0) && die;
+   }
+   my @index_stats;
+   my $assign = sub {
+      my $changes = are_we_there_yet();
+      if ($index) {
+         my $stats = {};
+         index_stats($stats) && die;
+         push @index_stats, $stats;
+      }
+      return $changes;
+   };
+   $changes = $assign->();
    while ($iteration++ < $args{maxiter} and $changes > 0) {
       bring_me_closer();
-      $changes = are_we_there_yet();
+      $changes = $assign->();
    }
+   $self->{stats} = { changes => $changes };
+   $self->{stats}{index} = \@index_stats if $index;
 #   if ($changes == 0) {
 #      say "converged in $iteration iterations";
 #   } else {
@@ -514,7 +697,9 @@ sub clusterise {
    my $clusters = [];
    take_me_home($clusters);
 
-   if (defined($args{cluster_key})) {
+   # the labels go into the data only when it is an array of hashes; an ML::Matrix has nowhere
+   # to keep them, so they are returned as they are without cluster_key
+   if (defined($args{cluster_key}) and ref($args{data}) eq "ARRAY") {
       foreach (zip $args{data}, $clusters) {
          my ($d, $c) = @$_;
          $d->{$args{cluster_key}} = $c;
@@ -525,6 +710,84 @@ sub clusterise {
 
 }
 
+sub _clusterise_deadline {
+   # clusterise within deadline_ms => N (or time_budget => seconds), counted from the call: the
+   # centroids are found on growing subsamples of the data (k-means++ on the first, seed => N) and
+   # then refined over all of it while there is time for another pass, and the best state reached
+   # is the one returned.  Every point is assigned at least once, however short the budget.
+   my $self = shift;
+   my %args = @_;
+   my $start = [gettimeofday];
+   my $budget = $args{deadline_ms} // 1000 * $args{time_budget};
+   $self->{matrix} = _packed(%args); # the engine works on its data
+   get_me_in_the_mood_packed($self->{matrix}->ptr, $args{clusters}) && die;
+   my $index = $args{index};
+   if ($index) {
+      set_index($index->{lists} // 0, $index->{recall} // 0.95, $index->{audit} ? 1 : 0) && die;
+   }
+   my $stats = {};
+   run_to_deadline($args{maxiter}, max(0, $budget - 1000 * tv_interval($start)),
+                   $args{seed} // int(rand(2**31)), $stats) && die;
+   $self->{stats} = $stats;
+   my $clusters = [];
+   take_me_home($clusters);
+   return $clusters unless defined($args{cluster_key}) and ref($args{data}) eq "ARRAY";
+   foreach (zip $args{data}, $clusters) {
+      my ($d, $c) = @$_;
+      $d->{$args{cluster_key}} = $c;
+   }
+}
+
+sub stats {
+   # from the last clusterise: the changes made by its final assignment and, when it was indexed,
+   # per assignment the lists probed and how many points weren't given their exact nearest
+   # centroid, counted on a sample (and over every point with audit => 1).  With a deadline, also
+   # converged, deadline_hit (a pass was left out for want of time), iterations over all the data,
+   # sample_rows and sample_iterations (the largest subsample, and the iterations on them all),
+   # inertia and elapsed_ms
+   my $self = shift;
+   return $self->{stats};
+}
+
+sub _packed {
+   # the data as an ML::Matrix, packing arrays (or the coords_key of each hash) once
+   my %args = @_;
+   return $args{data} if ref($args{data}) eq "ML::Matrix";
+   my $data = $args{data};
+   if (defined($args{coords_key})) {
+      $data = [ map { $_->{$args{coords_key}} } @{$args{data}} ];
+   }
+   return ML::Matrix->from_array($data);
+}
+
+sub sweep {
+   # k-means for every cluster count in k => [2 .. 50], run concurrently over one packed copy of the
+   # data (an ML::Matrix is used as it is), returning per K, in the order given, its clusters,
+   # iterations, changes, inertia, davies_bouldin and silhouette.  The silhouette is calculated on
+   # silhouette_sample => N random rows (2000 by default, 0 for none), its cost and memory go as N^2.
+   my $self = shift;
+   my %args = @_;
+   my $maxiter = defined($args{maxiter}) && $args{maxiter} =~ /^\d+$/ ? $args{maxiter} : 100;
+   my $matrix = _packed(%args);
+   my $results = [];
+   sweep_matrix($matrix->ptr, $args{k}, $maxiter, $args{seed} // int(rand(2**31)),
+                $args{silhouette_sample} // 2000, $results) && die "ML::KMeans::sweep failed";
+   return $results;
+}
+
+sub clusterise_async {
+   # clusterise on a background thread: returns an ML::KMeans::Job straight away, which can be
+   # polled (progress), cancelled, waited on, or watched through fd() in an event loop.  The
+   # centroids are initialised natively (k-means++, seed => N), and several jobs can run at once.
+   my $self = shift;
+   my %args = @_;
+   my $maxiter = defined($args{maxiter}) && $args{maxiter} =~ /^\d+$/ ? $args{maxiter} : 100;
+   my $matrix = _packed(%args);
+   my $ptr = kmeans_async_start($matrix->ptr, $args{clusters}, $maxiter, $args{seed} // int(rand(2**31)));
+   die "ML::KMeans::clusterise_async failed to start" unless $ptr;
+   return bless { ptr => $ptr, matrix => $matrix, data => $args{data}, cluster_key => $args{cluster_key} }, "ML::KMeans::Job";
+}
+
 sub centroids {
    my $self = shift;
    my $centroids = [];
@@ -535,4 +798,71 @@ sub centroids {
 sub DESTROY {
    clean_me_up_im_dirty();
 }
+
+package ML::KMeans::Job;
+
+# the handle returned by clusterise_async
+#
+#   my $job = ML::KMeans->new->clusterise_async(data => $data, clusters => 1000);
+#   my $w = AnyEvent->io(fh => $job->fd, poll => "r", cb => sub { my $labels = $job->result; ... });
+#   $job->progress;   # { iteration => 12, changes => 3021, done => 0, cancelled => 0 }
+#   $job->cancel;     # stops between steps, the labels and centroids are those reached so far
+
+sub progress {
+   my $self = shift;
+   my $progress = {};
+   ML::KMeans::kmeans_async_poll($self->{ptr}, $progress) && return;
+   return $progress;
+}
+
+sub done {
+   my $self = shift;
+   return $self->progress->{done};
+}
+
+sub cancel {
+   my $self = shift;
+   ML::KMeans::kmeans_async_cancel($self->{ptr});
+}
+
+sub fd {
+   # readable once the run has ended; use a duplicate (open "<&") rather than closing it
+   my $self = shift;
+   return ML::KMeans::kmeans_async_fd($self->{ptr});
+}
+
+sub wait {
+   my $self = shift;
+   ML::KMeans::kmeans_async_wait($self->{ptr});
+   return $self->result;
+}
+
+sub result {
+   # undef while the run is going, then the labels as clusterise returns them (or, with
+   # cluster_key, stored in the data)
+   my $self = shift;
+   return unless $self->done;
+   my $clusters = [];
+   ML::KMeans::kmeans_async_labels($self->{ptr}, $clusters) && return;
+   if (defined($self->{cluster_key}) and ref($self->{data}) eq "ARRAY") {
+      foreach my $i (0 .. $#$clusters) {
+         $self->{data}[$i]{$self->{cluster_key}} = $clusters->[$i];
+      }
+   }
+   return $clusters;
+}
+
+sub centroids {
+   my $self = shift;
+   return unless $self->done;
+   my $centroids = [];
+   ML::KMeans::kmeans_async_centroids($self->{ptr}, $centroids);
+   return $centroids;
+}
+
+sub DESTROY {
+   my $self = shift;
+   ML::KMeans::kmeans_async_free(delete $self->{ptr}) if $self->{ptr};
+}
+
 1;
@@ -24,10 +24,12 @@ use Inline CPP => Config =>
         clean_after_build => 1,
         warnings => 0,
         INC => "-I" . abs_path(substr(__FILE__,0,-1*(length("/ML/MVCUDA.pm"))) . "/inc")  . " -I" . abs_path("./inc") . " ",
-        LIBS => "-L" . abs_path(substr(__FILE__,0,-1*(length("/ML/MVCUDA.pm"))) . "/lib") . " -L" . abs_path("./lib") . " -lCUDAKernel "
+        LIBS => "-L" . abs_path(substr(__FILE__,0,-1*(length("/ML/MVCUDA.pm"))) . "/lib") . " -L" . abs_path("./lib") . " -lCUDAKernel -lHostKernel "
 ;
 
-use Inline CPP => abs_path(substr(__FILE__,0,-1*(length("/MVCUDA.pm")))). "/MVKernels.c";
+# the glue shared with the other backends (MVGlue.c) goes in front of MVKernels.c, in the one source
+# Inline::CPP builds and binds
+use Inline CPP => read_file(abs_path(substr(__FILE__,0,-1*(length("/MVCUDA.pm")))) . "/MVGlue.c") . read_file(abs_path(substr(__FILE__,0,-1*(length("/MVCUDA.pm")))) . "/MVKernels.c");
 
 sub c_add_node {
    my $self = shift;
@@ -123,6 +125,11 @@ sub c_calculate_covariance {
    return calculate_covariance(@_);
 }
 
+sub c_set_covariance_engine {
+   my $self = shift;
+   return set_covariance_engine(@_);
+}
+
 sub c_eigenvectors {
    my $self = shift;
    return cuda_eigenvectors(@_);
@@ -133,4 +140,153 @@ sub c_project_results {
    return cuda_project_results(@_);
 }
 
+
+sub c_pca_model_capture {
+   my $self = shift;
+   return pca_model_capture(@_);
+}
+
+sub c_pca_model_transform {
+   my $self = shift;
+   return pca_model_transform(@_);
+}
+
+sub c_pca_model_save {
+   my $self = shift;
+   return pca_model_save(@_);
+}
+
+sub c_pca_model_load {
+   my $self = shift;
+   return pca_model_load(@_);
+}
+
+sub c_pca_model_columns {
+   my $self = shift;
+   return pca_model_columns(@_);
+}
+
+sub c_pca_model_free {
+   my $self = shift;
+   return pca_model_free(@_);
+}
+
+
+sub c_pipeline_run {
+   my $self = shift;
+   return pipeline_run(@_);
+}
+
+
+sub c_pca_workspace_create {
+   my $self = shift;
+   return pca_workspace_create(@_);
+}
+
+sub c_pca_workspace_use {
+   my $self = shift;
+   return pca_workspace_use(@_);
+}
+
+sub c_pca_workspace_free {
+   my $self = shift;
+   return pca_workspace_free(@_);
+}
+
+sub c_pca_workspace_stats {
+   my $self = shift;
+   return pca_workspace_stats(@_);
+}
+
+
+sub c_load_training_set {
+   my $self = shift;
+   return load_training_set(@_);
+}
+
+sub c_load_evaluation_set {
+   my $self = shift;
+   return load_evaluation_set(@_);
+}
+
+sub c_train_epochs {
+   my $self = shift;
+   return train_epochs(@_);
+}
+
+sub c_save_checkpoint {
+   my $self = shift;
+   return save_checkpoint(@_);
+}
+
+sub c_load_checkpoint {
+   my $self = shift;
+   return load_checkpoint(@_);
+}
+
+sub c_inference_load {
+   my $self = shift;
+   return inference_load(@_);
+}
+
+sub c_inference_freeze {
+   my $self = shift;
+   return inference_freeze(@_);
+}
+
+sub c_inference_predict {
+   my $self = shift;
+   return inference_predict(@_);
+}
+
+sub c_inference_classify {
+   my $self = shift;
+   return inference_classify(@_);
+}
+
+sub c_inference_free {
+   my $self = shift;
+   return inference_free(@_);
+}
+
+sub c_calculate_covariance_packed {
+   my $self = shift;
+   return calculate_covariance_packed(@_);
+}
+
+sub c_calculate_gram {
+   my $self = shift;
+   return calculate_gram(@_);
+}
+
+sub c_calculate_gram_packed {
+   my $self = shift;
+   return calculate_gram_packed(@_);
+}
+
+sub c_pca_batch {
+   my $self = shift;
+   return pca_batch(@_);
+}
+
+sub c_pipeline_run_packed {
+   my $self = shift;
+   return pipeline_run_packed(@_);
+}
+
+sub c_pca_model_transform_packed {
+   my $self = shift;
+   return pca_model_transform_packed(@_);
+}
+
+sub c_pca_model_project_file {
+   my $self = shift;
+   return pca_model_project_file(@_);
+}
+
+sub c_pca_model_stream {
+   my $self = shift;
+   return pca_model_stream(@_);
+}
+
 1;
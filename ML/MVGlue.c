@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+
+#include <cstring>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+
+// The Perl side glue shared by MVKernels.c (ML::MVCUDA, ML::MVROCM) and MVHost.c (ML::MVHost).
+// The modules hand Inline::CPP this file followed by their own, so the marshalling, the packed
+// training sets and the inference handles are the same code whichever backend is loaded.
+
+#define HAVE_PERL_VERSION(R, V, S) \
+    (PERL_REVISION > (R) || (PERL_REVISION == (R) && (PERL_VERSION > (V) || (PERL_VERSION == (V) && (PERL_SUBVERSION >= (S))))))
+
+// This section is boilerplace code to move data from Perl -> C and back again
+
+#define sv_setrv(s, r)  S_sv_setrv(aTHX_ s, r)
+
+static void S_sv_setrv(pTHX_ SV *sv, SV *rv)
+{
+  sv_setiv(sv, (IV)rv);
+#if !HAVE_PERL_VERSION(5, 24, 0)
+  SvIOK_off(sv);
+#endif
+  SvROK_on(sv);
+}
+
+int is_array_ref(
+        SV *array,
+        size_t *array_sz
+);
+int array_numelts_2D(
+        SV *array,
+        size_t *_Nd1,
+        size_t **_Nd2
+);
+int array_of_int_into_AV(
+        int *src,
+        size_t src_sz,
+        SV *dst
+);
+
+int is_array_ref(
+        SV *array,
+        size_t *array_sz
+){
+        if( ! SvROK(array) ){ fprintf(stderr, "is_array_ref() : warning, input '%p' is not a reference.\n", array); return 0; }
+        if( SvTYPE(SvRV(array)) != SVt_PVAV ){ fprintf(stderr, "is_array_ref() : warning, input ref '%p' is not an ARRAY reference.\n", array); return 0; }
+        // it's an array, cast it to AV to get its len via av_len();
+        // yes, av_len needs to be bumped up
+        int asz = 1+av_len((AV *)SvRV(array));
+        if( asz < 0 ){ fprintf(stderr, "is_array_ref() : error, input array ref '%p' has negative size!\n", array); return 0; }
+        *array_sz = (size_t )asz;
+        return 1; // success, it is an array and size returned by ref, above
+}
+
+#define array_numelts_1D(A,B) (!is_array_ref(A,B))
+
+int array_numelts_2D(
+        SV *array,
+        size_t *_Nd1,
+        size_t **_Nd2
+){
+        size_t anN, anN2, *Nd2 = NULL;
+
+        if( ! is_array_ref(array, &anN) ){
+           fprintf(stderr, "is_array_ref_2D() : error, call to is_array_ref() has failed for array '%p'.\n", array);
+           return 1;
+        }
+
+        if( *_Nd2 == NULL ){
+           if( (Nd2=(size_t *)malloc(anN*sizeof(size_t))) == NULL ){
+               fprintf(stderr, "array_numelts_2D() : error, failed to allocate %zu bytes for %zu items for Nd2.\n", anN*sizeof(size_t), anN);
+               return 1;
+           }
+        } else Nd2 = *_Nd2;
+        AV *anAV = (AV *)SvRV(array);
+        size_t *pNd2 = &(Nd2[0]);
+        for(size_t i=0;i<anN;i++,pNd2++){
+           SV *subarray = *av_fetch(anAV, i, FALSE);
+           if( ! is_array_ref(subarray, &anN2) ){
+              fprintf(stderr, "is_array_ref_2D() : error, call to is_array_ref() has failed for [%p][%p], item %zu.\n", array, subarray, i);
+              if(*_Nd2==NULL) free(Nd2);
+              return 1;
+           }
+           *pNd2 = anN2;
+        }
+        if( *_Nd2 == NULL ) *_Nd2 = Nd2;
+        *_Nd1 = anN;
+        return 0; // success
+}
+
+int array_of_int_into_AV(
+        int *src,
+        size_t src_sz,
+        SV *dst
+){
+        size_t dst_sz;
+        if( ! is_array_ref(dst, &dst_sz) ){ fprintf(stderr, "array_of_int_into_AV() : error, call to is_array_ref() has failed.\n"); return 1; }
+        AV *dstAV = (AV *)SvRV(dst);
+        for(size_t i=0;i<src_sz;i++){
+                av_push(dstAV, newSViv(src[i]));
+        }
+        return 0; // success
+}
+// end of Perl -> C -> Perl section
+void print_2D_array(float *foo, int rows, int cols) {
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            printf("%+.5f\t", foo[i * cols + j]);
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+// the training and evaluation sets, packed once so train_epochs can run without calling back into Perl
+std::vector<float> train_x, train_y, eval_x, eval_y;
+size_t train_n = 0, eval_n = 0;
+
+int pack_perl_rows(SV *perl_rows, size_t cols, std::vector<float> &dst, size_t *rows) {
+    HOST_PROFILE_SCOPE("marshal.pack_rows");
+    size_t n, rowlen;
+    if( ! is_array_ref(perl_rows, &n) ){
+       fprintf(stderr, "pack_perl_rows() : error, expecting an array reference.\n");
+       return 1;
+    }
+    HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * n * cols);
+    dst.resize(n * cols);
+    float *pd = dst.data();
+    AV *av = (AV *)SvRV(perl_rows);
+    for(size_t i=0;i<n;i++){ // for each row
+       SV *subav = *av_fetch(av, i, FALSE);
+       if( ! is_array_ref(subav, &rowlen) || rowlen != cols ){
+          fprintf(stderr, "pack_perl_rows() : error, row %zu does not have %zu columns.\n", i, cols);
+          return 1;
+       }
+       for(size_t j=0;j<cols;j++){ // for the cols of that row
+          SV *subsubav = *av_fetch((AV *)SvRV(subav), j, FALSE);
+          *pd = SvNV(subsubav);
+          pd++;
+       }
+    }
+    *rows = n;
+    return 0;
+}
+
+// packs the inputs and targets of a training or evaluation set, for load_training_set and
+// load_evaluation_set in each backend, which know the network's input and output sizes
+int pack_perl_set(SV *perl_x, SV *perl_y, size_t insize, size_t outsize, std::vector<float> &x, std::vector<float> &y, size_t *n, const char *caller) {
+    size_t ny;
+    if (pack_perl_rows(perl_x, insize, x, n) || pack_perl_rows(perl_y, outsize, y, &ny)) {
+       return 1;
+    }
+    if (ny != *n) {
+       fprintf(stderr, "%s() : error, %zu inputs but %zu targets.\n", caller, *n, ny);
+       return 1;
+    }
+    return 0;
+}
+
+void push_stat(HV *hv, const char *key, double value) {
+    SV **svp = hv_fetch(hv, key, strlen(key), 0);
+    AV *av;
+    if (svp == NULL || !SvROK(*svp)) {
+       av = newAV();
+       hv_store(hv, key, strlen(key), newRV_noinc((SV *)av), 0);
+    } else {
+       av = (AV *)SvRV(*svp);
+    }
+    av_push(av, newSVnv(value));
+}
+
+// Frozen, prediction only copies of a network (see host_kernel/inference.cpp), passed to Perl as
+// handles; each backend has its own inference_freeze
+
+int inference_predict(void *inf_ptr, SV *perl_x, SV *perl_out) {
+    host_inference_t *inf = (host_inference_t *)inf_ptr;
+    std::vector<float> x;
+    size_t rows, asz;
+    if (pack_perl_rows(perl_x, inf->sizes[0], x, &rows)) {
+       return 1;
+    }
+    size_t width = inf->sizes[inf->layers];
+    std::vector<float> out(rows * width);
+    if (host_inference_predict(inf, x.data(), rows, out.data()) != 0) {
+       return 1;
+    }
+    if( ! is_array_ref(perl_out, &asz) ){
+       fprintf(stderr, "inference_predict() : error, expecting an array reference for the output.\n");
+       return 1;
+    }
+    AV *av = (AV *)SvRV(perl_out);
+    av_clear(av);
+    float *pd = out.data();
+    for(size_t i=0;i<rows;i++){ // one row of outputs per sample
+        AV *av2 = newAV();
+        av_extend(av2, width);
+        // LeoNerd's suggestion
+        av_push(av, newRV_noinc((SV *)av2));
+        for(size_t j=0;j<width;j++){
+            av_store(av2, j, newSVnv(*pd));
+            pd++;
+        }
+    }
+    return 0;
+}
+
+int inference_classify(void *inf_ptr, SV *perl_x, SV *perl_labels) {
+    host_inference_t *inf = (host_inference_t *)inf_ptr;
+    std::vector<float> x;
+    size_t rows;
+    if (pack_perl_rows(perl_x, inf->sizes[0], x, &rows)) {
+       return 1;
+    }
+    std::vector<int> labels(rows);
+    if (host_inference_classify(inf, x.data(), rows, labels.data()) != 0) {
+       return 1;
+    }
+    return array_of_int_into_AV(labels.data(), rows, perl_labels);
+}
+
+void *inference_load(char *filename) {
+    return host_inference_load(filename);
+}
+
+void inference_free(void *inf) {
+    host_inference_free((host_inference_t *)inf);
+}
@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <stddef.h>
+#include <iostream>
+#include <vector>
+
+#include <cstring>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+
+// The CPU (host library) version of the network half of MVKernels.c.  The functions have the
+// same names and arguments, so ML::MVHost can stand in for ML::MVCUDA / ML::MVROCM.  The batch is
+// kept one sample per row, which is the way round Perl hands it over, so no transposes are needed.
+// The Perl side glue both share (marshalling, the packed training sets, inference handles) is in
+// MVGlue.c, which ML::MVHost puts in front of this file.
+
+int debug = 0;
+int loss_function = 1;
+
+int mini_batch_size;
+
+host_network_t *network = NULL;
+
+// these are where the input and target for each "feedforward" will be stored, one row per sample
+std::vector<float> host_x;
+std::vector<float> host_y;
+
+int perl_rows_into(SV *perl_rows, size_t rows, size_t cols, float *pd) {
+    HOST_PROFILE_SCOPE("marshal.rows_in");
+    HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * rows * cols);
+    AV *av = (AV *)SvRV(perl_rows);
+    for(size_t i=0;i<rows;i++){ // for each row
+       SV *subav = *av_fetch(av, i, FALSE);
+       for(size_t j=0;j<cols;j++){ // for the cols of that row
+          SV *subsubav = *av_fetch((AV *)SvRV(subav), j, FALSE);
+          *pd = SvNV(subsubav);
+          pd++;
+       }
+    }
+    return 1;
+}
+
+void rows_into_perl(float *pd, size_t RH, size_t RW, SV *R) {
+    HOST_PROFILE_SCOPE("marshal.rows_out");
+    HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * RH * RW);
+    AV *av, *av2;
+    size_t asz;
+    if( is_array_ref(R, &asz) ){
+            av = (AV *)SvRV(R);
+            if( asz > 0 ){
+               av_clear(av);
+            }
+    } else if( SvROK(R) ){
+            av = newAV();
+            // LeoNerd's suggestion:
+            sv_setrv(SvRV(R), (SV *)av);
+    } else {
+            av = newAV();
+            // LeoNerd's suggestion:
+            sv_setrv(R, (SV *)av);
+    }
+    av = (AV *)SvRV(R);
+    for(size_t i=0;i<RH;i++){ // for each row
+        av2 = newAV(); // make a new array for each row
+        av_extend(av2, RW); // extend it to hold #cols items (RW)
+        // LeoNerd's suggestion
+        av_push(av, newRV_noinc((SV *)av2)); // insert it into the top Array
+        for(size_t j=0;j<RW;j++){ // for the cols of that row
+            av_store(av2, j, newSVnv(*pd));
+            pd++;
+        }
+    }
+}
+
+int add_node(int insize, int outsize, SV *biases, SV *weights, int batch_size)
+{
+    if (network == NULL) {
+       network = host_network_create(batch_size, loss_function);
+       if (network == NULL) {
+          std::cerr << "no network created for a batch size of " << batch_size << std::endl;
+          return 0;
+       }
+    }
+    std::vector<float> host_Bias(outsize), host_Weights((size_t)outsize * insize);
+    perl_rows_into(biases, outsize, 1, host_Bias.data());
+    perl_rows_into(weights, outsize, insize, host_Weights.data());
+    if (host_network_add_layer(network, insize, outsize, host_Weights.data(), host_Bias.data()) != 0) {
+       std::cerr << "no node created for " << insize << " x " << outsize << std::endl;
+       return 0;
+    }
+    return 1;
+}
+
+void reset_derivatives() {
+    host_network_zero_derivatives(network);
+}
+
+void print_list() {
+    for (size_t l = 0; l < network->layers; l++) {
+       std::cout << "layer " << l << " : " << network->layer[l].input_size << " => " << network->layer[l].output_size << std::endl;
+    }
+}
+
+int reserve_input_memory(int insize, int outsize, int batch_size)
+{
+    host_x.resize((size_t)insize * batch_size);
+    host_y.resize((size_t)outsize * batch_size);
+    mini_batch_size = batch_size;
+    return host_network_reserve(network, batch_size) == 0;
+}
+
+int load_input(SV *x, int elements)
+{
+    size_t insize = network->layer[0].input_size;
+    mini_batch_size = elements;
+    if (host_x.size() < insize * elements) {
+       host_x.resize(insize * elements);
+    }
+    perl_rows_into(x, elements, insize, host_x.data());
+    if (debug == 1) {
+       std::cout << "host_x"<<std::endl;
+       print_2D_array(host_x.data(), mini_batch_size, insize);
+    }
+    return 1;
+}
+
+int load_target(SV *y)
+{
+    size_t outsize = network->layer[network->layers - 1].output_size;
+    if (host_y.size() < outsize * mini_batch_size) {
+       host_y.resize(outsize * mini_batch_size);
+    }
+    perl_rows_into(y, mini_batch_size, outsize, host_y.data());
+    if (debug == 1) {
+       std::cout << "host_y"<<std::endl;
+       print_2D_array(host_y.data(), mini_batch_size, outsize);
+    }
+    return 1;
+}
+
+void run_feed_forward() {
+    host_network_forward(network, host_x.data(), mini_batch_size);
+    if (debug == 1) {
+       for (size_t l = 0; l < network->layers; l++) {
+          std::cout << "Output after activation" << std::endl;
+          print_2D_array(network->layer[l].activation, mini_batch_size, network->layer[l].output_size);
+       }
+    }
+}
+
+void run_backpropagation() {
+    host_network_backprop(network, host_x.data());
+    if (debug == 1) {
+       for (size_t l = network->layers; l-- > 0;) {
+          std::cout << "New Weights Derivative" << std::endl;
+          print_2D_array(network->layer[l].weights_derivative, network->layer[l].output_size, network->layer[l].input_size);
+       }
+    }
+}
+
+void run_update_weights_and_biases(float modifier, float decay) {
+    host_network_update(network, modifier, decay);
+}
+
+int get_last_activated_output( SV *R ) {
+    // the GPU version returns outsize rows x batch columns, so transpose to match
+    host_layer_t *tail = &network->layer[network->layers - 1];
+    size_t RH = tail->output_size, RW = mini_batch_size;
+    std::vector<float> transposed(RH * RW);
+    for (size_t i = 0; i < RW; i++) {
+       for (size_t j = 0; j < RH; j++) {
+          transposed[j * RW + i] = tail->activation[i * RH + j];
+       }
+    }
+    rows_into_perl(transposed.data(), RH, RW, R);
+    return 0;
+}
+
+float calculate_cost(){
+    float sum = host_network_cost(network, host_y.data());
+    if (debug == 1) {
+       std::cout << "sum of cost before weights calc " << sum << std::endl;
+    }
+    return sum;
+}
+
+float calculate_weights_cost() {
+    return host_network_weights_cost(network);
+}
+
+void calculate_cost_derivative() {
+    host_network_cost_derivative(network, host_y.data());
+    if (debug == 1) {
+       host_layer_t *tail = &network->layer[network->layers - 1];
+       std::cout << "cost calc" << std::endl;
+       print_2D_array(tail->delta, mini_batch_size, tail->output_size);
+    }
+}
+
+void set_debug_on() {
+   debug = 1;
+}
+
+void set_debug_off() {
+   debug = 0;
+}
+
+void set_loss(int funcno) {
+   loss_function = funcno;
+   if (network != NULL) {
+      network->loss = funcno;
+   }
+}
+
+void set_threads(int threads) {
+   host_set_threads(threads);
+}
+
+int load_training_set(SV *perl_x, SV *perl_y) {
+    return pack_perl_set(perl_x, perl_y, network->layer[0].input_size, network->layer[network->layers - 1].output_size, train_x, train_y, &train_n, "load_training_set");
+}
+
+int load_evaluation_set(SV *perl_x, SV *perl_y) {
+    return pack_perl_set(perl_x, perl_y, network->layer[0].input_size, network->layer[network->layers - 1].output_size, eval_x, eval_y, &eval_n, "load_evaluation_set");
+}
+
+int save_checkpoint(char *filename) {
+    return host_network_save(network, filename);
+}
+
+int load_checkpoint(char *filename, int batch_size, SV *perl_info) {
+    if( !SvROK(perl_info) || SvTYPE(SvRV(perl_info)) != SVt_PVHV ){
+       fprintf(stderr, "load_checkpoint() : error, expecting a hash reference for the network sizes.\n");
+       return 1;
+    }
+    host_network_t *loaded = host_network_load(filename, batch_size);
+    if (loaded == NULL) {
+       return 1;
+    }
+    host_network_free(network); // replace any network already built
+    network = loaded;
+    loss_function = network->loss;
+    AV *sizes = newAV();
+    av_push(sizes, newSVuv(network->layer[0].input_size));
+    for (size_t l = 0; l < network->layers; l++) {
+       av_push(sizes, newSVuv(network->layer[l].output_size));
+    }
+    HV *hv = (HV *)SvRV(perl_info);
+    hv_store(hv, "sizes", 5, newRV_noinc((SV *)sizes), 0);
+    hv_store(hv, "loss", 4, newSViv(network->loss), 0);
+    host_x.resize(network->layer[0].input_size * batch_size);
+    host_y.resize(network->layer[network->layers - 1].output_size * batch_size);
+    mini_batch_size = batch_size;
+    return 0;
+}
+
+int train_epochs(int epochs, int batch_size, float eta, float decay, int seed, int monitor_training, int monitor_evaluation, char *checkpoint, SV *perl_stats) {
+    if( !SvROK(perl_stats) || SvTYPE(SvRV(perl_stats)) != SVt_PVHV ){
+       fprintf(stderr, "train_epochs() : error, expecting a hash reference for the stats.\n");
+       return 1;
+    }
+    if (train_n == 0) {
+       fprintf(stderr, "train_epochs() : error, no training set loaded.\n");
+       return 1;
+    }
+    if (batch_size < 1) {
+       fprintf(stderr, "train_epochs() : error, batch size %d, it must be at least 1.\n", batch_size);
+       return 1;
+    }
+    HV *hv = (HV *)SvRV(perl_stats);
+    std::vector<size_t> order(train_n);
+    for (int epoch = 0; epoch < epochs; epoch++) {
+       struct timespec start, end;
+       clock_gettime(CLOCK_MONOTONIC, &start);
+       host_shuffle_index(order.data(), train_n, (unsigned long long)seed + epoch);
+       if (host_network_train_epoch(network, train_x.data(), train_y.data(), train_n, order.data(), batch_size, eta, decay) != 0) {
+          return 1;
+       }
+       clock_gettime(CLOCK_MONOTONIC, &end);
+       push_stat(hv, "epoch_time", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+       double cost;
+       size_t correct;
+       // cost as ML::MVKernels::total_cost, the summed cost plus the sum of the squared weights, per sample
+       if (monitor_training) {
+          if (host_network_evaluate(network, train_x.data(), train_y.data(), train_n, batch_size, &cost, &correct) != 0) {
+             return 1;
+          }
+          push_stat(hv, "training_cost", (cost + host_network_weights_cost(network)) / train_n);
+          push_stat(hv, "training_accuracy", correct);
+       }
+       if (monitor_evaluation && eval_n > 0) {
+          if (host_network_evaluate(network, eval_x.data(), eval_y.data(), eval_n, batch_size, &cost, &correct) != 0) {
+             return 1;
+          }
+          push_stat(hv, "evaluation_cost", (cost + host_network_weights_cost(network)) / eval_n);
+          push_stat(hv, "evaluation_accuracy", correct);
+       }
+       // the weights are already on the host, so a checkpoint is just a write of each layer
+       if (checkpoint != NULL && checkpoint[0] != '\0' && save_checkpoint(checkpoint) != 0) {
+          return 1;
+       }
+    }
+    return 0;
+}
+
+void *inference_freeze() {
+    return host_inference_from_network(network);
+}
+
+void get_weights(SV *R, int i) {
+   host_layer_t *current = &network->layer[i];
+   rows_into_perl(current->weights, current->output_size, current->input_size, R);
+}
+
+void get_biases(SV *R, int i) {
+   host_layer_t *current = &network->layer[i];
+   rows_into_perl(current->bias, current->output_size, 1, R);
+}
@@ -0,0 +1,171 @@
+use Modern::Perl;
+package ML::MVHost;
+use File::Slurp;
+use Cwd qw(abs_path);
+
+sub new {
+   my $class = shift;
+   my $self = {};
+   return bless $self, $class;
+}
+
+
+use Inline CPP => Config =>
+        BUILD_NOISY => 0,
+        force_build => 0,
+        clean_after_build => 1,
+        warnings => 0,
+        INC => "-I" . abs_path(substr(__FILE__,0,-1*(length("/ML/MVHost.pm"))) . "/inc")  . " -I" . abs_path("./inc") . " ",
+        LIBS => "-L" . abs_path(substr(__FILE__,0,-1*(length("/ML/MVHost.pm"))) . "/lib") . " -L" . abs_path("./lib") . " -lHostKernel "
+;
+
+# the glue shared with the other backends (MVGlue.c) goes in front of MVHost.c, in the one source
+# Inline::CPP builds and binds
+use Inline CPP => read_file(abs_path(substr(__FILE__,0,-1*(length("/MVHost.pm")))) . "/MVGlue.c") . read_file(abs_path(substr(__FILE__,0,-1*(length("/MVHost.pm")))) . "/MVHost.c");
+
+sub c_add_node {
+   my $self = shift;
+   return add_node(@_);
+}
+
+sub c_reset_derivatives {
+   my $self = shift;
+   return reset_derivatives();
+}
+
+sub c_set_debug_on {
+   my $self = shift;
+   set_debug_on();
+}
+
+sub c_set_debug_off {
+   my $self = shift;
+   set_debug_off();
+}
+
+sub c_set_loss {
+   my $self = shift;
+   return set_loss(@_);
+}
+
+sub c_reserve_input_memory {
+   my $self = shift;
+   return reserve_input_memory(@_);
+}
+
+sub c_print_list {
+   my $self = shift;
+   print_list();
+}
+
+sub c_load_input {
+   my $self = shift;
+   return load_input(@_);
+}
+
+sub c_load_target {
+   my $self = shift;
+   return load_target(@_);
+}
+
+sub c_run_feed_forward {
+   my $self = shift;
+   return run_feed_forward();
+}
+
+sub c_get_last_activated_output {
+   my $self = shift;
+   return get_last_activated_output(@_);
+}
+
+sub c_calculate_cost_derivative {
+   my $self = shift;
+   calculate_cost_derivative();
+}
+
+sub c_calculate_cost {
+   my $self = shift;
+   calculate_cost();
+}
+
+sub c_calculate_weights_cost {
+   my $self = shift;
+   calculate_weights_cost();
+}
+sub c_run_backpropagation {
+   my $self = shift;
+   run_backpropagation();
+}
+
+sub c_run_update_weights_and_biases {
+   my $self = shift;
+   return run_update_weights_and_biases( @_ );
+}
+
+sub c_get_weights {
+   my $self = shift;
+   return get_weights(@_);
+}
+
+sub c_get_biases {
+   my $self = shift;
+   return get_biases(@_);
+}
+
+sub c_set_threads {
+   my $self = shift;
+   return set_threads(@_);
+}
+
+
+sub c_load_training_set {
+   my $self = shift;
+   return load_training_set(@_);
+}
+
+sub c_load_evaluation_set {
+   my $self = shift;
+   return load_evaluation_set(@_);
+}
+
+sub c_train_epochs {
+   my $self = shift;
+   return train_epochs(@_);
+}
+
+sub c_save_checkpoint {
+   my $self = shift;
+   return save_checkpoint(@_);
+}
+
+sub c_load_checkpoint {
+   my $self = shift;
+   return load_checkpoint(@_);
+}
+
+sub c_inference_load {
+   my $self = shift;
+   return inference_load(@_);
+}
+
+sub c_inference_freeze {
+   my $self = shift;
+   return inference_freeze(@_);
+}
+
+sub c_inference_predict {
+   my $self = shift;
+   return inference_predict(@_);
+}
+
+sub c_inference_classify {
+   my $self = shift;
+   return inference_classify(@_);
+}
+
+sub c_inference_free {
+   my $self = shift;
+   return inference_free(@_);
+}
+
+1;
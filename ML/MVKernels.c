@@ -12,15 +12,16 @@
 #include <vector>
 
 #include "MVKernels.h"
+#include "HostKernel.h"
+#include "HostProfile.h"
 #include "node_typedef.h"
 
 int debug = 0;
 int loss_function = 1;
+int covariance_engine = 1; // 1 = GPU kernel, 2 = blocked host (CPU) kernel
 
 int mini_batch_size;
-
-#define HAVE_PERL_VERSION(R, V, S) \
-    (PERL_REVISION > (R) || (PERL_REVISION == (R) && (PERL_VERSION > (V) || (PERL_VERSION == (V) && (PERL_SUBVERSION >= (S))))))
+int reserved_batch_size = 0; // the batch size the per-node buffers were allocated for
 
 float *host_Cost_Derivative;
 float *device_Cost_Derivative;
@@ -28,113 +29,11 @@ float *host_Cost;
 float *device_Cost;
 int dirty_dirty_weights = 0;
 
-// This section is boilerplace code to move data from Perl -> C and back again
-
-#define sv_setrv(s, r)  S_sv_setrv(aTHX_ s, r)
-
-static void S_sv_setrv(pTHX_ SV *sv, SV *rv)
-{
-  sv_setiv(sv, (IV)rv);
-#if !HAVE_PERL_VERSION(5, 24, 0)
-  SvIOK_off(sv);
-#endif
-  SvROK_on(sv);
-}
-
-int is_array_ref(
-        SV *array,
-        size_t *array_sz
-);
-int array_numelts_2D(
-        SV *array,
-        size_t *_Nd1,
-        size_t **_Nd2
-);
 int array_of_unsigned_int_into_AV(
         size_t *src,
         size_t src_sz,
         SV *dst
 );
-int array_of_int_into_AV(
-        int *src,
-        size_t src_sz,
-        SV *dst
-);
-
-int is_array_ref(
-        SV *array,
-        size_t *array_sz
-){
-        if( ! SvROK(array) ){ fprintf(stderr, "is_array_ref() : warning, input '%p' is not a reference.\n", array); return 0; }
-        if( SvTYPE(SvRV(array)) != SVt_PVAV ){ fprintf(stderr, "is_array_ref() : warning, input ref '%p' is not an ARRAY reference.\n", array); return 0; }
-        // it's an array, cast it to AV to get its len via av_len();
-        // yes, av_len needs to be bumped up
-        int asz = 1+av_len((AV *)SvRV(array));
-        if( asz < 0 ){ fprintf(stderr, "is_array_ref() : error, input array ref '%p' has negative size!\n", array); return 0; }
-        *array_sz = (size_t )asz;
-        return 1; // success, it is an array and size returned by ref, above
-}
-
-#define array_numelts_1D(A,B) (!is_array_ref(A,B))
-
-int array_numelts_2D(
-        SV *array,
-        size_t *_Nd1,
-        size_t **_Nd2
-){
-        size_t anN, anN2, *Nd2 = NULL;
-
-        if( ! is_array_ref(array, &anN) ){
-           fprintf(stderr, "is_array_ref_2D() : error, call to is_array_ref() has failed for array '%p'.\n", array);
-           return 1;
-        }
-
-        if( *_Nd2 == NULL ){
-           if( (Nd2=(size_t *)malloc(anN*sizeof(size_t))) == NULL ){
-               fprintf(stderr, "array_numelts_2D() : error, failed to allocate %zu bytes for %zu items for Nd2.\n", anN*sizeof(size_t), anN);
-               return 1;
-           }
-        } else Nd2 = *_Nd2;
-        AV *anAV = (AV *)SvRV(array);
-        size_t *pNd2 = &(Nd2[0]);
-        for(size_t i=0;i<anN;i++,pNd2++){
-           SV *subarray = *av_fetch(anAV, i, FALSE);
-           if( ! is_array_ref(subarray, &anN2) ){
-              fprintf(stderr, "is_array_ref_2D() : error, call to is_array_ref() has failed for [%p][%p], item %zu.\n", array, subarray, i);
-              if(*_Nd2==NULL) free(Nd2);
-              return 1;
-           }
-           *pNd2 = anN2;
-        }
-        if( *_Nd2 == NULL ) *_Nd2 = Nd2;
-        *_Nd1 = anN;
-        return 0; // success
-}
-
-int array_of_int_into_AV(
-        int *src,
-        size_t src_sz,
-        SV *dst
-){
-        size_t dst_sz;
-        if( ! is_array_ref(dst, &dst_sz) ){ fprintf(stderr, "array_of_int_into_AV() : error, call to is_array_ref() has failed.\n"); return 1; }
-        AV *dstAV = (AV *)SvRV(dst);
-        for(size_t i=0;i<src_sz;i++){
-                av_push(dstAV, newSViv(src[i]));
-        }
-        return 0; // success
-}
-// end of Perl -> C -> Perl section
-void print_2D_array(float *foo, int rows, int cols) {
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            printf("%+.5f\t", foo[i * cols + j]);
-        }
-        printf("\n");
-    }
-    printf("\n");
-}
-
 
 node_t * head = NULL;
 node_t * tail = NULL;
@@ -152,6 +51,68 @@ float *host_y_transposed;
 float *device_y_transposed; 
 SV    *perl_y; 
 
+node* allocate_node(int insize, int outsize, int batch_size)
+{
+    node_t * new_node = (node_t *)malloc(sizeof(node_t));
+    new_node->input_size = insize;
+    new_node->output_size = outsize;
+    new_node->perl_Bias = NULL;
+    new_node->perl_Weights = NULL;
+    new_node->device_Bias = gpu_device_malloc(sizeof(float)*outsize);
+    new_node->host_Bias = gpu_host_malloc(sizeof(float)*outsize*1);
+    new_node->host_Weights = gpu_host_malloc(sizeof(float)*outsize*insize);
+    new_node->device_Weights = gpu_device_malloc(sizeof(float)*insize*outsize);
+// reserve memory for output and activated output (both 1 x outsize)
+    new_node->host_Output = gpu_host_malloc(sizeof(float)*outsize*batch_size);
+    new_node->device_Output = gpu_device_malloc(sizeof(float)*batch_size*outsize);
+    new_node->host_Activated_Output = gpu_host_malloc(sizeof(float)*outsize*batch_size);
+    new_node->device_Activated_Output = gpu_device_malloc(sizeof(float)*batch_size*outsize);
+    new_node->host_Activated_Output_Derivative = gpu_host_malloc(sizeof(float)*outsize*batch_size);
+    new_node->device_Activated_Output_Derivative = gpu_device_malloc(sizeof(float)*batch_size*outsize);
+    new_node->host_Activated_Output_Transposed = gpu_host_malloc(sizeof(float)*outsize*batch_size);
+    new_node->device_Activated_Output_Transposed = gpu_device_malloc(sizeof(float)*batch_size*outsize);
+// reserve memory for deriviatives, bias = 1 * outsize, weight = insize * outsize
+    new_node->host_Weights_Derivative = gpu_host_malloc(sizeof(float)*outsize*insize);
+    new_node->device_Weights_Derivative = gpu_device_malloc(sizeof(float)*insize*outsize);
+    new_node->host_Bias_Derivative = gpu_host_malloc(sizeof(float)*outsize*batch_size);
+    new_node->device_Bias_Derivative = gpu_device_malloc(sizeof(float)*batch_size*outsize);
+// reserve memory for transposed Weights
+    new_node->host_Weights_Transposed = gpu_host_malloc(sizeof(float)*outsize*insize);
+    new_node->device_Weights_Transposed = gpu_device_malloc(sizeof(float)*insize*outsize);
+// reserve memory for temporary derivative calculation
+    new_node->host_Delta = gpu_host_malloc(sizeof(float)*outsize*batch_size);
+    new_node->device_Delta = gpu_device_malloc(sizeof(float)*batch_size*outsize);
+         
+    new_node->next = NULL; 
+    new_node->prev = NULL; 
+    return new_node;
+}
+
+void free_node(node_t *node)
+{
+    gpu_free_device((void *)node->device_Bias);
+    gpu_free_host((void *)node->host_Bias);
+    gpu_free_host((void *)node->host_Weights);
+    gpu_free_device((void *)node->device_Weights);
+    gpu_free_host((void *)node->host_Output);
+    gpu_free_device((void *)node->device_Output);
+    gpu_free_host((void *)node->host_Activated_Output);
+    gpu_free_device((void *)node->device_Activated_Output);
+    gpu_free_host((void *)node->host_Activated_Output_Derivative);
+    gpu_free_device((void *)node->device_Activated_Output_Derivative);
+    gpu_free_host((void *)node->host_Activated_Output_Transposed);
+    gpu_free_device((void *)node->device_Activated_Output_Transposed);
+    gpu_free_host((void *)node->host_Weights_Derivative);
+    gpu_free_device((void *)node->device_Weights_Derivative);
+    gpu_free_host((void *)node->host_Bias_Derivative);
+    gpu_free_device((void *)node->device_Bias_Derivative);
+    gpu_free_host((void *)node->host_Weights_Transposed);
+    gpu_free_device((void *)node->device_Weights_Transposed);
+    gpu_free_host((void *)node->host_Delta);
+    gpu_free_device((void *)node->device_Delta);
+    free(node);
+}
+
 node* create_node(int insize, int outsize, SV *biases, SV *weights, int batch_size)
 {
     AV *av;
@@ -160,15 +121,10 @@ node* create_node(int insize, int outsize, SV *biases, SV *weights, int batch_si
     size_t AH, AW, *AWs = NULL;
     SV *subav, *subsubav;
 
-    node_t * new_node = (node_t *)malloc(sizeof(node_t));
-    new_node->input_size = insize;
-    new_node->output_size = outsize;
+    node_t * new_node = allocate_node(insize, outsize, batch_size);
     new_node->perl_Bias = biases;
     new_node->perl_Weights = weights;
 // convert Perl bias array to C array of floats and push it onto the GPU
-    new_node->device_Bias = gpu_device_malloc(sizeof(float)*outsize);
-    new_node->host_Bias = gpu_host_malloc(sizeof(float)*outsize*1);
-
     array_numelts_2D(new_node->perl_Bias, &AH, &AWs);
     AW = AWs[0];
 
@@ -183,8 +139,6 @@ node* create_node(int insize, int outsize, SV *biases, SV *weights, int batch_si
        }
     }
 // convert Perl weight array to C array of floats and push it onto the GPU
-    new_node->host_Weights = gpu_host_malloc(sizeof(float)*outsize*insize);
-    new_node->device_Weights = gpu_device_malloc(sizeof(float)*insize*outsize);
     pd = &(new_node->host_Weights[0]);
     av = (AV *)SvRV(new_node->perl_Weights);
     for(i=0;i<outsize;i++){ // for each row
@@ -197,40 +151,11 @@ node* create_node(int insize, int outsize, SV *biases, SV *weights, int batch_si
     }
     gpu_memcpy_to_device(new_node->host_Bias, new_node->device_Bias, outsize*sizeof(float));
     gpu_memcpy_to_device(new_node->host_Weights, new_node->device_Weights, insize*outsize*sizeof(float));
-// reserve memory for output and activated output (both 1 x outsize)
-    new_node->host_Output = gpu_host_malloc(sizeof(float)*outsize*batch_size);
-    new_node->device_Output = gpu_device_malloc(sizeof(float)*batch_size*outsize);
-    new_node->host_Activated_Output = gpu_host_malloc(sizeof(float)*outsize*batch_size);
-    new_node->device_Activated_Output = gpu_device_malloc(sizeof(float)*batch_size*outsize);
-    new_node->host_Activated_Output_Derivative = gpu_host_malloc(sizeof(float)*outsize*batch_size);
-    new_node->device_Activated_Output_Derivative = gpu_device_malloc(sizeof(float)*batch_size*outsize);
-    new_node->host_Activated_Output_Transposed = gpu_host_malloc(sizeof(float)*outsize*batch_size);
-    new_node->device_Activated_Output_Transposed = gpu_device_malloc(sizeof(float)*batch_size*outsize);
-// reserve memory for deriviatives, bias = 1 * outsize, weight = insize * outsize
-    new_node->host_Weights_Derivative = gpu_host_malloc(sizeof(float)*outsize*insize);
-    new_node->device_Weights_Derivative = gpu_device_malloc(sizeof(float)*insize*outsize);
-    new_node->host_Bias_Derivative = gpu_host_malloc(sizeof(float)*outsize*batch_size);
-    new_node->device_Bias_Derivative = gpu_device_malloc(sizeof(float)*batch_size*outsize);
-// reserve memory for transposed Weights
-    new_node->host_Weights_Transposed = gpu_host_malloc(sizeof(float)*outsize*insize);
-    new_node->device_Weights_Transposed = gpu_device_malloc(sizeof(float)*insize*outsize);
-// reserve memory for temporary derivative calculation
-    new_node->host_Delta = gpu_host_malloc(sizeof(float)*outsize*batch_size);
-    new_node->device_Delta = gpu_device_malloc(sizeof(float)*batch_size*outsize);
-         
-    new_node->next = NULL; 
-    new_node->prev = NULL; 
     return new_node;
 }        
 
-int add_node(int insize, int outsize, SV *biases, SV *weights, int batch_size)
+void link_node(node_t *new_node)
 {
-
-    node_t* new_node = create_node(insize, outsize, biases, weights, batch_size); 
-    if (new_node == NULL) {
-       std::cerr << "no node created for " << insize << " x " << outsize << std::endl;
-       return 0;
-    }
     if (tail == NULL) { 
         head = new_node; 
         tail = new_node; 
@@ -240,6 +165,17 @@ int add_node(int insize, int outsize, SV *biases, SV *weights, int batch_size)
         tail->next = new_node; 
         tail = new_node; 
     } 
+}
+
+int add_node(int insize, int outsize, SV *biases, SV *weights, int batch_size)
+{
+
+    node_t* new_node = create_node(insize, outsize, biases, weights, batch_size); 
+    if (new_node == NULL) {
+       std::cerr << "no node created for " << insize << " x " << outsize << std::endl;
+       return 0;
+    }
+    link_node(new_node);
     return 1;
 }
 
@@ -258,9 +194,26 @@ void reset_derivatives() {
     }
 }
 
+void release_input_memory()
+{
+// the staging buffers of the last reserve_input_memory, before a new network (or a checkpoint)
+// reserves its own; freeing NULL is a no-op for both runtimes
+    float **host[] = { &host_x, &host_x_transposed, &host_y, &host_y_transposed, &host_Cost_Derivative, &host_Cost };
+    float **device[] = { &device_x, &device_x_transposed, &device_y, &device_y_transposed, &device_Cost_Derivative, &device_Cost };
+    for (float **p : host) {
+       gpu_free_host((void *)*p);
+       *p = NULL;
+    }
+    for (float **p : device) {
+       gpu_free_device((void *)*p);
+       *p = NULL;
+    }
+}
+
 int reserve_input_memory(int insize, int outsize, int batch_size)
 {  
 // memory for input array
+    release_input_memory();
 
     host_x = gpu_host_malloc(sizeof(float)*insize*batch_size); 
     host_x_transposed = gpu_host_malloc(sizeof(float)*insize*batch_size);
@@ -279,9 +232,37 @@ int reserve_input_memory(int insize, int outsize, int batch_size)
     device_Cost = gpu_device_malloc(sizeof(float)*outsize*batch_size);
 
     mini_batch_size = batch_size;
+    reserved_batch_size = batch_size;
     return 1;
 }
 
+void input_to_device()
+{
+    size_t insize = head->input_size;
+    // host_x_transposed holds mini_batch_size rows of input, transfer to device
+    gpu_memcpy_to_device(host_x_transposed, device_x_transposed, mini_batch_size*insize*sizeof(float));
+    run_gpu_transpose_2D_array(device_x_transposed, device_x, mini_batch_size, insize);
+    if (debug == 1) {
+       gpu_memcpy_from_device(host_x, device_x, insize*mini_batch_size*sizeof(float));
+       std::cout << "host_x"<<std::endl;
+       print_2D_array(host_x, insize, mini_batch_size);
+    }
+}
+
+void target_to_device()
+{
+    size_t outsize = tail->output_size;
+    // host_y_transposed holds mini_batch_size rows of targets, transfer to device
+    gpu_memcpy_to_device(host_y_transposed, device_y_transposed, mini_batch_size*outsize*sizeof(float));
+    run_gpu_transpose_2D_array(device_y_transposed, device_y, mini_batch_size, outsize);
+    if (debug == 1) {
+printf("host_y %p device_y %p\n", host_y, device_y);
+       gpu_memcpy_from_device(host_y, device_y, outsize*mini_batch_size*sizeof(float));
+       std::cout << "host_y"<<std::endl;
+       print_2D_array(host_y, outsize, mini_batch_size);
+    }
+}
+
 int load_input(SV *x, int elements) 
 {
 // insize x 1 input array
@@ -289,10 +270,12 @@ int load_input(SV *x, int elements)
     float *pd;
     size_t i,j,insize;
     SV *subav, *subsubav; 
+    HOST_PROFILE_SCOPE("nn.load_input");
     mini_batch_size = elements;
     pd = &(host_x_transposed[0]);
     av = (AV *)SvRV(x);
     insize = head->input_size;
+    HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * elements * insize);
 
     for(i=0;i<elements;i++){ // for each row
        subav = *av_fetch(av, i, FALSE);
@@ -302,15 +285,7 @@ int load_input(SV *x, int elements)
           pd++;
        }
     }
-    // now transfer to device
-    gpu_memcpy_to_device(host_x_transposed, device_x_transposed, mini_batch_size*insize*sizeof(float));
-    run_gpu_transpose_2D_array(device_x_transposed, device_x, mini_batch_size, insize);
-    if (debug == 1) {
-       gpu_memcpy_from_device(host_x, device_x, insize*mini_batch_size*sizeof(float));
-       std::cout << "host_x"<<std::endl;
-       print_2D_array(host_x, insize, mini_batch_size);
-    }
-
+    input_to_device();
     return 1;
 }
 
@@ -321,9 +296,11 @@ int load_target(SV *y)
     float *pd; 
     size_t i,j,outsize;
     SV *subav, *subsubav; 
+    HOST_PROFILE_SCOPE("nn.load_target");
     pd = &(host_y_transposed[0]);
     av = (AV *)SvRV(y);
     outsize = tail->output_size;
+    HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * mini_batch_size * outsize);
     for(i=0;i<mini_batch_size;i++){ // for each row
        subav = *av_fetch(av, i, FALSE);
        for(j=0;j<outsize;j++){ // for the cols of that row
@@ -332,16 +309,7 @@ int load_target(SV *y)
           pd++;
        }
     }
-    // now transfer to device
-    gpu_memcpy_to_device(host_y_transposed, device_y_transposed, mini_batch_size*outsize*sizeof(float));
-    run_gpu_transpose_2D_array(device_y_transposed, device_y, mini_batch_size, outsize);
-    if (debug == 1) {
-printf("host_y %p device_y %p\n", host_y, device_y);
-       gpu_memcpy_from_device(host_y, device_y, outsize*mini_batch_size*sizeof(float));
-       std::cout << "host_y"<<std::endl;
-       print_2D_array(host_y, outsize, mini_batch_size);
-    }
-
+    target_to_device();
     return 1;
 }  
 
@@ -352,7 +320,9 @@ void run_feed_forward() {
     float *activation;
     activation = device_x;
     run_gpu_transpose_2D_array(activation, device_x_transposed, head->input_size,1);
+    int layer = 0;
     while (current != NULL) {
+        HOST_PROFILE_SCOPE("nn.forward", layer++);
         run_gpu_linear( activation, current->device_Weights, current->device_Bias, current->device_Output, current->output_size, current->input_size, mini_batch_size );
         if (debug == 1) {
            if (current == head) {
@@ -389,6 +359,11 @@ void run_feed_forward() {
 
 void run_backpropagation() {
    node_t *current = tail;
+   int layer = 0;
+   for (node_t *n = head; n != tail; n = n->next) {
+      layer++;
+   }
+   HOST_PROFILE_BEGIN(last_layer, "nn.backward", layer);
 
    //float *delta = device_Cost_Derivative;
    gpu_memcpy_intra_device( device_Cost_Derivative, current->device_Delta, mini_batch_size * current->output_size*sizeof(float));
@@ -417,9 +392,11 @@ void run_backpropagation() {
       std::cout << "Last Layer Backpass Weights Derivative" << std::endl;
       print_2D_array(current->host_Weights_Derivative, current->output_size, current->input_size);
    }
+   HOST_PROFILE_END(last_layer);
 
    current = current->prev;
    while (current != NULL) {
+      HOST_PROFILE_SCOPE("nn.backward", --layer);
 // do the back prop
       run_gpu_sigmoid_prime(current->device_Activated_Output, current->device_Activated_Output_Derivative,current->output_size, mini_batch_size);
       if (debug == 1) {
@@ -465,6 +442,7 @@ void run_backpropagation() {
 }
 
 void run_update_weights_and_biases(float modifier, float decay) {
+   HOST_PROFILE_SCOPE("nn.update");
    node_t * current = head;
 
    while (current != NULL) {
@@ -592,6 +570,170 @@ void calculate_cost_derivative() {
    }
 }
 
+int load_training_set(SV *perl_x, SV *perl_y) {
+    return pack_perl_set(perl_x, perl_y, head->input_size, tail->output_size, train_x, train_y, &train_n, "load_training_set");
+}
+
+int load_evaluation_set(SV *perl_x, SV *perl_y) {
+    return pack_perl_set(perl_x, perl_y, head->input_size, tail->output_size, eval_x, eval_y, &eval_n, "load_evaluation_set");
+}
+
+void evaluate_set(float *x, float *y, size_t n, size_t batch_size, double *cost, size_t *correct) {
+    size_t insize = head->input_size, outsize = tail->output_size;
+    *cost = 0;
+    *correct = 0;
+    for (size_t b = 0; b < n; b += batch_size) {
+       mini_batch_size = std::min(batch_size, n - b);
+       memcpy(host_x_transposed, x + b * insize, mini_batch_size * insize * sizeof(float));
+       memcpy(host_y_transposed, y + b * outsize, mini_batch_size * outsize * sizeof(float));
+       input_to_device();
+       target_to_device();
+       run_feed_forward();
+       *cost += calculate_cost();
+       // the output is outsize x mini_batch_size, first maximum wins as in ML::MVKernels::argmax
+       gpu_memcpy_from_device(tail->host_Activated_Output, tail->device_Activated_Output, mini_batch_size * outsize * sizeof(float));
+       float *a = tail->host_Activated_Output, *t = y + b * outsize;
+       for (size_t i = 0; i < (size_t)mini_batch_size; i++) {
+          size_t guess = 0, actual = 0;
+          for (size_t j = 1; j < outsize; j++) {
+             if (a[j * mini_batch_size + i] > a[guess * mini_batch_size + i]) guess = j;
+             if (t[i * outsize + j] > t[i * outsize + actual]) actual = j;
+          }
+          if (guess == actual) {
+             (*correct)++;
+          }
+       }
+    }
+}
+
+int save_checkpoint(char *filename) {
+    // copy the weights back from the device and write them out as one binary checkpoint
+    std::vector<size_t> sizes;
+    std::vector<const float *> weights, biases;
+    sizes.push_back(head->input_size);
+    for (node_t *current = head; current != NULL; current = current->next) {
+       gpu_memcpy_from_device(current->host_Weights, current->device_Weights, current->output_size*current->input_size*sizeof(float));
+       gpu_memcpy_from_device(current->host_Bias, current->device_Bias, current->output_size*sizeof(float));
+       sizes.push_back(current->output_size);
+       weights.push_back(current->host_Weights);
+       biases.push_back(current->host_Bias);
+    }
+    dirty_dirty_weights = 0;
+    return host_checkpoint_save(filename, loss_function, weights.size(), sizes.data(), weights.data(), biases.data());
+}
+
+int load_checkpoint(char *filename, int batch_size, SV *perl_info) {
+    if( !SvROK(perl_info) || SvTYPE(SvRV(perl_info)) != SVt_PVHV ){
+       fprintf(stderr, "load_checkpoint() : error, expecting a hash reference for the network sizes.\n");
+       return 1;
+    }
+    host_checkpoint_t *cp = host_checkpoint_open(filename);
+    if (cp == NULL) {
+       return 1;
+    }
+    // replace any network already built
+    while (head != NULL) {
+       node_t *next = head->next;
+       free_node(head);
+       head = next;
+    }
+    tail = NULL;
+    AV *sizes = newAV();
+    av_push(sizes, newSVuv(cp->sizes[0]));
+    for (size_t l = 0; l < cp->layers; l++) {
+       // straight from the mapped file to the pinned host buffer and on to the device
+       node_t *new_node = allocate_node(cp->sizes[l], cp->sizes[l + 1], batch_size);
+       memcpy(new_node->host_Weights, cp->weights[l], cp->sizes[l + 1] * cp->sizes[l] * sizeof(float));
+       memcpy(new_node->host_Bias, cp->bias[l], cp->sizes[l + 1] * sizeof(float));
+       gpu_memcpy_to_device(new_node->host_Bias, new_node->device_Bias, cp->sizes[l + 1]*sizeof(float));
+       gpu_memcpy_to_device(new_node->host_Weights, new_node->device_Weights, cp->sizes[l]*cp->sizes[l + 1]*sizeof(float));
+       link_node(new_node);
+       av_push(sizes, newSVuv(cp->sizes[l + 1]));
+    }
+    loss_function = cp->loss;
+    HV *hv = (HV *)SvRV(perl_info);
+    hv_store(hv, "sizes", 5, newRV_noinc((SV *)sizes), 0);
+    hv_store(hv, "loss", 4, newSViv(cp->loss), 0);
+    reserve_input_memory(cp->sizes[0], cp->sizes[cp->layers], batch_size);
+    host_checkpoint_close(cp);
+    reset_derivatives();
+    return 0;
+}
+
+int train_epochs(int epochs, int batch_size, float eta, float decay, int seed, int monitor_training, int monitor_evaluation, char *checkpoint, SV *perl_stats) {
+    if( !SvROK(perl_stats) || SvTYPE(SvRV(perl_stats)) != SVt_PVHV ){
+       fprintf(stderr, "train_epochs() : error, expecting a hash reference for the stats.\n");
+       return 1;
+    }
+    if (train_n == 0) {
+       fprintf(stderr, "train_epochs() : error, no training set loaded.\n");
+       return 1;
+    }
+    if (batch_size < 1) {
+       fprintf(stderr, "train_epochs() : error, batch size %d, it must be at least 1.\n", batch_size);
+       return 1;
+    }
+    if (batch_size > reserved_batch_size) {
+       fprintf(stderr, "train_epochs() : error, batch size %d is larger than the %d the network was created with.\n", batch_size, reserved_batch_size);
+       return 1;
+    }
+    HV *hv = (HV *)SvRV(perl_stats);
+    size_t insize = head->input_size, outsize = tail->output_size;
+    std::vector<size_t> order(train_n);
+    for (int epoch = 0; epoch < epochs; epoch++) {
+       struct timespec start, end;
+       clock_gettime(CLOCK_MONOTONIC, &start);
+       host_shuffle_index(order.data(), train_n, (unsigned long long)seed + epoch);
+       for (size_t b = 0; b < train_n; b += batch_size) {
+          mini_batch_size = std::min((size_t)batch_size, train_n - b);
+          // gather the batch straight into the pinned staging buffers
+          host_gather_rows(train_x.data(), insize, order.data() + b, mini_batch_size, host_x_transposed);
+          host_gather_rows(train_y.data(), outsize, order.data() + b, mini_batch_size, host_y_transposed);
+          input_to_device();
+          target_to_device();
+          run_feed_forward();
+          calculate_cost_derivative();
+          run_backpropagation();
+          run_update_weights_and_biases(eta / mini_batch_size, decay);
+          reset_derivatives();
+       }
+       clock_gettime(CLOCK_MONOTONIC, &end);
+       push_stat(hv, "epoch_time", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+       double cost;
+       size_t correct;
+       // cost as ML::MVKernels::total_cost, the summed cost plus the sum of the squared weights, per sample
+       if (monitor_training) {
+          evaluate_set(train_x.data(), train_y.data(), train_n, batch_size, &cost, &correct);
+          push_stat(hv, "training_cost", (cost + calculate_weights_cost()) / train_n);
+          push_stat(hv, "training_accuracy", correct);
+       }
+       if (monitor_evaluation && eval_n > 0) {
+          evaluate_set(eval_x.data(), eval_y.data(), eval_n, batch_size, &cost, &correct);
+          push_stat(hv, "evaluation_cost", (cost + calculate_weights_cost()) / eval_n);
+          push_stat(hv, "evaluation_accuracy", correct);
+       }
+       if (checkpoint != NULL && checkpoint[0] != '\0' && save_checkpoint(checkpoint) != 0) {
+          return 1;
+       }
+    }
+    return 0;
+}
+
+void *inference_freeze() {
+    // a CPU copy of the network as it stands, the weights copied back from the device
+    std::vector<size_t> sizes;
+    std::vector<const float *> weights, biases;
+    sizes.push_back(head->input_size);
+    for (node_t *current = head; current != NULL; current = current->next) {
+       gpu_memcpy_from_device(current->host_Weights, current->device_Weights, current->output_size*current->input_size*sizeof(float));
+       gpu_memcpy_from_device(current->host_Bias, current->device_Bias, current->output_size*sizeof(float));
+       sizes.push_back(current->output_size);
+       weights.push_back(current->host_Weights);
+       biases.push_back(current->host_Bias);
+    }
+    return host_inference_create(weights.size(), sizes.data(), weights.data(), biases.data());
+}
+
 void set_debug_on() {
    debug = 1;
 }
@@ -604,6 +746,10 @@ void set_loss(int funcno) {
    loss_function = funcno;
 }
 
+void set_covariance_engine(int engineno) {
+   covariance_engine = engineno;
+}
+
 void get_weights(SV *R, int i) {
    node_t * current = head;
    AV *av, *av2;
@@ -692,80 +838,186 @@ void get_biases(SV *R, int i) {
 float *host_Data, *host_Z, *host_Cov, *host_Means, *host_Stddev,
          *device_Data, *device_Z, *device_Cov, *device_Means, *device_Stddev
 ;
-size_t CCH, CCW;
+float *l2norm;
+float *device_dotp;
+float *device_R_T,
+         *device_Sums, *host_Sums;
+float *device_pQ; // we'll need this for the projection later on
 
-int calculate_covariance(SV *perl_Data, SV *perl_Cov) {
-   // move Data to a C array
-   size_t DH, DW, *DWs = NULL, // all of the arrays are the same size
-          i, j, asz
-        ;
-   SV *subav, *subsubav, **ssubav;
+// Workspace arena for the PCA working arrays.  Every array has a slot which only ever grows, so
+// once a workspace has seen its largest input shape later calls reuse the same memory and make
+// no allocations at all.  Each ML::PCA object has its own workspace, selected with
+// pca_workspace_use before it calls in; anything else uses the default one.
+
+// WS_HOST buffers are copied to or from the device and so are pinned; WS_ALIGNED ones never are,
+// and come from the host library's allocator instead of using up locked memory
+enum ws_kind { WS_HOST, WS_DEVICE, WS_DEVICE_INT, WS_ALIGNED };
+enum ws_slot {
+   WS_HOST_DATA, WS_HOST_Z, WS_HOST_COV, WS_HOST_MEANS, WS_HOST_STDDEV,
+   WS_DEVICE_DATA, WS_DEVICE_Z, WS_DEVICE_COV, WS_DEVICE_MEANS, WS_DEVICE_STDDEV,
+   WS_QR_L2NORM, WS_QR_DOTP, WS_QR_R_T,
+   WS_HOST_PQ, WS_DEVICE_PQ, WS_DEVICE_PQ2, WS_DEVICE_R, WS_DEVICE_Q,
+   WS_HOST_SUMS, WS_DEVICE_SUMS, WS_SUMS_INDICIES, WS_DEVICE_SUMS_INDICIES,
+   WS_HOST_P, WS_DEVICE_P, WS_COMPONENTS, WS_TRANSFORM_IN, WS_TRANSFORM_OUT,
+   WS_SLOTS
+};
+static const int ws_slot_kind[WS_SLOTS] = {
+   WS_HOST, WS_HOST, WS_HOST, WS_HOST, WS_HOST,
+   WS_DEVICE, WS_DEVICE, WS_DEVICE, WS_DEVICE, WS_DEVICE,
+   WS_DEVICE, WS_DEVICE, WS_DEVICE,
+   WS_HOST, WS_DEVICE, WS_DEVICE, WS_DEVICE, WS_DEVICE,
+   WS_HOST, WS_DEVICE, WS_ALIGNED, WS_DEVICE_INT,
+   WS_HOST, WS_DEVICE, WS_ALIGNED, WS_ALIGNED, WS_ALIGNED
+};
+
+typedef struct pca_workspace {
+   void   *ptr[WS_SLOTS];
+   size_t capacity[WS_SLOTS];
+   size_t allocations;      // buffers (re)allocated since the workspace was created
+   size_t call_allocations; // buffers (re)allocated since the last pca_workspace_use
+   size_t reuses;           // requests satisfied by an existing buffer
+   size_t frees;
+   size_t host_bytes, device_bytes; // currently reserved
+} pca_workspace_t;
+
+pca_workspace_t default_workspace;
+pca_workspace_t *pca_ws = &default_workspace;
+
+// the globals above which the PCA steps point into the current workspace; ws_release clears any
+// that point at the buffer it frees, so once an object's workspace is gone nothing can use it
+static float **ws_aliases[] = {
+   &host_Data, &host_Z, &host_Cov, &host_Means, &host_Stddev,
+   &device_Data, &device_Z, &device_Cov, &device_Means, &device_Stddev,
+   &l2norm, &device_dotp, &device_R_T, &device_Sums, &host_Sums, &device_pQ
+};
+
+void ws_release(pca_workspace_t *ws, int slot) {
+   if (ws->ptr[slot] == NULL) {
+      return;
+   }
+   for (float **alias : ws_aliases) {
+      if (*alias == ws->ptr[slot]) {
+         *alias = NULL;
+      }
+   }
+   switch (ws_slot_kind[slot]) {
+      case WS_HOST:    gpu_free_host(ws->ptr[slot]); ws->host_bytes -= ws->capacity[slot]; break;
+      case WS_ALIGNED: host_free(ws->ptr[slot]); ws->host_bytes -= ws->capacity[slot]; break;
+      default:         gpu_free_device(ws->ptr[slot]); ws->device_bytes -= ws->capacity[slot]; break;
+   }
+   ws->ptr[slot] = NULL;
+   ws->capacity[slot] = 0;
+   ws->frees++;
+}
 
-   if( array_numelts_2D(perl_Data, &DH, &DWs) ){
-      fprintf(stderr, "cuda_covariance() : error, call to array_numelts_2D() has failed for input matrix Data.\n");
-      return 1;
+void *ws_reserve(int slot, size_t bytes) {
+   pca_workspace_t *ws = pca_ws;
+   if (bytes == 0) {
+      bytes = 1;
+   }
+   if (ws->ptr[slot] != NULL && ws->capacity[slot] >= bytes) {
+      ws->reuses++;
+      return ws->ptr[slot];
+   }
+   ws_release(ws, slot);
+   switch (ws_slot_kind[slot]) {
+      case WS_HOST:       ws->ptr[slot] = gpu_host_malloc(bytes); break;
+      case WS_ALIGNED:    ws->ptr[slot] = host_alloc(bytes); break;
+      case WS_DEVICE_INT: ws->ptr[slot] = gpu_device_malloc_int(bytes); break;
+      default:            ws->ptr[slot] = gpu_device_malloc(bytes); break;
+   }
+   if (ws->ptr[slot] == NULL) {
+      fprintf(stderr, "ws_reserve() : error, failed to allocate %zu bytes for workspace slot %d.\n", bytes, slot);
+      return NULL;
+   }
+   ws->capacity[slot] = bytes;
+   bool on_host = ws_slot_kind[slot] == WS_HOST || ws_slot_kind[slot] == WS_ALIGNED;
+   if (on_host) {
+      ws->host_bytes += bytes;
+   } else {
+      ws->device_bytes += bytes;
    }
+   HOST_PROFILE_COUNT(on_host ? "bytes_allocated" : "device_bytes_allocated", bytes);
+   ws->allocations++;
+   ws->call_allocations++;
+   return ws->ptr[slot];
+}
 
-   CCH = DH; // CCH needed later for the final projection to the required number of columns
+void *pca_workspace_create() {
+   return calloc(1, sizeof(pca_workspace_t));
+}
 
-   DW = DWs[0];
+void pca_workspace_use(void *ws) {
+   pca_ws = (ws == NULL) ? &default_workspace : (pca_workspace_t *)ws;
+   pca_ws->call_allocations = 0;
+}
 
-   CCW = DW; // CCW needed later for the final projection to the required number of columns
-   if (debug == 1) {
-      std::cout << "CCH = " << CCH << " CCW " << CCW << std::endl;
+void pca_workspace_free(void *ws_ptr) {
+   pca_workspace_t *ws = (pca_workspace_t *)ws_ptr;
+   if (ws == NULL) {
+      return;
    }
-   if( is_array_ref(perl_Cov, &asz) ){
-      if( asz > 0 ){
-         AV *avd = (AV *)SvRV(perl_Cov);
-         av_clear(avd);
+   for (int slot = 0; slot < WS_SLOTS; slot++) {
+      ws_release(ws, slot);
+   }
+   if (pca_ws == ws) {
+      pca_ws = &default_workspace;
+   }
+   free(ws);
+}
+
+int pca_workspace_stats(void *ws_ptr, SV *perl_stats) {
+   pca_workspace_t *ws = (ws_ptr == NULL) ? &default_workspace : (pca_workspace_t *)ws_ptr;
+   if( !SvROK(perl_stats) || SvTYPE(SvRV(perl_stats)) != SVt_PVHV ){
+      fprintf(stderr, "pca_workspace_stats() : error, expecting a hash reference.\n");
+      return 1;
+   }
+   size_t buffers = 0;
+   for (int slot = 0; slot < WS_SLOTS; slot++) {
+      if (ws->ptr[slot] != NULL) {
+         buffers++;
       }
-   } else if( SvROK(perl_Cov) ){
-      // LeoNerd's suggestion:
-      sv_setrv(SvRV(perl_Cov), (SV *)newAV());
-   } else {
-      // LeoNerd's suggestion:
-      sv_setrv(perl_Cov, (SV *)newAV());
    }
+   HV *hv = (HV *)SvRV(perl_stats);
+   hv_store(hv, "allocations", 11, newSVuv(ws->allocations), 0);
+   hv_store(hv, "call_allocations", 16, newSVuv(ws->call_allocations), 0);
+   hv_store(hv, "reuses", 6, newSVuv(ws->reuses), 0);
+   hv_store(hv, "frees", 5, newSVuv(ws->frees), 0);
+   hv_store(hv, "buffers", 7, newSVuv(buffers), 0);
+   hv_store(hv, "host_bytes", 10, newSVuv(ws->host_bytes), 0);
+   hv_store(hv, "device_bytes", 12, newSVuv(ws->device_bytes), 0);
+   return 0;
+}
+size_t CCH, CCW;
+size_t CPW; // columns of the eigenvectors in device_pQ, CCW or the components kept by the Gram path
 
-   host_Data = gpu_host_malloc(sizeof(float)*DW*DH);
-   host_Z = gpu_host_malloc(sizeof(float)*DW*DH);
-   host_Cov = gpu_host_malloc(sizeof(float)*DW*DH);
-   host_Means = gpu_host_malloc(sizeof(float)*DW*DH);
-   host_Stddev = gpu_host_malloc(sizeof(float)*DW*DH);
+int covariance_allocate(size_t DH, size_t DW) {
+// working arrays for a DH x DW input, host_Data is then filled in by the caller; the DW x DW
+// covariance is only reserved when it is calculated, wide inputs go by way of the Gram matrix
+   host_Data = (float *)ws_reserve(WS_HOST_DATA, sizeof(float)*DW*DH);
+   host_Z = (float *)ws_reserve(WS_HOST_Z, sizeof(float)*DW*DH);
+   host_Means = (float *)ws_reserve(WS_HOST_MEANS, sizeof(float)*DW);
+   host_Stddev = (float *)ws_reserve(WS_HOST_STDDEV, sizeof(float)*DW);
 
 
    // allocate again for the device
-   device_Data = gpu_device_malloc(sizeof(float)*DW*DH);
-   device_Z = gpu_device_malloc(sizeof(float)*DW*DH);
-   device_Cov = gpu_device_malloc(sizeof(float)*DW*DH);
-   device_Means = gpu_device_malloc(sizeof(float)*DW*DH);
-   device_Stddev = gpu_device_malloc(sizeof(float)*DW*DH);
+   device_Data = (float *)ws_reserve(WS_DEVICE_DATA, sizeof(float)*DW*DH);
+   device_Z = (float *)ws_reserve(WS_DEVICE_Z, sizeof(float)*DW*DH);
+   device_Means = (float *)ws_reserve(WS_DEVICE_MEANS, sizeof(float)*DW);
+   device_Stddev = (float *)ws_reserve(WS_DEVICE_STDDEV, sizeof(float)*DW);
+   if( host_Data == NULL || host_Z == NULL || host_Means == NULL || host_Stddev == NULL
+       || device_Data == NULL || device_Z == NULL || device_Means == NULL || device_Stddev == NULL ){
+      return 1; // ws_reserve has said which
+   }
+   return 0;
+}
 
-   AV *av, *av2;
-   float *pd = &(host_Data[0]);
-   av = (AV *)SvRV(perl_Data);
-
-   for(i=0;i<DH;i++){ // for each row
-      ssubav = av_fetch(av, i, FALSE);
-      if( ssubav == NULL ){
-         fprintf(stderr, "cuda_covariance() : error, input matrix Data does not contain valid row at i=%d\n", i);
-         return 1;
-      }
-      subav = *ssubav;
-      for(j=0;j<DW;j++){ // for the cols of that row
-         ssubav = av_fetch((AV *)SvRV(subav), j, FALSE);
-         if( ssubav == NULL ){
-            fprintf(stderr, "cuda_covariance() : error, input matrix Data does not contain valid column at i=%d, j=%d\n", i, j);
-            return 1;
-         }
-         subsubav = *ssubav;
-         *pd = SvNV(subsubav);
-         pd++;
-      }
-   }
-   // transfer results from host to device for A
-   //print_2D_array(host_Data, DH, DW);
-   gpu_memcpy_to_device(host_Data, device_Data, DW*DH*sizeof(float));
+void standardise_host_data(size_t DH, size_t DW) {
+// the means, stddevs and z scores of host_Data, into device_Means, device_Stddev and device_Z
+   size_t i;
+   // transfer results from host to device for A
+   //print_2D_array(host_Data, DH, DW);
+   gpu_memcpy_to_device(host_Data, device_Data, DW*DH*sizeof(float));
 
    for(i=0;i<DW;i++) { // initialise the means and stddev arrays to 0
       host_Means[i] = 0;
@@ -775,19 +1027,25 @@ int calculate_covariance(SV *perl_Data, SV *perl_Cov) {
    gpu_memcpy_to_device(host_Means, device_Means, DW*sizeof(float));
    gpu_memcpy_to_device(host_Stddev, device_Stddev, DW*sizeof(float));
 
+   HOST_PROFILE_BEGIN(means, "pca.means");
    run_gpu_calc_means(device_Data, device_Means, DH, DW);
+   HOST_PROFILE_END(means);
    if (debug == 1) {
       gpu_memcpy_from_device(host_Means, device_Means, DW*sizeof(float));
       std::cout << "Means" << std::endl;
       print_2D_array(host_Means, 1, DW);
    }
+   HOST_PROFILE_BEGIN(stddev, "pca.stddev");
    run_gpu_calc_stddev(device_Data, device_Means, device_Stddev, DH, DW);
+   HOST_PROFILE_END(stddev);
    if (debug == 1) {
       gpu_memcpy_from_device(host_Stddev, device_Stddev, DW*sizeof(float));
       std::cout << "Stddev" << std::endl;
       print_2D_array(host_Stddev, 1, DW);
    }
+   HOST_PROFILE_BEGIN(z_scores, "pca.z_scores");
    run_gpu_assign_z_scores(device_Data, device_Means, device_Stddev, device_Z, DH, DW);
+   HOST_PROFILE_END(z_scores);
    if (debug == 1) {
       gpu_memcpy_from_device(host_Z, device_Z, DH*DW*sizeof(float));
       std::cout << "Z" << std::endl;
@@ -801,17 +1059,59 @@ int calculate_covariance(SV *perl_Data, SV *perl_Cov) {
       print_2D_array(host_Z, DH, DW);
    }
 */
-   run_gpu_calc_covariance(device_Z, device_Cov, DH, DW);
-   gpu_memcpy_from_device(host_Cov, device_Cov, DH*DW*sizeof(float));
+}
+
+int covariance_from_host_data(size_t DH, size_t DW) {
+// standardises host_Data on the device and calculates its covariance into host_Cov & device_Cov
+   standardise_host_data(DH, DW);
+   host_Cov = (float *)ws_reserve(WS_HOST_COV, sizeof(float)*DW*DW);
+   device_Cov = (float *)ws_reserve(WS_DEVICE_COV, sizeof(float)*DW*DW);
+   if( host_Cov == NULL || device_Cov == NULL ){
+      return 1;
+   }
+   HOST_PROFILE_BEGIN(covariance, "pca.covariance");
+   if (covariance_engine == 2) {
+      // only the upper triangle is calculated on the host, then mirrored, and the eigenvector
+      // code expects to find the result on the device
+      gpu_memcpy_from_device(host_Z, device_Z, DH*DW*sizeof(float));
+      host_calc_covariance(host_Z, host_Cov, DH, DW);
+      gpu_memcpy_to_device(host_Cov, device_Cov, DW*DW*sizeof(float));
+   } else {
+      run_gpu_calc_covariance(device_Z, device_Cov, DH, DW);
+      gpu_memcpy_from_device(host_Cov, device_Cov, DW*DW*sizeof(float));
+   }
+   HOST_PROFILE_END(covariance);
    if (debug == 1) {
       std::cout << "Cov" << std::endl;
       print_2D_array(host_Cov, DW, DW);
    }
+   return 0;
+}
+
+void covariance_into_perl(SV *perl_Cov, size_t DW) {
 // populate the Perl array ref for Cov
+   HOST_PROFILE_SCOPE("marshal.rows_out");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * DW * DW);
+   size_t i, j, asz;
+   float *pd;
+   AV *av, *av2;
+
+   if( is_array_ref(perl_Cov, &asz) ){
+      if( asz > 0 ){
+         AV *avd = (AV *)SvRV(perl_Cov);
+         av_clear(avd);
+      }
+   } else if( SvROK(perl_Cov) ){
+      // LeoNerd's suggestion:
+      sv_setrv(SvRV(perl_Cov), (SV *)newAV());
+   } else {
+      // LeoNerd's suggestion:
+      sv_setrv(perl_Cov, (SV *)newAV());
+   }
 
    pd = &(host_Cov[0]);
    av = (AV *)SvRV(perl_Cov);
-   av_extend(av, DH);
+   av_extend(av, DW);
    for(i=0;i<DW;i++){ // for each row
       av2 = newAV(); // make a new array for each row
       av_extend(av2, DW); // extend it to hold #cols items (RW)
@@ -822,98 +1122,51 @@ int calculate_covariance(SV *perl_Data, SV *perl_Cov) {
          pd++;
       }
    }
-
-   //CUDA_CHECK(cudaFree((void *)device_Z));
-   //CUDA_CHECK(cudaFree((void *)device_Cov));
-   //CUDA_CHECK(cudaFreeHost((void *)host_Cov));
-   //CUDA_CHECK(cudaFreeHost((void *)host_Z));
-   //CUDA_CHECK(cudaFree((void *)device_Means));
-   //CUDA_CHECK(cudaFreeHost((void *)host_Means));
-   //CUDA_CHECK(cudaFree((void *)device_Stddev));
-   //CUDA_CHECK(cudaFreeHost((void *)host_Stddev));
-
-   return 0;
-}
-
-float *l2norm;
-float *device_dotp;
-float *device_R_T,
-         *device_Sums, *host_Sums;
-int cuda_qr_initialised = 0;
-
-void cuda_qr_get_q_and_r(float *device_A, float *device_Q, float *device_R, size_t AH, size_t AW) {
-   size_t i;
-   if (cuda_qr_initialised == 0) {
-      l2norm = gpu_device_malloc(sizeof(float)); 
-      device_dotp = gpu_device_malloc(sizeof(float)*AW); 
-      device_R_T = gpu_device_malloc(sizeof(float)*AW*AH); 
-      cuda_qr_initialised = 1;
-   }
-   for (i=0;i<AW;i++) {
-      run_gpu_qr_column_mult(device_A, device_Q, device_dotp, AH, AW, i);
-      run_gpu_qr_column(device_A, device_Q, device_dotp, AH, AW, i);
-      run_gpu_qr_l2_norm(device_Q, l2norm, AH, AW, i);
-   }
-   run_gpu_matmul( device_A, device_Q,  device_R_T, AH, AW, AW);
-   run_gpu_transpose_2D_array(device_R_T, device_R,  AH, AW);
-   run_gpu_qr_clamp_r_to_0(device_R, AH, AW); // make sure the cells below the diagonal are 0, not just close to it
-}
-
-void cuda_qr_get_q_and_r_cleanup() {
-   gpu_free_device((void *)l2norm);
-   gpu_free_device((void *)device_dotp);
-   gpu_free_device((void *)device_R_T);
-
-   cuda_qr_initialised = 0;
 }
 
-bool sums_less_than(int i, int j) { return (host_Sums[i] < host_Sums[j]); }
-float *device_pQ; // we'll need this for the projection later on
-
-int cuda_eigenvectors( SV *perl_pQ, float epsilon, int max_iterations) ;
-int cuda_eigenvectors( SV *perl_pQ, float epsilon, int max_iterations) {
-// relies on host_Cov and device_Cov being already populated by calculate_covariance
-   size_t pQH, pQW, *pQWs = NULL,
-          XH, XW,
-          RH, RW, QH, QW,
-          i, j, asz
-        ;
-   float *host_pQ,
-         *device_pQ2, 
-         *device_Q, *device_R
+int data_into_host(SV *perl_Data) {
+   // move Data to a C array, sizing the working arrays and setting CCH & CCW
+   size_t DH, DW, *DWs = NULL, // all of the arrays are the same size
+          i, j
         ;
    SV *subav, *subsubav, **ssubav;
-   int *sums_indicies, *device_sums_indicies;
 
-   if( array_numelts_2D(perl_pQ, &pQH, &pQWs) ){
-      fprintf(stderr, "cuda_qr_get_q() : error, call to array_numelts_2D() has failed for input matrix pQ.\n");
+   if( array_numelts_2D(perl_Data, &DH, &DWs) ){
+      fprintf(stderr, "cuda_covariance() : error, call to array_numelts_2D() has failed for input matrix Data.\n");
       return 1;
    }
 
-   pQW = pQWs[0];
+   CCH = DH; // CCH needed later for the final projection to the required number of columns
 
-   XH = pQH; XW = pQW;
+   DW = DWs[0];
+   free(DWs);
 
+   CCW = DW; // CCW needed later for the final projection to the required number of columns
    if (debug == 1) {
-      printf("cuda_eigenvectors incoming pQ size = %d rows x %d columns\n", pQH, pQW);
+      std::cout << "CCH = " << CCH << " CCW " << CCW << std::endl;
    }
-   host_pQ = gpu_host_malloc(sizeof(float)*pQW*pQH);
 
-   AV *av, *av2;
-   float *pd = &(host_pQ[0]);
-   av = (AV *)SvRV(perl_pQ);
+   if( covariance_allocate(DH, DW) ){
+      return 1;
+   }
 
-   for(i=0;i<pQH;i++){ // for each row
+   AV *av;
+   HOST_PROFILE_BEGIN(marshal, "marshal.rows_in");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * DH * DW);
+   float *pd = &(host_Data[0]);
+   av = (AV *)SvRV(perl_Data);
+
+   for(i=0;i<DH;i++){ // for each row
       ssubav = av_fetch(av, i, FALSE);
       if( ssubav == NULL ){
-         fprintf(stderr, "inline_cuda_matrix_multiply() : error, input matrix pQ does not contain valid row at i=%d\n", i);
+         fprintf(stderr, "cuda_covariance() : error, input matrix Data does not contain valid row at i=%d\n", i);
          return 1;
       }
       subav = *ssubav;
-      for(j=0;j<pQW;j++){ // for the cols of that row
+      for(j=0;j<DW;j++){ // for the cols of that row
          ssubav = av_fetch((AV *)SvRV(subav), j, FALSE);
          if( ssubav == NULL ){
-            fprintf(stderr, "inline_cuda_matrix_multiply() : error, input matrix pQ does not contain valid column at i=%d, j=%d\n", i, j);
+            fprintf(stderr, "cuda_covariance() : error, input matrix Data does not contain valid column at i=%d, j=%d\n", i, j);
             return 1;
          }
          subsubav = *ssubav;
@@ -921,27 +1174,98 @@ int cuda_eigenvectors( SV *perl_pQ, float epsilon, int max_iterations) {
          pd++;
       }
    }
+   HOST_PROFILE_END(marshal);
+   return 0;
+}
+
+int calculate_covariance(SV *perl_Data, SV *perl_Cov) {
+   if( data_into_host(perl_Data) || covariance_from_host_data(CCH, CCW) ){
+      return 1;
+   }
+   covariance_into_perl(perl_Cov, CCW);
+   return 0;
+}
+
+int calculate_covariance_packed(void *matrix, SV *perl_Cov) {
+   // as calculate_covariance, for data already packed in an ML::Matrix
+   host_matrix_t *m = (host_matrix_t *)matrix;
+   if( m->rows == 0 || m->cols == 0 ){
+      fprintf(stderr, "calculate_covariance_packed() : error, input matrix is empty.\n");
+      return 1;
+   }
+   CCH = m->rows;
+   CCW = m->cols;
+   if( covariance_allocate(CCH, CCW) ){
+      return 1;
+   }
+   memcpy(host_Data, m->data, sizeof(float)*CCH*CCW);
+   if( covariance_from_host_data(CCH, CCW) ){
+      return 1;
+   }
+   covariance_into_perl(perl_Cov, CCW);
+   return 0;
+}
+
+int cuda_qr_get_q_and_r(float *device_A, float *device_Q, float *device_R, size_t AH, size_t AW) {
+   size_t i;
+   // reserved from the workspace each time, so a larger matrix gets larger buffers
+   l2norm = (float *)ws_reserve(WS_QR_L2NORM, sizeof(float)); 
+   device_dotp = (float *)ws_reserve(WS_QR_DOTP, sizeof(float)*AW); 
+   device_R_T = (float *)ws_reserve(WS_QR_R_T, sizeof(float)*AW*AH); 
+   if( l2norm == NULL || device_dotp == NULL || device_R_T == NULL ){
+      return 1;
+   }
+   for (i=0;i<AW;i++) {
+      run_gpu_qr_column_mult(device_A, device_Q, device_dotp, AH, AW, i);
+      run_gpu_qr_column(device_A, device_Q, device_dotp, AH, AW, i);
+      run_gpu_qr_l2_norm(device_Q, l2norm, AH, AW, i);
+   }
+   run_gpu_matmul( device_A, device_Q,  device_R_T, AH, AW, AW);
+   run_gpu_transpose_2D_array(device_R_T, device_R,  AH, AW);
+   run_gpu_qr_clamp_r_to_0(device_R, AH, AW); // make sure the cells below the diagonal are 0, not just close to it
+   return 0;
+}
+
+bool sums_less_than(int i, int j) { return (host_Sums[i] < host_Sums[j]); }
+
+int eigenvectors_from_host_pQ(float *host_pQ, size_t pQH, size_t pQW, float epsilon, int max_iterations) {
+// QR iterations on device_Cov starting from host_pQ; the sorted eigenvectors are left in device_pQ
+// and copied back to host_pQ
+   HOST_PROFILE_SCOPE("pca.eigenvectors");
+   size_t XH = pQH, XW = pQW,
+          RH, RW, QH, QW,
+          i
+        ;
+   float *device_pQ2, 
+         *device_Q, *device_R
+        ;
+   int *sums_indicies, *device_sums_indicies;
 
    RH = pQH; RW = pQW;
    QH = pQH; QW = pQW;
 
 // initialise working area for the eigenvector calc
 
-   device_pQ = gpu_device_malloc(sizeof(float)*pQW*pQH);
-   device_pQ2 = gpu_device_malloc(sizeof(float)*pQW*pQH);
-   device_R = gpu_device_malloc(sizeof(float)*pQW*pQH);
-   device_Q = gpu_device_malloc(sizeof(float)*pQW*pQH);
-   device_Sums = gpu_device_malloc(sizeof(float)*pQW);
-   host_Sums = gpu_host_malloc(sizeof(float)*pQW);
-   float *host_Q = gpu_host_malloc(sizeof(float)*pQW*pQH);
-   float *host_R = gpu_host_malloc(sizeof(float)*pQW*pQH);
+   device_pQ = (float *)ws_reserve(WS_DEVICE_PQ, sizeof(float)*pQW*pQH);
+   device_pQ2 = (float *)ws_reserve(WS_DEVICE_PQ2, sizeof(float)*pQW*pQH);
+   device_R = (float *)ws_reserve(WS_DEVICE_R, sizeof(float)*pQW*pQH);
+   device_Q = (float *)ws_reserve(WS_DEVICE_Q, sizeof(float)*pQW*pQH);
+   device_Sums = (float *)ws_reserve(WS_DEVICE_SUMS, sizeof(float)*pQW);
+   host_Sums = (float *)ws_reserve(WS_HOST_SUMS, sizeof(float)*pQW);
+   if( device_pQ == NULL || device_pQ2 == NULL || device_R == NULL || device_Q == NULL
+       || device_Sums == NULL || host_Sums == NULL ){
+      return 1;
+   }
 
    gpu_memcpy_to_device(host_pQ, device_pQ, pQW*pQH*sizeof(float));
 
    int iterations = 0;
    int host_unconverged = 1;
    while (host_unconverged == 1 && iterations++ < max_iterations) {
-      cuda_qr_get_q_and_r(device_Cov, device_Q, device_R, XH, XW);
+      HOST_PROFILE_SCOPE("pca.eigen_iteration");
+      if( cuda_qr_get_q_and_r(device_Cov, device_Q, device_R, XH, XW) ){
+         return 1;
+      }
       run_gpu_matmul( device_pQ, device_Q,  device_pQ2, pQH, pQW, pQW);
       // I guess we could do something smart here to avoid the memcpy?
       gpu_memcpy_intra_device( device_pQ2, device_pQ, pQH*pQW*sizeof(float));
@@ -960,7 +1284,10 @@ int cuda_eigenvectors( SV *perl_pQ, float epsilon, int max_iterations) {
    run_gpu_eigenvector_signs(device_pQ, device_Sums, pQH, pQW);
    gpu_memcpy_from_device(host_Sums, device_Sums, pQW*sizeof(float));
    
-   sums_indicies = (int*)malloc(pQW * sizeof(int));
+   sums_indicies = (int *)ws_reserve(WS_SUMS_INDICIES, pQW * sizeof(int));
+   if( sums_indicies == NULL ){
+      return 1;
+   }
    for (int i=0;i<pQW;i++) {
       sums_indicies[i] = i;
    }
@@ -972,21 +1299,78 @@ int cuda_eigenvectors( SV *perl_pQ, float epsilon, int max_iterations) {
    // create a new matrix with the sorted eigenvectors
    // might as well reuse pQ2, since is already allocated... 
    // first copy the array with the new order to the device
-   device_sums_indicies = gpu_device_malloc_int( sizeof(int)*pQW);
+   device_sums_indicies = (int *)ws_reserve(WS_DEVICE_SUMS_INDICIES, sizeof(int)*pQW);
+   if( device_sums_indicies == NULL ){
+      return 1;
+   }
    gpu_memcpy_to_device_int(sums_indicies, device_sums_indicies, pQW*sizeof(int));
    run_gpu_reorder_eigenvectors(device_pQ2, device_pQ, device_sums_indicies, pQH, pQW);
    gpu_memcpy_intra_device( device_pQ2, device_pQ, pQH*pQW*sizeof(float));
 
-   gpu_free_device((void *)device_R);
-   gpu_free_device((void *)device_Q);
-
    // the eigenvectors are in pQ, so copy them back to Perl
    // transfer results from device to host
    gpu_memcpy_from_device(host_pQ, device_pQ, pQW*pQH*sizeof(float));
+   CPW = pQW;
    if (debug == 1) {
       std::cout << "Eigenvectors Post Signs"<<std::endl;
       print_2D_array(host_pQ, pQH, pQW);
    }
+   return 0;
+}
+
+int cuda_eigenvectors( SV *perl_pQ, float epsilon, int max_iterations) ;
+int cuda_eigenvectors( SV *perl_pQ, float epsilon, int max_iterations) {
+// relies on host_Cov and device_Cov being already populated by calculate_covariance
+   size_t pQH, pQW, *pQWs = NULL,
+          XH, XW,
+          i, j, asz
+        ;
+   float *host_pQ;
+   SV *subav, *subsubav, **ssubav;
+
+   if( array_numelts_2D(perl_pQ, &pQH, &pQWs) ){
+      fprintf(stderr, "cuda_qr_get_q() : error, call to array_numelts_2D() has failed for input matrix pQ.\n");
+      return 1;
+   }
+
+   pQW = pQWs[0];
+
+   XH = pQH; XW = pQW;
+
+   if (debug == 1) {
+      printf("cuda_eigenvectors incoming pQ size = %d rows x %d columns\n", pQH, pQW);
+   }
+   host_pQ = (float *)ws_reserve(WS_HOST_PQ, sizeof(float)*pQW*pQH);
+   if( host_pQ == NULL ){
+      return 1;
+   }
+
+   AV *av, *av2;
+   float *pd = &(host_pQ[0]);
+   av = (AV *)SvRV(perl_pQ);
+
+   for(i=0;i<pQH;i++){ // for each row
+      ssubav = av_fetch(av, i, FALSE);
+      if( ssubav == NULL ){
+         fprintf(stderr, "inline_cuda_matrix_multiply() : error, input matrix pQ does not contain valid row at i=%d\n", i);
+         return 1;
+      }
+      subav = *ssubav;
+      for(j=0;j<pQW;j++){ // for the cols of that row
+         ssubav = av_fetch((AV *)SvRV(subav), j, FALSE);
+         if( ssubav == NULL ){
+            fprintf(stderr, "inline_cuda_matrix_multiply() : error, input matrix pQ does not contain valid column at i=%d, j=%d\n", i, j);
+            return 1;
+         }
+         subsubav = *ssubav;
+         *pd = SvNV(subsubav);
+         pd++;
+      }
+   }
+
+   if( eigenvectors_from_host_pQ(host_pQ, pQH, pQW, epsilon, max_iterations) ){
+      return 1;
+   }
 
    // clear the existing pQ Perl data structure, as it gets added to rather than overwritten
    if( is_array_ref(perl_pQ, &asz) ){
@@ -1016,14 +1400,72 @@ int cuda_eigenvectors( SV *perl_pQ, float epsilon, int max_iterations) {
       }
    }
 
-//   CUDA_CHECK(cudaFree((void *)device_pQ));
-//   CUDA_CHECK(cudaFree((void *)device_pQ2));
-//   CUDA_CHECK(cudaFreeHost((void *)host_pQ));
-//   CUDA_CHECK(cudaFree((void *)device_X));
-//   CUDA_CHECK(cudaFreeHost((void *)host_X));
    return 0;
 }
 
+// Wide data (DW > DH, e.g. a few hundred samples of 200k features) by way of the DH x DH Gram
+// matrix: the DW x DW covariance is never formed, the first k principal axes are recovered from
+// the Gram matrix's eigenvectors on the host and left in device_pQ (DW x k) for the projection
+// and the model, just as cuda_eigenvectors leaves them.
+
+int gram_from_host_data(size_t DH, size_t DW, size_t k, SV *perl_values) {
+   float *host_pQ;
+   size_t i, asz;
+
+   if( k < 1 || k > DH ){
+      fprintf(stderr, "gram_from_host_data() : error, %zu components requested from %zu rows.\n", k, DH);
+      return 1;
+   }
+   standardise_host_data(DH, DW);
+   gpu_memcpy_from_device(host_Z, device_Z, DH*DW*sizeof(float));
+   host_pQ = (float *)ws_reserve(WS_HOST_PQ, sizeof(float)*DW*k);
+   host_Sums = (float *)ws_reserve(WS_HOST_SUMS, sizeof(float)*k); // the eigenvalues
+   if( host_pQ == NULL || host_Sums == NULL || host_pca_gram(host_Z, DH, DW, k, host_pQ, host_Sums) ){
+      return 1;
+   }
+   device_pQ = (float *)ws_reserve(WS_DEVICE_PQ, sizeof(float)*DW*k);
+   if( device_pQ == NULL ){
+      return 1;
+   }
+   gpu_memcpy_to_device(host_pQ, device_pQ, DW*k*sizeof(float));
+   CPW = k;
+   if( perl_values != NULL && is_array_ref(perl_values, &asz) ){
+      AV *av = (AV *)SvRV(perl_values);
+      av_clear(av);
+      av_extend(av, k);
+      for(i=0;i<k;i++){
+         av_push(av, newSVnv(host_Sums[i]));
+      }
+   }
+   if (debug == 1) {
+      std::cout << "Gram eigenvalues" << std::endl;
+      print_2D_array(host_Sums, 1, k);
+   }
+   return 0;
+}
+
+int calculate_gram(SV *perl_Data, int k, SV *perl_values) {
+   if( data_into_host(perl_Data) ){
+      return 1;
+   }
+   return gram_from_host_data(CCH, CCW, k, perl_values);
+}
+
+int calculate_gram_packed(void *matrix, int k, SV *perl_values) {
+   host_matrix_t *m = (host_matrix_t *)matrix;
+   if( m->rows == 0 || m->cols == 0 ){
+      fprintf(stderr, "calculate_gram_packed() : error, input matrix is empty.\n");
+      return 1;
+   }
+   CCH = m->rows;
+   CCW = m->cols;
+   if( covariance_allocate(CCH, CCW) ){
+      return 1;
+   }
+   memcpy(host_Data, m->data, sizeof(float)*CCH*CCW);
+   return gram_from_host_data(CCH, CCW, k, perl_values);
+}
+
 int cuda_project_results(int projected_columns, SV *perl_projection){
         size_t pH, pW, // projection
 // Z, which is what was are multiplying the results by, was already calculated in the PCA code
@@ -1035,6 +1477,14 @@ int cuda_project_results(int projected_columns, SV *perl_projection){
 
         pH = CCH; // assumes calculate_covariance already called and CCH populated
         pW = projected_columns;
+        if( pW < 1 || pW > CPW ){
+           fprintf(stderr, "cuda_project_results() : error, %zu columns requested, %zu components were found.\n", pW, CPW);
+           return 1;
+        }
+        if( device_Z == NULL || device_pQ == NULL ){
+           fprintf(stderr, "cuda_project_results() : error, the workspace holding the fit has been freed.\n");
+           return 1;
+        }
 
         if( is_array_ref(perl_projection, &asz) ){
            if( asz > 0 ){
@@ -1049,20 +1499,20 @@ int cuda_project_results(int projected_columns, SV *perl_projection){
            sv_setrv(perl_projection, (SV *)newAV());
         }
 
-        host_p = gpu_host_malloc(sizeof(float)*pW*pH);
-        device_p = gpu_device_malloc(sizeof(float)*pW*pH);
-        run_gpu_partial_matmul( device_Z, device_pQ, device_p, CCH, CCW, CCW, projected_columns);
-
-        // free A and B from Host and device
-        //CUDA_CHECK(cudaFreeHost(host_Results));
-        //CUDA_CHECK(cudaFreeHost(host_B));
-        //CUDA_CHECK(cudaFree((void *)device_A));
-        //CUDA_CHECK(cudaFree((void *)device_B));
+        HOST_PROFILE_BEGIN(projection, "pca.project");
+        host_p = (float *)ws_reserve(WS_HOST_P, sizeof(float)*pW*pH);
+        device_p = (float *)ws_reserve(WS_DEVICE_P, sizeof(float)*pW*pH);
+        if( host_p == NULL || device_p == NULL ){
+           return 1;
+        }
+        run_gpu_partial_matmul( device_Z, device_pQ, device_p, CCH, CCW, CPW, projected_columns);
 
         // transfer results from device to host
         gpu_memcpy_from_device(host_p, device_p, pH*pW*sizeof(float));
+        HOST_PROFILE_END(projection);
 
-
+        HOST_PROFILE_SCOPE("marshal.rows_out");
+        HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * pH * pW);
         float *pd = &(host_p[0]);
         AV *av = (AV *)SvRV(perl_projection);
         AV *av2;
@@ -1078,9 +1528,440 @@ int cuda_project_results(int projected_columns, SV *perl_projection){
            }
         }
 
-        //CUDA_CHECK(cudaFree((void *)device_R));
-        //CUDA_CHECK(cudaFreeHost((void *)host_R));
-
         return 0;
 }
 
+
+// Fitted PCA model: the means, stddevs and first k eigenvectors are kept on the host so that new
+// data can be projected without recalculating the covariance and eigenvectors
+
+void *pca_model_capture(int projected_columns) {
+// relies on calculate_covariance and cuda_eigenvectors (or calculate_gram) having already been called
+   size_t i, j, k = projected_columns;
+   float *host_pQ, *components;
+
+   if( k < 1 || k > CPW ){
+      fprintf(stderr, "pca_model_capture() : error, %zu components requested, %zu were found.\n", k, CPW);
+      return NULL;
+   }
+   host_pQ = (float *)ws_reserve(WS_HOST_PQ, sizeof(float)*CCW*CPW);
+   if( host_pQ == NULL || (components=(float *)ws_reserve(WS_COMPONENTS, CCW*k*sizeof(float))) == NULL ){
+      return NULL;
+   }
+   gpu_memcpy_from_device(host_Means, device_Means, CCW*sizeof(float));
+   gpu_memcpy_from_device(host_Stddev, device_Stddev, CCW*sizeof(float));
+   gpu_memcpy_from_device(host_pQ, device_pQ, CCW*CPW*sizeof(float));
+   for(i=0;i<CCW;i++){ // keep the first k columns of the sorted eigenvectors
+      for(j=0;j<k;j++){
+         components[i * k + j] = host_pQ[i * CPW + j];
+      }
+   }
+   host_pca_model_t *model = host_pca_model_create(CCW, k, host_Means, host_Stddev, components);
+   return (void *)model;
+}
+
+void rows_into_perl(float *src, size_t rows, size_t cols, SV *perl_R) {
+   HOST_PROFILE_SCOPE("marshal.rows_out");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * rows * cols);
+   size_t i, j, asz;
+   float *pd;
+   AV *av, *av2;
+
+   if( is_array_ref(perl_R, &asz) ){
+      if( asz > 0 ){
+         av_clear((AV *)SvRV(perl_R));
+      }
+   } else if( SvROK(perl_R) ){
+      // LeoNerd's suggestion:
+      sv_setrv(SvRV(perl_R), (SV *)newAV());
+   } else {
+      // LeoNerd's suggestion:
+      sv_setrv(perl_R, (SV *)newAV());
+   }
+
+   pd = &(src[0]);
+   av = (AV *)SvRV(perl_R);
+   av_extend(av, rows);
+   for(i=0;i<rows;i++){ // for each row
+      av2 = newAV(); // make a new array for each row
+      av_extend(av2, cols);
+      av_push(av, newRV_noinc((SV *)av2));
+      for(j=0;j<cols;j++){
+         av_store(av2, j, newSVnv(*pd));
+         pd++;
+      }
+   }
+}
+
+int pca_model_transform(void *model_ptr, SV *perl_Data, SV *perl_projection) {
+   host_pca_model_t *model = (host_pca_model_t *)model_ptr;
+   size_t DH, DW, *DWs = NULL,
+          i, j
+        ;
+   float *host_In, *host_Out, *pd;
+   SV *subav, *subsubav, **ssubav;
+   AV *av, *av2;
+
+   if( array_numelts_2D(perl_Data, &DH, &DWs) ){
+      fprintf(stderr, "pca_model_transform() : error, call to array_numelts_2D() has failed for input matrix Data.\n");
+      return 1;
+   }
+   DW = DWs[0];
+   free(DWs);
+   if( DW != model->cols ){
+      fprintf(stderr, "pca_model_transform() : error, model was fitted on %zu columns, input matrix Data has %zu.\n", model->cols, DW);
+      return 1;
+   }
+   if( (host_In=(float *)ws_reserve(WS_TRANSFORM_IN, DH*DW*sizeof(float))) == NULL ){
+      return 1;
+   }
+   if( (host_Out=(float *)ws_reserve(WS_TRANSFORM_OUT, DH*model->k*sizeof(float))) == NULL ){
+      return 1;
+   }
+
+   HOST_PROFILE_BEGIN(marshal, "marshal.rows_in");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * DH * DW);
+   pd = &(host_In[0]);
+   av = (AV *)SvRV(perl_Data);
+   for(i=0;i<DH;i++){ // for each row
+      ssubav = av_fetch(av, i, FALSE);
+      if( ssubav == NULL ){
+         fprintf(stderr, "pca_model_transform() : error, input matrix Data does not contain valid row at i=%zu\n", i);
+         return 1;
+      }
+      subav = *ssubav;
+      for(j=0;j<DW;j++){ // for the cols of that row
+         ssubav = av_fetch((AV *)SvRV(subav), j, FALSE);
+         *pd = (ssubav == NULL) ? 0 : SvNV(*ssubav);
+         pd++;
+      }
+   }
+
+   HOST_PROFILE_END(marshal);
+   host_pca_model_transform(model, host_In, DH, host_Out);
+   rows_into_perl(host_Out, DH, model->k, perl_projection);
+   return 0;
+}
+
+int pca_model_transform_packed(void *model_ptr, void *matrix, SV *perl_projection) {
+   // as pca_model_transform, for data already packed in an ML::Matrix
+   host_pca_model_t *model = (host_pca_model_t *)model_ptr;
+   host_matrix_t *m = (host_matrix_t *)matrix;
+   float *host_Out;
+
+   if( m->cols != model->cols ){
+      fprintf(stderr, "pca_model_transform_packed() : error, model was fitted on %zu columns, input matrix Data has %zu.\n", model->cols, m->cols);
+      return 1;
+   }
+   if( (host_Out=(float *)ws_reserve(WS_TRANSFORM_OUT, m->rows*model->k*sizeof(float))) == NULL ){
+      return 1;
+   }
+   host_pca_model_transform(model, m->data, m->rows, host_Out);
+   rows_into_perl(host_Out, m->rows, model->k, perl_projection);
+   return 0;
+}
+
+// Out-of-core projection: the rows are projected a block at a time by the host library, and each
+// block goes to a file, or to a Perl callback, without the whole projection ever being held
+int pca_model_project_file(void *model_ptr, void *matrix, char *filename, int block_rows) {
+   return host_pca_model_project_file((host_pca_model_t *)model_ptr, (host_matrix_t *)matrix, block_rows > 0 ? block_rows : 0, filename);
+}
+
+static int perl_block_sink(void *callback, const float *block, size_t first_row, size_t rows, size_t cols) {
+   // called on the thread that called pca_model_stream, so calling back into Perl is safe
+   dSP;
+   int failed = 0;
+   SV *perl_rows = newRV_noinc((SV *)newAV());
+
+   rows_into_perl((float *)block, rows, cols, perl_rows);
+   ENTER;
+   SAVETMPS;
+   PUSHMARK(SP);
+   XPUSHs(sv_2mortal(newSVuv(first_row)));
+   XPUSHs(sv_2mortal(perl_rows));
+   PUTBACK;
+   call_sv((SV *)callback, G_DISCARD | G_EVAL);
+   if( SvTRUE(ERRSV) ){
+      fprintf(stderr, "pca_model_stream() : error, the callback died at row %zu: %s", first_row, SvPV_nolen(ERRSV));
+      failed = 1;
+   }
+   FREETMPS;
+   LEAVE;
+   return failed;
+}
+
+int pca_model_stream(void *model_ptr, void *matrix, SV *callback, int block_rows) {
+   return host_pca_model_stream((host_pca_model_t *)model_ptr, (host_matrix_t *)matrix, block_rows > 0 ? block_rows : 0,
+                                perl_block_sink, (void *)callback);
+}
+
+// Batched PCA: many small independent datasets fitted and projected in one call by the host
+// library, rather than one round of device allocations and QR iterations per dataset.  Each element
+// of the list is an array of arrays or an ML::Matrix handle; they are packed one after another
+// into a single buffer, and each projection comes back as an array of arrays in the same order.
+int pca_batch(SV *perl_datasets, int k, SV *perl_results) {
+   size_t count, rowlen, d;
+   std::vector<float> packed, rows_buffer;
+   std::vector<size_t> rows, cols;
+
+   if( k < 1 ){
+      fprintf(stderr, "pca_batch() : error, %d components requested.\n", k);
+      return 1;
+   }
+   if( ! is_array_ref(perl_datasets, &count) ){
+      fprintf(stderr, "pca_batch() : error, expecting an array reference of datasets.\n");
+      return 1;
+   }
+   rows.resize(count);
+   cols.resize(count);
+   AV *av = (AV *)SvRV(perl_datasets);
+   for(d=0;d<count;d++){
+      SV **ssubav = av_fetch(av, d, FALSE);
+      if( ssubav == NULL ){
+         fprintf(stderr, "pca_batch() : error, dataset %zu is missing.\n", d);
+         return 1;
+      }
+      if( sv_isa(*ssubav, "ML::Matrix") && SvTYPE(SvRV(*ssubav)) == SVt_PVHV ){ // an ML::Matrix, its handle under ptr
+         SV **ptr = hv_fetch((HV *)SvRV(*ssubav), "ptr", 3, 0);
+         host_matrix_t *m = ptr != NULL ? INT2PTR(host_matrix_t *, SvIV(*ptr)) : NULL;
+         if( m == NULL ){
+            fprintf(stderr, "pca_batch() : error, dataset %zu is an ML::Matrix without any data.\n", d);
+            return 1;
+         }
+         rows[d] = m->rows;
+         cols[d] = m->cols;
+         packed.insert(packed.end(), m->data, m->data + m->rows * m->cols);
+      } else if( SvROK(*ssubav) && SvTYPE(SvRV(*ssubav)) == SVt_PVAV ){ // an array of arrays, as wide as its first row
+         SV **first = is_array_ref(*ssubav, &rowlen) && rowlen > 0 ? av_fetch((AV *)SvRV(*ssubav), 0, FALSE) : NULL;
+         if( first == NULL || ! is_array_ref(*first, &cols[d]) || pack_perl_rows(*ssubav, cols[d], rows_buffer, &rows[d]) ){
+            fprintf(stderr, "pca_batch() : error, dataset %zu is not an array of arrays.\n", d);
+            return 1;
+         }
+         packed.insert(packed.end(), rows_buffer.begin(), rows_buffer.end());
+      } else {
+         fprintf(stderr, "pca_batch() : error, dataset %zu is neither an array of arrays nor an ML::Matrix.\n", d);
+         return 1;
+      }
+   }
+
+   size_t out_size = 0;
+   for(d=0;d<count;d++){
+      out_size += rows[d] * std::min((size_t)k, cols[d]);
+   }
+   std::vector<float> out(out_size);
+   if( host_pca_batch(packed.data(), rows.data(), cols.data(), count, k, out.data()) ){
+      return 1;
+   }
+
+   if( ! is_array_ref(perl_results, &rowlen) ){
+      fprintf(stderr, "pca_batch() : error, expecting an array reference for the results.\n");
+      return 1;
+   }
+   AV *results = (AV *)SvRV(perl_results);
+   av_clear(results);
+   av_extend(results, count);
+   float *pd = out.data();
+   for(d=0;d<count;d++){
+      SV *projection = newRV_noinc((SV *)newAV());
+      size_t width = std::min((size_t)k, cols[d]);
+      rows_into_perl(pd, rows[d], width, projection);
+      av_push(results, projection);
+      pd += rows[d] * width;
+   }
+   return 0;
+}
+
+int pca_model_save(void *model, char *filename) {
+   return host_pca_model_save((host_pca_model_t *)model, filename);
+}
+
+void *pca_model_load(char *filename) {
+   return (void *)host_pca_model_load(filename);
+}
+
+int pca_model_columns(void *model) {
+   return ((host_pca_model_t *)model)->k;
+}
+
+void pca_model_free(void *model) {
+   host_pca_model_free((host_pca_model_t *)model);
+}
+
+// Fused PCA -> k-means: the projection stays in native memory and is handed straight to the host
+// k-means engine, only the labels and centroids (and optionally the projection) go back to Perl
+
+int pipeline_check(size_t DH, size_t DW, size_t k, int clusters) {
+   if( k < 1 || k > DW || (DW > DH && k > DH) || clusters < 1 || (size_t)clusters > DH ){
+      fprintf(stderr, "pipeline_run() : error, %zu components and %d clusters requested for a %zu x %zu input.\n", k, clusters, DH, DW);
+      return 1;
+   }
+   CCH = DH;
+   CCW = DW;
+   return covariance_allocate(DH, DW);
+}
+
+int pipeline_from_host_data(size_t DH, size_t DW, size_t k, float epsilon, int max_iterations,
+                            int clusters, int maxiter, int seed, SV *perl_labels, SV *perl_centroids,
+                            SV *perl_projection, SV *perl_stats);
+
+int pipeline_run(SV *perl_Data, int projected_columns, float epsilon, int max_iterations,
+                 int clusters, int maxiter, int seed, SV *perl_labels, SV *perl_centroids,
+                 SV *perl_projection, SV *perl_stats) {
+   size_t DH, DW, *DWs = NULL,
+          i, j, k = projected_columns
+        ;
+   float *pd;
+   SV *subav, **ssubav;
+   AV *av;
+
+   if( array_numelts_2D(perl_Data, &DH, &DWs) ){
+      fprintf(stderr, "pipeline_run() : error, call to array_numelts_2D() has failed for input matrix Data.\n");
+      return 1;
+   }
+   DW = DWs[0];
+   free(DWs);
+   if( pipeline_check(DH, DW, k, clusters) ){
+      return 1;
+   }
+   HOST_PROFILE_BEGIN(marshal, "marshal.rows_in");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * DH * DW);
+   pd = &(host_Data[0]);
+   av = (AV *)SvRV(perl_Data);
+   for(i=0;i<DH;i++){ // for each row
+      ssubav = av_fetch(av, i, FALSE);
+      if( ssubav == NULL ){
+         fprintf(stderr, "pipeline_run() : error, input matrix Data does not contain valid row at i=%zu\n", i);
+         return 1;
+      }
+      subav = *ssubav;
+      for(j=0;j<DW;j++){ // for the cols of that row
+         ssubav = av_fetch((AV *)SvRV(subav), j, FALSE);
+         *pd = (ssubav == NULL) ? 0 : SvNV(*ssubav);
+         pd++;
+      }
+   }
+   HOST_PROFILE_END(marshal);
+   return pipeline_from_host_data(DH, DW, k, epsilon, max_iterations, clusters, maxiter, seed,
+                                  perl_labels, perl_centroids, perl_projection, perl_stats);
+}
+
+int pipeline_run_packed(void *matrix, int projected_columns, float epsilon, int max_iterations,
+                        int clusters, int maxiter, int seed, SV *perl_labels, SV *perl_centroids,
+                        SV *perl_projection, SV *perl_stats) {
+   // as pipeline_run, for data already packed in an ML::Matrix
+   host_matrix_t *m = (host_matrix_t *)matrix;
+   if( pipeline_check(m->rows, m->cols, projected_columns, clusters) ){
+      return 1;
+   }
+   memcpy(host_Data, m->data, sizeof(float)*m->rows*m->cols);
+   return pipeline_from_host_data(m->rows, m->cols, projected_columns, epsilon, max_iterations, clusters, maxiter, seed,
+                                  perl_labels, perl_centroids, perl_projection, perl_stats);
+}
+
+int pipeline_from_host_data(size_t DH, size_t DW, size_t k, float epsilon, int max_iterations,
+                            int clusters, int maxiter, int seed, SV *perl_labels, SV *perl_centroids,
+                            SV *perl_projection, SV *perl_stats) {
+   size_t i, j, asz;
+   float *host_pQ, *host_p, *device_p, *pd;
+   AV *av, *av2;
+
+   if( DW > DH ){ // wide, by way of the Gram matrix
+      if( gram_from_host_data(DH, DW, k, NULL) ){
+         return 1;
+      }
+   } else {
+      if( covariance_from_host_data(DH, DW) ){
+         return 1;
+      }
+      host_pQ = (float *)ws_reserve(WS_HOST_PQ, sizeof(float)*DW*DW); // identity to start the QR iterations
+      if( host_pQ == NULL ){
+         return 1;
+      }
+      for(i=0;i<DW;i++){
+         for(j=0;j<DW;j++){
+            host_pQ[i * DW + j] = (i == j) ? 1 : 0;
+         }
+      }
+      if( eigenvectors_from_host_pQ(host_pQ, DW, DW, epsilon, max_iterations) ){
+         return 1;
+      }
+   }
+
+   HOST_PROFILE_BEGIN(projection, "pca.project");
+   host_p = (float *)ws_reserve(WS_HOST_P, sizeof(float)*DH*k);
+   device_p = (float *)ws_reserve(WS_DEVICE_P, sizeof(float)*DH*k);
+   if( host_p == NULL || device_p == NULL ){
+      return 1;
+   }
+   run_gpu_partial_matmul( device_Z, device_pQ, device_p, DH, DW, CPW, k);
+   gpu_memcpy_from_device(host_p, device_p, DH*k*sizeof(float));
+   HOST_PROFILE_END(projection);
+
+   host_kmeans_t *km = host_kmeans_create(host_p, DH, k, clusters);
+   if( km == NULL ){
+      return 1;
+   }
+   host_kmeans_init_plusplus(km, seed);
+   size_t iterations;
+   size_t changes = host_kmeans_run(km, maxiter, &iterations);
+
+   if( is_array_ref(perl_labels, &asz) ){
+      if( asz > 0 ){
+         av_clear((AV *)SvRV(perl_labels));
+      }
+   } else {
+      // LeoNerd's suggestion:
+      sv_setrv(SvROK(perl_labels) ? SvRV(perl_labels) : perl_labels, (SV *)newAV());
+   }
+   av = (AV *)SvRV(perl_labels);
+   av_extend(av, DH);
+   for(i=0;i<DH;i++){
+      av_push(av, newSViv(km->cluster_map[i]));
+   }
+
+   if( is_array_ref(perl_centroids, &asz) ){
+      if( asz > 0 ){
+         av_clear((AV *)SvRV(perl_centroids));
+      }
+   } else {
+      // LeoNerd's suggestion:
+      sv_setrv(SvROK(perl_centroids) ? SvRV(perl_centroids) : perl_centroids, (SV *)newAV());
+   }
+   pd = &(km->centroids[0]);
+   av = (AV *)SvRV(perl_centroids);
+   for(i=0;i<(size_t)clusters;i++){
+      av2 = newAV();
+      av_extend(av2, k);
+      av_push(av, newRV_noinc((SV *)av2));
+      for(j=0;j<k;j++){
+         av_store(av2, j, newSVnv(*pd));
+         pd++;
+      }
+   }
+
+   if( SvROK(perl_projection) && SvTYPE(SvRV(perl_projection)) == SVt_PVAV ){ // only if asked for
+      av = (AV *)SvRV(perl_projection);
+      av_clear(av);
+      av_extend(av, DH);
+      pd = &(host_p[0]);
+      for(i=0;i<DH;i++){
+         av2 = newAV();
+         av_extend(av2, k);
+         av_push(av, newRV_noinc((SV *)av2));
+         for(j=0;j<k;j++){
+            av_store(av2, j, newSVnv(*pd));
+            pd++;
+         }
+      }
+   }
+
+   if( SvROK(perl_stats) && SvTYPE(SvRV(perl_stats)) == SVt_PVHV ){
+      HV *hv = (HV *)SvRV(perl_stats);
+      hv_store(hv, "iterations", 10, newSVuv(iterations), 0);
+      hv_store(hv, "changes", 7, newSVuv(changes), 0);
+      hv_store(hv, "inertia", 7, newSVnv(km->inertia), 0);
+   }
+
+   host_kmeans_free(km);
+   return 0;
+}
@@ -15,6 +15,9 @@ sub import {
    if (!scalar(@_) or $_[0] eq "CUDA") {
       require ML::MVCUDA;
       $gpuif = ML::MVCUDA->new();
+   } elsif ($_[0] =~ /^(CPU|HOST)$/i) {
+      require ML::MVHost;
+      $gpuif = ML::MVHost->new();
    } else {
       require ML::MVROCM;
       $gpuif = ML::MVROCM->new();
@@ -24,12 +27,19 @@ sub import {
 sub new {
    my $class = shift;
    my %params = @_;
-   my $self = {};
+   # the backend imported when the object is made; engine => "cpu" changes it for this object only
+   my $self = { gpuif => $gpuif };
    if (defined($params{debug}) and $params{debug} == 1) {
       $self->{debug} = 1;
    } else {
       $self->{debug} = 0;
    }
+   # "host" runs the covariance on the CPU (blocked, upper triangle only), anything else uses the GPU
+   if (defined($params{covariance}) and $params{covariance} eq "host") {
+      $self->{covariance_engine} = 2;
+   } else {
+      $self->{covariance_engine} = 1;
+   }
    return bless $self, $class;
 }
 
@@ -41,12 +51,24 @@ my %loss_functions = (
 
 my %network_init_params;
 
+sub _select_engine {
+   # engine => "cpu" trains on the host, using all the cores, rather than on the GPU
+   my $self = shift;
+   my %params = @_;
+   if (defined($params{engine}) and $params{engine} =~ /^(cpu|host)$/i) {
+      require ML::MVHost;
+      $self->{gpuif} = ML::MVHost->new() unless ref($self->{gpuif}) eq "ML::MVHost";
+      $self->{gpuif}->c_set_threads($params{threads}) if $params{threads};
+   }
+}
+
 sub create_network {
    my $self = shift;
    my ($sizes, @options) = @_;
    $network_init_params{ sizes } = $sizes;
    my %params = @options;
    $params{batch_size} ||= 10;
+   $self->_select_engine(%params);
    my $scale_factor = 1;
    if (defined($params{weight_init}) and $params{weight_init} eq "scaled") {
       $scale_factor = sqrt($params{batch_size});
@@ -66,31 +88,33 @@ sub create_network {
          }
          $params{weights}->[$i] = $iw;
       }
-      return 0 unless $gpuif->c_add_node($sizes->[$i], $sizes->[$i + 1], $params{bias}->[$i], $params{weights}->[$i], $params{batch_size});
+      return 0 unless $self->{gpuif}->c_add_node($sizes->[$i], $sizes->[$i + 1], $params{bias}->[$i], $params{weights}->[$i], $params{batch_size});
    }
    # reserve RAM for initial input
-   $gpuif->c_reset_derivatives();
+   $self->{gpuif}->c_reset_derivatives();
    if ($self->{debug} == 1 or ($params{debug} and $params{debug} == 1)) {
-      $gpuif->c_set_debug_on();
+      $self->{gpuif}->c_set_debug_on();
    } else {
-      $gpuif->c_set_debug_off();
+      $self->{gpuif}->c_set_debug_off();
    }
    if ($params{loss} =~ /(CrossEntropy|CrossEntropyLoss|CEL)/i) {
-      $gpuif->c_set_loss($loss_functions{cel});
+      $self->{gpuif}->c_set_loss($loss_functions{cel});
       $network_init_params{loss} = "cel";
    } else {
-      $gpuif->c_set_loss($loss_functions{quadratic});
+      $self->{gpuif}->c_set_loss($loss_functions{quadratic});
       $network_init_params{loss} = "mse";
    }
-   return 0 unless $gpuif->c_reserve_input_memory($sizes->[0], $sizes->[-1], $params{batch_size});
+   return 0 unless $self->{gpuif}->c_reserve_input_memory($sizes->[0], $sizes->[-1], $params{batch_size});
    return 1;
 }
 
 sub print_network {
-   $gpuif->c_print_list();
+   my $self = shift;
+   $self->{gpuif}->c_print_list();
 }
 
 sub feedforward {
+   my $self = shift;
    my $xy = shift;
    # convert input to C, put into already reserved memory
    my (@x, @y);
@@ -100,16 +124,17 @@ sub feedforward {
       push @y, $input->[1];
       $elements++;
    }
-   return unless $gpuif->c_load_input(\@x, $elements);
-   return unless $gpuif->c_load_target(\@y);
+   return unless $self->{gpuif}->c_load_input(\@x, $elements);
+   return unless $self->{gpuif}->c_load_target(\@y);
    # run the forward pass of the network
-   $gpuif->c_run_feed_forward();
+   $self->{gpuif}->c_run_feed_forward();
    #my $last_activated_output = [];
    #get_last_activated_output($last_activated_output) ;
    #Math::Matrix->new($last_activated_output)->print("Last activated output");
 }
 
 sub validation_feedforward {
+   my $self = shift;
    my $xy = shift;
    # convert input to C, put into already reserved memory
    my (@x, @y);
@@ -119,40 +144,43 @@ sub validation_feedforward {
       push @y, $input->[1];
       $elements++;
    }
-   return unless $gpuif->c_load_input(\@x, $elements);
-   return unless $gpuif->c_load_target(\@y);
+   return unless $self->{gpuif}->c_load_input(\@x, $elements);
+   return unless $self->{gpuif}->c_load_target(\@y);
    # run the forward pass of the network
-   $gpuif->c_run_feed_forward();
+   $self->{gpuif}->c_run_feed_forward();
    my $last_activated_output = [];
-   $gpuif->c_get_last_activated_output($last_activated_output) ;
+   $self->{gpuif}->c_get_last_activated_output($last_activated_output) ;
    return $last_activated_output;
 }
 
 sub calculate_loss {
-   $gpuif->c_calculate_cost_derivative();
+   my $self = shift;
+   $self->{gpuif}->c_calculate_cost_derivative();
 }
 
 sub backprop {
-   $gpuif->c_run_backpropagation();
+   my $self = shift;
+   $self->{gpuif}->c_run_backpropagation();
 }
 
 sub update_weights {
   # run at end of mini batch
   # don't forget to zero the derivatives!
+  my $self = shift;
   my %params = @_;
   $params{batch_size} ||= 10;
   $params{learning_rate} ||= 3;
   $params{decay} ||= 1;
-  $gpuif->c_run_update_weights_and_biases( $params{learning_rate} / $params{batch_size}, $params{decay} );
-  $gpuif->c_reset_derivatives();
+  $self->{gpuif}->c_run_update_weights_and_biases( $params{learning_rate} / $params{batch_size}, $params{decay} );
+  $self->{gpuif}->c_reset_derivatives();
 }
 
 sub update_mini_batch {
-   my ($mb, $eta, $j, $ctr, $decay) = @_;
-   feedforward($mb);
-   calculate_loss();
-   backprop();
-   update_weights( batch_size => scalar(@$mb), learning_rate => $eta, decay => $decay );
+   my ($self, $mb, $eta, $j, $ctr, $decay) = @_;
+   feedforward($self, $mb);
+   calculate_loss($self);
+   backprop($self);
+   update_weights( $self, batch_size => scalar(@$mb), learning_rate => $eta, decay => $decay );
 }
 
 sub argmax {
@@ -179,6 +207,7 @@ my @testing_targets;
 
 
 sub total_cost {
+   my $self = shift;
    my $data = shift;
    my $targets = shift;
    my $lambda = shift;
@@ -190,12 +219,12 @@ sub total_cost {
    foreach my $i (0 .. $#$data) {
       my $calc;
       if ($accuracy) {
-         $calc = validation_feedforward($data->[$i]);
+         $calc = validation_feedforward($self, $data->[$i]);
       } else {
-         feedforward($data->[$i]);
+         feedforward($self, $data->[$i]);
       }
       if ($cost) {
-         $total_cost += calculate_cost();
+         $total_cost += $self->{gpuif}->c_calculate_cost();
          $data_len += scalar(@{$data->[$i]});
       }
       if ($accuracy) {
@@ -207,7 +236,7 @@ sub total_cost {
       }
    }
    if ($cost) {
-      $total_cost += calculate_weights_cost();
+      $total_cost += $self->{gpuif}->c_calculate_weights_cost();
       $total_cost /= $data_len;
    }
    return $total_cost, $successes;
@@ -265,18 +294,18 @@ sub SGD {
       } 
       my $ctr = 1;
       foreach my $mb (@mini_batches) {
-         update_mini_batch($mb, $eta, $j, $ctr, $decay);
+         update_mini_batch($self, $mb, $eta, $j, $ctr, $decay);
          $ctr++;
       } 
       say "Epoch $j training complete";
       if (defined($params{monitor_training_cost}) or defined($params{monitor_training_accuracy})) {
-         my ($cost,$accuracy) = total_cost( \@testing_batches, \@testing_targets, $params{ lambda }, $params{monitor_training_cost}, $params{monitor_training_accuracy} );
+         my ($cost,$accuracy) = total_cost( $self, \@testing_batches, \@testing_targets, $params{ lambda }, $params{monitor_training_cost}, $params{monitor_training_accuracy} );
          push @training_cost, $cost;
          say "Cost on training data $cost" if defined($params{monitor_training_cost});
          say "Accuracy on training data $accuracy / $n_test" if defined($params{monitor_training_accuracy})
       }
       if (defined($params{monitor_evaluation_cost}) or defined($params{monitory_evaluation_accuracy})) {
-         my ($cost,$accuracy) = total_cost( \@evaluation_batches, \@evaluation_targets, $params{ lambda },  $params{monitor_evaluation_cost}, $params{monitor_evaluation_accuracy} );
+         my ($cost,$accuracy) = total_cost( $self, \@evaluation_batches, \@evaluation_targets, $params{ lambda },  $params{monitor_evaluation_cost}, $params{monitor_evaluation_accuracy} );
          push @evaluation_cost, $cost;
          say "Cost on evaluation data $cost" if defined($params{monitor_evaluation_cost});
          say "Accuracy on evaluation data $accuracy / $n_eval" if defined($params{monitor_evaluation_accuracy})
@@ -290,16 +319,61 @@ sub SGD {
 
 }
 
+sub _split_xy {
+   my $data = shift;
+   my (@x, @y);
+   foreach my $input (@$data) {
+      push @x, $input->[0];
+      push @y, $input->[1];
+   }
+   return \@x, \@y;
+}
+
+sub load_training_set {
+   # packs the [x, y] pairs into a native buffer once, for train_epochs
+   my $self = shift;
+   my $data = shift;
+   $self->{training_size} = scalar(@$data);
+   return !$self->{gpuif}->c_load_training_set(_split_xy($data));
+}
+
+sub load_evaluation_set {
+   my $self = shift;
+   my $data = shift;
+   return !$self->{gpuif}->c_load_evaluation_set(_split_xy($data));
+}
+
+sub train_epochs {
+   # the same as SGD, but the shuffling, batching and updates are all done natively on the sets
+   # loaded with load_training_set / load_evaluation_set.  Costs and accuracies are per epoch.
+   my $self = shift;
+   my $epochs = shift;
+   my $mini_batch_size = shift;
+   my $eta = shift;
+   my %params = @_;
+   die "ML::MVKernels::train_epochs needs a mini batch size of at least 1"
+      unless defined($mini_batch_size) and $mini_batch_size =~ /^\d+$/ and $mini_batch_size > 0;
+   $params{lambda} ||= 0;
+   $params{seed} //= int(rand(2**31));
+   my $decay = 1 - $eta * ( $params{lambda} / ($self->{training_size} || 1) );
+   my $monitor_training = (defined($params{monitor_training_cost}) or defined($params{monitor_training_accuracy})) ? 1 : 0;
+   my $monitor_evaluation = (defined($params{monitor_evaluation_cost}) or defined($params{monitor_evaluation_accuracy})) ? 1 : 0;
+   my $stats = { evaluation_cost => [], evaluation_accuracy => [], training_cost => [], training_accuracy => [], epoch_time => [] };
+   return if $self->{gpuif}->c_train_epochs($epochs, $mini_batch_size, $eta, $decay, $params{seed}, $monitor_training, $monitor_evaluation,
+                                    $params{checkpoint} // "", $stats);
+   return $stats;
+}
+
 sub save_network {
    my $self = shift;
    my $filename = shift;
    my $data = { loss => $network_init_params{loss}, sizes => $network_init_params{sizes} };
    foreach my $i (0 .. ($#{$network_init_params{sizes}} - 1)) {
       my $W = [];
-      $gpuif->c_get_weights($W, $i);
+      $self->{gpuif}->c_get_weights($W, $i);
       push @{$data->{weights}}, $W;
       my $B = [];
-      $gpuif->c_get_biases($B, $i);
+      $self->{gpuif}->c_get_biases($B, $i);
       push @{$data->{bias}}, $B;
    }
    open(FILE, ">", $filename);
@@ -311,15 +385,81 @@ sub load_network {
    my $self = shift;
    my $filename = shift;
    my $data = from_json(scalar(read_file($filename)));
-   $self->create_network(delete $data->{sizes}, %$data);
+   $self->create_network(delete $data->{sizes}, %$data, @_);
 }   
     
+sub save_checkpoint {
+   # binary version of save_network, the header and sizes followed by the raw float32 weights and biases
+   my $self = shift;
+   my $filename = shift;
+   return !$self->{gpuif}->c_save_checkpoint($filename);
+}
+
+sub load_checkpoint {
+   my $self = shift;
+   my $filename = shift;
+   my %params = @_;
+   $params{batch_size} ||= 10;
+   $self->_select_engine(%params);
+   my $info = {};
+   return 0 if $self->{gpuif}->c_load_checkpoint($filename, $params{batch_size}, $info);
+   $network_init_params{sizes} = $info->{sizes};
+   $network_init_params{loss} = $info->{loss} == $loss_functions{cel} ? "cel" : "mse";
+   if ($self->{debug} == 1 or ($params{debug} and $params{debug} == 1)) {
+      $self->{gpuif}->c_set_debug_on();
+   } else {
+      $self->{gpuif}->c_set_debug_off();
+   }
+   return 1;
+}
+
+sub load_inference_network {
+   # a prediction only copy of a network saved with save_checkpoint, run on the CPU threads
+   my $self = shift;
+   my $filename = shift;
+   $self->_free_inference();
+   $self->{inference} = $self->{gpuif}->c_inference_load($filename);
+   return $self->{inference} ? 1 : 0;
+}
+
+sub freeze {
+   # a prediction only copy of the network as trained so far
+   my $self = shift;
+   $self->_free_inference();
+   $self->{inference} = $self->{gpuif}->c_inference_freeze();
+   return $self->{inference} ? 1 : 0;
+}
+
+sub predict {
+   # one row of outputs per input row
+   my $self = shift;
+   my $rows = shift;
+   my $out = [];
+   return if $self->{gpuif}->c_inference_predict($self->{inference}, $rows, $out);
+   return $out;
+}
+
+sub classify {
+   # the index of the largest output for each input row
+   my $self = shift;
+   my $rows = shift;
+   my $labels = [];
+   return if $self->{gpuif}->c_inference_classify($self->{inference}, $rows, $labels);
+   return $labels;
+}
+
+sub _free_inference {
+   my $self = shift;
+   $self->{gpuif}->c_inference_free(delete $self->{inference}) if $self->{inference};
+}
+
 sub mnist_batch_guess {
 # use if the data supplied is in the same format as the mnist batches
 # otherwise use mnist_image_guess
    my $self = shift;
    my $data = shift;
-   my $calc = validation_feedforward($data);
+   return $self->classify([ map { $_->[0] } @$data ]) if $self->{inference};
+   my $calc = validation_feedforward($self, $data);
    return argmax($calc);
 }   
     
@@ -327,20 +467,55 @@ sub mnist_image_guess {
    my $self = shift;
    my $data = shift;
    # expecting an array of 784 pixel values scaled to the 0-1 range
-   $gpuif->c_set_debug_on();
+   return $self->classify([ $data ]) if $self->{inference};
+   $self->{gpuif}->c_set_debug_on();
    my @batch;
    $batch[0]->[0] = $data;
    $batch[0]->[1] = [(0) x 10]; # validation expects to see a target array, but it isn't needed, so just make it zeros.
-   my $calc = validation_feedforward(\@batch);
+   my $calc = validation_feedforward($self, \@batch);
    return argmax($calc);
 }
 
 sub calculate_covariance {
    my $self = shift;
    if ($self->{debug} == 1) {
-      $gpuif->c_set_debug_on();
+      $self->{gpuif}->c_set_debug_on();
+   }
+   $self->{gpuif}->c_set_covariance_engine($self->{covariance_engine});
+   $self->_use_workspace();
+   my ($data, $cov) = @_;
+   return $self->{gpuif}->c_calculate_covariance_packed($data->ptr, $cov) if ref($data) eq "ML::Matrix";
+   return $self->{gpuif}->c_calculate_covariance(@_);
+}
+
+sub calculate_gram {
+   # wide data (more columns than rows): the first $k principal axes from the rows x rows Gram
+   # matrix, left natively for project_results and capture_model as eigenvectors leaves them, and
+   # their eigenvalues in @$values
+   my $self = shift;
+   my ($data, $k, $values) = @_;
+   if ($self->{debug} == 1) {
+      $self->{gpuif}->c_set_debug_on();
+   }
+   $self->_use_workspace();
+   return $self->{gpuif}->c_calculate_gram_packed($data->ptr, $k, $values) if ref($data) eq "ML::Matrix";
+   return $self->{gpuif}->c_calculate_gram($data, $k, $values);
+}
+
+sub project_batch {
+   # many small datasets, each standardised, fitted and projected on its own to (at most) $k
+   # columns, in one native call; returns the projections in the order of @$datasets
+   my $self = shift;
+   my ($datasets, $k) = @_;
+   my $results = [];
+   foreach my $i (0 .. $#$datasets) {
+      my $type = ref($datasets->[$i]);
+      die "ML::MVKernels::project_batch: dataset $i is neither an array of arrays nor an ML::Matrix"
+         unless $type eq "ARRAY" or $type eq "ML::Matrix";
    }
-   return $gpuif->c_calculate_covariance(@_);
+   # matrices go over as they are, so pca_batch can tell them from arrays by their class
+   return if $self->{gpuif}->c_pca_batch($datasets, $k, $results);
+   return $results;
 }
 
 sub eigenvectors {
@@ -349,9 +524,10 @@ sub eigenvectors {
    my $epsilon = shift;
    my $max_iterations = shift;
    if ($self->{debug} == 1) {
-      $gpuif->c_set_debug_on();
+      $self->{gpuif}->c_set_debug_on();
    }
-   $gpuif->c_eigenvectors($pQ, $epsilon, $max_iterations);
+   $self->_use_workspace();
+   $self->{gpuif}->c_eigenvectors($pQ, $epsilon, $max_iterations);
    return $pQ;
 }
 
@@ -360,11 +536,111 @@ sub project_results {
    my $columns = shift;
    my $projection = [];
    if ($self->{debug} == 1) {
-      $gpuif->c_set_debug_on();
+      $self->{gpuif}->c_set_debug_on();
+   }
+   $self->_use_workspace();
+   $self->{gpuif}->c_project_results($columns, $projection);
+   return $projection;
+}
+
+
+
+sub _use_workspace {
+   # each object keeps its own set of PCA working buffers, grown to the largest input it has seen
+   my $self = shift;
+   $self->{workspace} ||= $self->{gpuif}->c_pca_workspace_create();
+   $self->{gpuif}->c_pca_workspace_use($self->{workspace});
+}
+
+sub workspace_stats {
+   my $self = shift;
+   my $stats = {};
+   return unless $self->{workspace};
+   return if $self->{gpuif}->c_pca_workspace_stats($self->{workspace}, $stats);
+   return $stats;
+}
+
+sub capture_model {
+   my $self = shift;
+   my $columns = shift;
+   $self->_use_workspace();
+   return $self->{gpuif}->c_pca_model_capture($columns);
+}
+
+sub transform_model {
+   my $self = shift;
+   my $model = shift;
+   my $data = shift;
+   my $projection = [];
+   $self->_use_workspace();
+   if (ref($data) eq "ML::Matrix") {
+      return if $self->{gpuif}->c_pca_model_transform_packed($model, $data->ptr, $projection);
+      return $projection;
    }
-   $gpuif->c_project_results($columns, $projection);
+   return if $self->{gpuif}->c_pca_model_transform($model, $data, $projection);
    return $projection;
 }
 
+sub project_model {
+   # streams the projection of an ML::Matrix a block of rows at a time, to a file when $sink is a
+   # filename, otherwise to $sink->($first_row, $rows)
+   my $self = shift;
+   my ($model, $matrix, $sink, $block_rows) = @_;
+   if (ref($sink) eq "CODE") {
+      return !$self->{gpuif}->c_pca_model_stream($model, $matrix->ptr, $sink, $block_rows || 0);
+   }
+   return !$self->{gpuif}->c_pca_model_project_file($model, $matrix->ptr, $sink, $block_rows || 0);
+}
+
+sub save_model {
+   my $self = shift;
+   my ($model, $filename) = @_;
+   return !$self->{gpuif}->c_pca_model_save($model, $filename);
+}
+
+sub load_model {
+   my $self = shift;
+   my $filename = shift;
+   return $self->{gpuif}->c_pca_model_load($filename);
+}
+
+sub model_columns {
+   my $self = shift;
+   my $model = shift;
+   return $self->{gpuif}->c_pca_model_columns($model);
+}
+
+sub free_model {
+   my $self = shift;
+   my $model = shift;
+   $self->{gpuif}->c_pca_model_free($model);
+}
+
+
+sub run_pipeline {
+   # PCA projection followed by k-means on the projected data, without returning to Perl in between
+   my $self = shift;
+   my %params = @_;
+   my $result = { labels => [], centroids => [], stats => {} };
+   $result->{projection} = [] if $params{projection};
+   if ($self->{debug} == 1) {
+      $self->{gpuif}->c_set_debug_on();
+   }
+   $self->{gpuif}->c_set_covariance_engine($self->{covariance_engine});
+   $self->_use_workspace();
+   my $run = ref($params{data}) eq "ML::Matrix" ? "c_pipeline_run_packed" : "c_pipeline_run";
+   my $data = ref($params{data}) eq "ML::Matrix" ? $params{data}->ptr : $params{data};
+   return if $self->{gpuif}->$run($data, $params{k}, $params{epsilon}, $params{max_iterations},
+                          $params{clusters}, $params{maxiter}, $params{seed},
+                          $result->{labels}, $result->{centroids}, $result->{projection}, $result->{stats});
+   return $result;
+}
+
+sub DESTROY {
+   my $self = shift;
+   return unless $self->{gpuif};
+   $self->{gpuif}->c_pca_workspace_free(delete $self->{workspace}) if $self->{workspace};
+   $self->_free_inference();
+}
 
 1;
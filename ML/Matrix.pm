@@ -0,0 +1,351 @@
+package ML::Matrix;
+
+use Modern::Perl;
+
+use Cwd qw(abs_path);
+
+# A rows x cols matrix of floats held in one native buffer, so large inputs never become one SV
+# per cell.  ML::PCA (fit, project, transform) and ML::Pipeline take one in place of an array of
+# arrays.
+#
+#   my $m = ML::Matrix->load_csv("iris.csv", columns => [1 .. 4], header => 1);
+#   say $m->rows . " rows, " . $m->mb_per_sec . " MB/s";
+#   my $coords = ML::PCA->new()->project($m, 2);
+#
+# columns are numbered from 0, sep defaults to a tab for .tsv files and a comma otherwise.
+
+my $code;
+BEGIN {
+   $code = <<'EOCODE';
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+
+// This section is boilerplace code to move data from Perl -> C and back again
+
+#define HAVE_PERL_VERSION(R, V, S) \
+    (PERL_REVISION > (R) || (PERL_REVISION == (R) && (PERL_VERSION > (V) || (PERL_VERSION == (V) && (PERL_SUBVERSION >= (S))))))
+
+#define sv_setrv(s, r)  S_sv_setrv(aTHX_ s, r)
+
+static void S_sv_setrv(pTHX_ SV *sv, SV *rv)
+{
+  sv_setiv(sv, (IV)rv);
+#if !HAVE_PERL_VERSION(5, 24, 0)
+  SvIOK_off(sv);
+#endif
+  SvROK_on(sv);
+}
+
+int is_array_ref(
+        SV *array,
+        size_t *array_sz
+);
+
+int is_array_ref(
+        SV *array,
+        size_t *array_sz
+){
+        if( ! SvROK(array) ){ fprintf(stderr, "is_array_ref() : warning, input '%p' is not a reference.\n", array); return 0; }
+        if( SvTYPE(SvRV(array)) != SVt_PVAV ){ fprintf(stderr, "is_array_ref() : warning, input ref '%p' is not an ARRAY reference.\n", array); return 0; }
+        // it's an array, cast it to AV to get its len via av_len();
+        // yes, av_len needs to be bumped up
+        int asz = 1+av_len((AV *)SvRV(array));
+        if( asz < 0 ){ fprintf(stderr, "is_array_ref() : error, input array ref '%p' has negative size!\n", array); return 0; }
+        *array_sz = (size_t )asz;
+        return 1; // success, it is an array and size returned by ref, above
+}
+// end of Perl -> C -> Perl section
+
+void *csv_load(char *filename, char *sep, int skip_lines, SV *perl_columns, SV *perl_stats) {
+   size_t ncolumns = 0, i;
+   size_t *columns = NULL;
+   SV **ssubav;
+
+   if( SvROK(perl_columns) ){
+      if( ! is_array_ref(perl_columns, &ncolumns) ){
+         fprintf(stderr, "csv_load() : error, columns must be an array reference.\n");
+         return NULL;
+      }
+      if( (columns=(size_t *)malloc(sizeof(size_t)*(ncolumns + 1))) == NULL ){
+         fprintf(stderr, "csv_load() : error, failed to allocate %zu columns.\n", ncolumns);
+         return NULL;
+      }
+      for(i=0;i<ncolumns;i++){
+         ssubav = av_fetch((AV *)SvRV(perl_columns), i, FALSE);
+         IV c = (ssubav == NULL) ? -1 : SvIV(*ssubav);
+         if( c < 0 ){
+            fprintf(stderr, "csv_load() : error, column %zu is not a column number.\n", i);
+            free(columns);
+            return NULL;
+         }
+         columns[i] = c;
+      }
+   }
+   double mb_per_sec = 0;
+   host_matrix_t *m = host_csv_load(filename, sep[0], skip_lines, columns, ncolumns, &mb_per_sec);
+   free(columns);
+   if( m != NULL && SvROK(perl_stats) && SvTYPE(SvRV(perl_stats)) == SVt_PVHV ){
+      hv_store((HV *)SvRV(perl_stats), "mb_per_sec", 10, newSVnv(mb_per_sec), 0);
+   }
+   return (void *)m;
+}
+
+void *matrix_map(char *filename, int cols) {
+   return (void *)host_matrix_map(filename, cols > 0 ? cols : 0);
+}
+
+int matrix_rows(void *m) {
+   return ((host_matrix_t *)m)->rows;
+}
+
+int matrix_cols(void *m) {
+   return ((host_matrix_t *)m)->cols;
+}
+
+int matrix_into_AV(void *m_ptr, SV *perl_R) {
+   host_matrix_t *m = (host_matrix_t *)m_ptr;
+   AV *av, *av2;
+   float *pd;
+   size_t i, j, asz;
+
+   if( is_array_ref(perl_R, &asz) ){
+      if( asz > 0 ){
+         av_clear((AV *)SvRV(perl_R));
+      }
+   } else {
+      // LeoNerd's suggestion:
+      sv_setrv(SvROK(perl_R) ? SvRV(perl_R) : perl_R, (SV *)newAV());
+   }
+   HOST_PROFILE_SCOPE("marshal.rows_out");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * m->rows * m->cols);
+   pd = &(m->data[0]);
+   av = (AV *)SvRV(perl_R);
+   av_extend(av, m->rows);
+   for(i=0;i<m->rows;i++){ // for each row
+      av2 = newAV();
+      av_extend(av2, m->cols);
+      av_push(av, newRV_noinc((SV *)av2));
+      for(j=0;j<m->cols;j++){
+         av_store(av2, j, newSVnv(*pd));
+         pd++;
+      }
+   }
+   return 0;
+}
+
+void *matrix_from_AV(SV *perl_Data) {
+   host_matrix_t *m;
+   size_t DH, DW = 0, i, j;
+   SV **ssubav, **ssubsubav;
+   AV *av;
+
+   if( ! is_array_ref(perl_Data, &DH) ){
+      fprintf(stderr, "matrix_from_AV() : error, input is not an array of arrays.\n");
+      return NULL;
+   }
+   av = (AV *)SvRV(perl_Data);
+   if( DH > 0 ){
+      ssubav = av_fetch(av, 0, FALSE);
+      if( ssubav == NULL || ! is_array_ref(*ssubav, &DW) ){
+         fprintf(stderr, "matrix_from_AV() : error, row 0 is not an array.\n");
+         return NULL;
+      }
+   }
+   if( (m=(host_matrix_t *)calloc(1, sizeof(host_matrix_t))) == NULL ||
+       (m->data=(float *)host_alloc(sizeof(float)*(DH*DW + 1))) == NULL ){
+      fprintf(stderr, "matrix_from_AV() : error, failed to allocate %zu x %zu matrix.\n", DH, DW);
+      free(m);
+      return NULL;
+   }
+   m->rows = DH;
+   m->cols = DW;
+   HOST_PROFILE_SCOPE("marshal.rows_in");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(float) * DH * DW);
+   float *pd = &(m->data[0]);
+   for(i=0;i<DH;i++){ // for each row
+      ssubav = av_fetch(av, i, FALSE);
+      if( ssubav == NULL || ! SvROK(*ssubav) || SvTYPE(SvRV(*ssubav)) != SVt_PVAV ){
+         fprintf(stderr, "matrix_from_AV() : error, input does not contain a valid row at i=%zu\n", i);
+         host_matrix_free(m);
+         return NULL;
+      }
+      for(j=0;j<DW;j++){ // for the cols of that row
+         ssubsubav = av_fetch((AV *)SvRV(*ssubav), j, FALSE);
+         *pd = (ssubsubav == NULL) ? 0 : SvNV(*ssubsubav);
+         pd++;
+      }
+   }
+   return (void *)m;
+}
+
+int matrix_bounds(void *m_ptr, SV *perl_bounds) {
+   // the x (column 0) and y (column 1) ranges, as [ xmin, xmax, ymin, ymax ]
+   host_matrix_t *m = (host_matrix_t *)m_ptr;
+   float bounds[4];
+   if( m->cols < 2 || m->rows == 0 ){
+      fprintf(stderr, "matrix_bounds() : error, need at least one row of 2 columns, have %zu x %zu.\n", m->rows, m->cols);
+      return 1;
+   }
+   host_density_bounds(m->data, m->rows, m->cols, bounds);
+   AV *av = (AV *)SvRV(perl_bounds);
+   av_clear(av);
+   for(int i=0;i<4;i++){
+      av_push(av, newSVnv(bounds[i]));
+   }
+   return 0;
+}
+
+int matrix_density(void *m_ptr, SV *perl_labels, int clusters, int width, int height, SV *perl_transform, SV *perl_cells) {
+   // bins columns 0 and 1 into a width x height grid, pixel = floor(t0 + t1 * x), floor(t2 + t3 * y),
+   // and fills perl_cells with the pixel index, majority cluster and point count of every pixel with points in it
+   host_matrix_t *m = (host_matrix_t *)m_ptr;
+   size_t asz, i;
+   SV **ssubav;
+   double transform[4];
+   std::vector<int> labels;
+
+   if( m->cols < 2 || clusters < 1 || width < 1 || height < 1 ){
+      fprintf(stderr, "matrix_density() : error, %zu columns, %d clusters, %d x %d grid.\n", m->cols, clusters, width, height);
+      return 1;
+   }
+   if( ! is_array_ref(perl_transform, &asz) || asz != 4 ){
+      fprintf(stderr, "matrix_density() : error, transform must be [ x0, x scale, y0, y scale ].\n");
+      return 1;
+   }
+   for(i=0;i<4;i++){
+      transform[i] = SvNV(*av_fetch((AV *)SvRV(perl_transform), i, FALSE));
+   }
+   if( SvROK(perl_labels) ){
+      if( ! is_array_ref(perl_labels, &asz) || asz != m->rows ){
+         fprintf(stderr, "matrix_density() : error, need one label per row (%zu).\n", m->rows);
+         return 1;
+      }
+      labels.resize(m->rows);
+      for(i=0;i<m->rows;i++){
+         ssubav = av_fetch((AV *)SvRV(perl_labels), i, FALSE);
+         labels[i] = (ssubav == NULL) ? -1 : SvIV(*ssubav);
+      }
+   }
+   std::vector<unsigned int> total((size_t)width * height);
+   std::vector<int> majority((size_t)width * height);
+   if( host_density_bin(m->data, m->rows, m->cols, labels.empty() ? NULL : labels.data(), labels.empty() ? 1 : clusters,
+                        width, height, transform, total.data(), majority.data()) ){
+      return 1;
+   }
+   AV *av = (AV *)SvRV(perl_cells);
+   av_clear(av);
+   for(i=0;i<total.size();i++){
+      if( total[i] > 0 ){
+         av_push(av, newSVuv(i));
+         av_push(av, newSViv(majority[i]));
+         av_push(av, newSVuv(total[i]));
+      }
+   }
+   return 0;
+}
+
+void matrix_free(void *m) {
+   host_matrix_free((host_matrix_t *)m);
+}
+EOCODE
+};
+
+use Inline CPP => Config =>
+        BUILD_NOISY => 0,
+        force_build => 0,
+        clean_after_build => 0,
+        warnings => 0,
+        INC => "-I" . abs_path(substr(__FILE__,0,-1*(length("/ML/Matrix.pm"))) . "/inc")  . " -I" . abs_path("./inc") . " ",
+        LIBS => "-L" . abs_path(substr(__FILE__,0,-1*(length("/ML/Matrix.pm"))) . "/lib") . " -L" . abs_path("./lib") . " -lHostKernel "
+;
+
+use Inline CPP => $code;
+
+sub load_csv {
+   my $class = shift;
+   my $filename = shift;
+   my %params = @_;
+   my $sep = $params{sep};
+   $sep = ($filename =~ /\.tsv$/i ? "\t" : ",") unless defined($sep) and length($sep) == 1;
+   my $stats = {};
+   my $ptr = csv_load($filename, $sep, $params{header} || 0, $params{columns} || 0, $stats);
+   die "ML::Matrix::load_csv failed to load $filename" unless $ptr;
+   return bless { ptr => $ptr, mb_per_sec => $stats->{mb_per_sec} }, $class;
+}
+
+sub map {
+   # a file of raw native floats, cols => N to a row (as written by ML::PCA::transform_to, or
+   # numpy's tofile), mapped rather than read, so it can be bigger than memory
+   my $class = shift;
+   my $filename = shift;
+   my %params = @_;
+   my $ptr = matrix_map($filename, $params{cols} || 0);
+   die "ML::Matrix::map failed to map $filename" unless $ptr;
+   return bless { ptr => $ptr }, $class;
+}
+
+sub from_array {
+   # packs an array of arrays, all rows being as long as the first
+   my $class = shift;
+   my $rows = shift;
+   my $ptr = matrix_from_AV($rows);
+   die "ML::Matrix::from_array needs an array of arrays" unless $ptr;
+   return bless { ptr => $ptr }, $class;
+}
+
+sub ptr {
+   my $self = shift;
+   return $self->{ptr};
+}
+
+sub rows {
+   my $self = shift;
+   return matrix_rows($self->{ptr});
+}
+
+sub cols {
+   my $self = shift;
+   return matrix_cols($self->{ptr});
+}
+
+sub mb_per_sec {
+   # load throughput, file size over the time taken to map, split and parse it
+   my $self = shift;
+   return $self->{mb_per_sec};
+}
+
+sub bounds {
+   # [ xmin, xmax, ymin, ymax ] of the first two columns
+   my $self = shift;
+   my $bounds = [];
+   return if matrix_bounds($self->{ptr}, $bounds);
+   return $bounds;
+}
+
+sub density {
+   # bins the first two columns into a width x height pixel grid, see Chart::Scatter::add_density.
+   # Returns a flat list of (pixel index, majority cluster, count) for each pixel with points in it.
+   my $self = shift;
+   my %params = @_;
+   my $cells = [];
+   return if matrix_density($self->{ptr}, $params{labels} || 0, $params{clusters} || 1,
+                            $params{width}, $params{height}, $params{transform}, $cells);
+   return $cells;
+}
+
+sub to_array {
+   # a copy as an array of arrays, for code which wants Perl rows
+   my $self = shift;
+   my $rows = [];
+   matrix_into_AV($self->{ptr}, $rows);
+   return $rows;
+}
+
+sub DESTROY {
+   my $self = shift;
+   matrix_free(delete $self->{ptr}) if $self->{ptr};
+}
+
+1;
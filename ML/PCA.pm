@@ -2,11 +2,12 @@ use Modern::Perl;
 
 package ML::PCA;
 
-use List::Util qw(zip);
+use List::Util qw(zip max);
 use Storable qw(dclone);
-use ML::Util qw(transpose print_2d_array add_2_arrays diagonal_matrix matmul);
+use ML::Util qw(shape transpose print_2d_array add_2_arrays diagonal_matrix matmul);
 use lib '.';
 use ML::MVKernels;
+use ML::Matrix;
 
 use Data::Dumper;
 
@@ -14,12 +15,26 @@ use Data::Dumper;
 # note that this version of the algorithm divides by || u || whereas others 
 # divide by || u ||^2
 
-sub project {
+sub fit {
    my $self = shift;
    my $A = shift;
-say "PCA project, A has " . scalar(@$A) . " rows, and there are " . scalar(@{$A->[0]}) . " columns in row 0" if $self->{debug};
+   my ($rows, $cols) = shape($A);
+say "PCA fit, A has $rows rows, and there are $cols columns in row 0" if $self->{debug};
    my $k = shift;
-   $k ||= scalar(@{$A->[0]}); # if number of features, "k", isn't supplied, return all features
+   $k ||= $cols; # if number of features, "k", isn't supplied, keep all features
+   $k = $cols if $k > $cols;
+   if ($cols > $rows) {
+      # wide data: there are at most $rows components, and they are found from the $rows x $rows
+      # Gram matrix, so the $cols x $cols covariance (and its eigenvectors) are never built
+      $k = $rows if $k > $rows;
+      $self->{cov} = undef;
+      $self->{eigenvectors} = undef;
+      $self->{eigenvalues} = [];
+      $self->{Kernel}->calculate_gram($A, $k, $self->{eigenvalues}) and die "ML::PCA::fit failed on the $rows x $cols input";
+      $self->_free_model();
+      $self->{model} = $self->{Kernel}->capture_model($k) or die "ML::PCA::fit failed to keep the $k component model";
+      return $self;
+   }
    $self->{cov} = [];
    $self->{Kernel}->calculate_covariance($A, $self->{cov});  # $A is the array ref to the original data, $self->{cov} will be populated
                                               # with the covariance data.  The C function will have the standardised & scaled
@@ -36,9 +51,23 @@ say "PCA project, A has " . scalar(@$A) . " rows, and there are " . scalar(@{$A-
    $self->{Kernel}->eigenvectors($pQ, $self->{epsilon}, $self->{max_iterations});
    say "eigenvectors complete " . localtime() if $self->{debug};
    print_2d_array("eigenvectors", $pQ) if $self->{debug};
+   $self->{eigenvectors} = $pQ;
+   # keep the means, stddevs and first $k eigenvectors natively so transform can project new data
+   $self->_free_model();
+   $self->{model} = $self->{Kernel}->capture_model($k) or die "ML::PCA::fit failed to keep the $k component model";
+   return $self;
+}
+
+sub project {
+   my $self = shift;
+   my $A = shift;
+   my $k = shift;
+   $k ||= (shape($A))[1]; # if number of features, "k", isn't supplied, return all features
+   $self->fit($A, $k);
+   $k = $self->components(); # wide data has at most as many components as rows
 =pod
    my $results = [];
-   foreach my $r (@$pQ) {
+   foreach my $r (@{$self->{eigenvectors}}) {
       my @data;
       foreach my $i (0 .. ($k - 1)) {
          push @data, $r->[$i];
@@ -48,13 +77,82 @@ say "PCA project, A has " . scalar(@$A) . " rows, and there are " . scalar(@{$A-
    say "eigenvectors sorted, and trimmed, starting projection " . localtime() if $self->{debug};
    print_2d_array("eigenvectors", $results) if $self->{debug};
 =cut
-   $self->{eigenvectors} = $pQ;
    my $projection = $self->{Kernel}->project_results($k); # Z and the eigenvectors will already be on the device
    $self->{projection} = $projection;
    print_2d_array("projection", $projection) if $self->{debug};
    return $projection;
 }
 
+sub project_batch {
+   # ML::PCA->project_batch([$A1, $A2, ...], $k): the projection of each of many small, independent
+   # datasets (arrays of arrays or ML::Matrix) onto its own first $k components, all in one call
+   # rather than a fit per dataset.  Nothing is kept for transform.
+   my $self = shift;
+   my $datasets = shift;
+   my $k = shift;
+   $self = $self->new() unless ref($self);
+   return [] unless @$datasets;
+   $k ||= max(map { ref($_) eq "ML::Matrix" ? $_->cols : ref($_) eq "ARRAY" ? (shape($_))[1] : 0 } @$datasets);
+   my $projections = $self->{Kernel}->project_batch($datasets, $k);
+   die "ML::PCA::project_batch failed" unless defined($projections);
+   return $projections;
+}
+
+sub transform {
+   # project new rows with the model from the last fit (or load), without refitting
+   my $self = shift;
+   my $A = shift;
+   die "ML::PCA::transform called before fit or load" unless $self->{model};
+   my $projection = $self->{Kernel}->transform_model($self->{model}, $A);
+   die "ML::PCA::transform failed" unless defined($projection);
+   print_2d_array("transformed", $projection) if $self->{debug};
+   return $projection;
+}
+
+sub transform_to {
+   # out-of-core transform: $pca->transform_to($data, $sink, block_rows => 65536) projects a block
+   # of rows at a time, overlapping the projection of the next block with the handling of this
+   # one, so memory is bounded by the block size whatever the number of rows.  $data is an
+   # ML::Matrix (ML::Matrix->map for a file of raw floats bigger than memory) or an array of
+   # arrays.  $sink is a filename, written as raw native floats, components to a row (which
+   # ML::Matrix->map can read back), or a sub called as $sink->($first_row, $rows) per block.
+   my $self = shift;
+   my $data = shift;
+   my $sink = shift;
+   my %params = @_;
+   die "ML::PCA::transform_to called before fit or load" unless $self->{model};
+   $data = ML::Matrix->from_array($data) unless ref($data) eq "ML::Matrix";
+   $self->{Kernel}->project_model($self->{model}, $data, $sink, $params{block_rows}) or die "ML::PCA::transform_to failed";
+   return $self;
+}
+
+sub save {
+   my $self = shift;
+   my $filename = shift;
+   die "ML::PCA::save called before fit" unless $self->{model};
+   return $self->{Kernel}->save_model($self->{model}, $filename);
+}
+
+sub load {
+   # ML::PCA->load($filename, %params) or $pca->load($filename)
+   my $self = shift;
+   my $filename = shift;
+   $self = $self->new(@_) unless ref($self);
+   $self->_free_model();
+   $self->{model} = $self->{Kernel}->load_model($filename) or die "ML::PCA::load unable to load $filename";
+   return $self;
+}
+
+sub components {
+   my $self = shift;
+   return $self->{model} ? $self->{Kernel}->model_columns($self->{model}) : 0;
+}
+
+sub _free_model {
+   my $self = shift;
+   $self->{Kernel}->free_model(delete $self->{model}) if $self->{model};
+}
+
 sub new {
    my $class = shift;
    my %params = @_;
@@ -75,10 +173,16 @@ sub new {
       $params{GPU} = "CUDA";
    }
    ML::MVKernels->import($params{GPU});
-   $self->{Kernel} = ML::MVKernels->new( debug => $self->{debug});
+   $self->{Kernel} = ML::MVKernels->new( debug => $self->{debug}, covariance => $params{covariance});
    bless $self, $class;
 }
 
+sub workspace_stats {
+   # allocations, reuses and bytes held by the buffers kept between runs
+   my $self = shift;
+   return $self->{Kernel}->workspace_stats();
+}
+
 sub covariance {
    my $self = shift;
    return $self->{cov};
@@ -94,4 +198,10 @@ sub cumulative_explained_variance {
    return [ map { $running_total += $_->{value} / $e_sum; $running_total } @{$self->{eigenvector_sums}} ];
 }
    
+
+sub DESTROY {
+   my $self = shift;
+   $self->_free_model();
+}
+
 1;
@@ -0,0 +1,64 @@
+use Modern::Perl;
+
+package ML::Pipeline;
+
+# PCA followed by k-means clustering of the projected data, run as a single native call.
+#
+#   my $result = ML::Pipeline->new(pca => { k => 2 }, kmeans => { clusters => 3 })->run($data);
+#
+# $result->{labels} has the cluster of each row of $data, $result->{centroids} the centroids in the
+# projected space.  Pass projection => 1 to run() to get the projected data back as well.
+
+use lib '.';
+use ML::MVKernels;
+use ML::Util qw(shape);
+
+sub new {
+   my $class = shift;
+   my %params = @_;
+   my $self = {};
+   my $pca = $params{pca} || {};
+   my $kmeans = $params{kmeans} || {};
+   if (defined($params{debug}) and $params{debug} =~ /^\d+$/ and $params{debug} > 0) {
+      $self->{debug} = 1;
+   } else {
+      $self->{debug} = 0;
+   }
+   $self->{k} = $pca->{k};
+   $self->{epsilon} = $pca->{threshold};
+   $self->{epsilon} ||= 0.00001;
+   $self->{epsilon} = 0.00001 unless $self->{epsilon} =~ /^\d+\.?\d+?$/;
+   $self->{max_iterations} = $pca->{max_iterations};
+   $self->{max_iterations} ||= 10;
+   $self->{max_iterations} = 10 unless $self->{max_iterations} =~ /^\d+$/;
+   $self->{clusters} = $kmeans->{clusters} or die "ML::Pipeline needs kmeans => { clusters => N }";
+   $self->{maxiter} = $kmeans->{maxiter};
+   $self->{maxiter} = 100 unless defined($self->{maxiter}) and $self->{maxiter} =~ /^\d+$/;
+   $self->{seed} = $kmeans->{seed};
+   if (!defined($pca->{GPU}) or $pca->{GPU} ne "ROCM") {
+      $pca->{GPU} = "CUDA";
+   }
+   ML::MVKernels->import($pca->{GPU});
+   $self->{Kernel} = ML::MVKernels->new( debug => $self->{debug}, covariance => $pca->{covariance});
+   return bless $self, $class;
+}
+
+sub run {
+   my $self = shift;
+   my $data = shift;
+   my %params = @_;
+   my $k = $self->{k} || (shape($data))[1];
+   my $result = $self->{Kernel}->run_pipeline( data => $data,
+                                               k => $k,
+                                               epsilon => $self->{epsilon},
+                                               max_iterations => $self->{max_iterations},
+                                               clusters => $self->{clusters},
+                                               maxiter => $self->{maxiter},
+                                               seed => defined($self->{seed}) ? $self->{seed} : int(rand(2**31)),
+                                               projection => $params{projection} );
+   die "ML::Pipeline::run failed" unless defined($result);
+   $result->{converged} = $result->{stats}{changes} == 0 ? 1 : 0;
+   return $result;
+}
+
+1;
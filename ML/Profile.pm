@@ -0,0 +1,150 @@
+package ML::Profile;
+
+use Modern::Perl;
+
+use Cwd qw(abs_path);
+
+# Stage timings and counters from the native code (ingest, PCA stages and eigen iterations,
+# projection, k-means phases, the network's forward/backward pass per layer, marshalling between
+# Perl and C, and bytes allocated).  Off until enabled, and cheap when on.
+#
+#   ML::Profile->enable();
+#   ... run things ...
+#   my $stats = ML::Profile->stats();      # { stages => { name => { calls, total_ms, ... } }, counters => { ... }, tasks => { ... }, memory => { ... } }
+#   ML::Profile->write_trace("run.json");  # open in chrome://tracing or https://ui.perfetto.dev
+#
+# tasks are the parallel loops run on the worker pool (ML::Threads), each with utilisation (the
+# share of its threads' time spent working), imbalance (the busiest thread against the mean, 1 is
+# even), the mean number of threads which joined it, and the chunks stolen between them.
+#
+# memory is the host allocator's (host_alloc) allocations, frees, bytes allocated, in use and at
+# peak, how many of those bytes are on huge pages, and the blocks large enough to be mapped alone.
+#
+# With ML_PROFILE_TRACE=file.json in the environment, loading the module (e.g. perl -MML::Profile
+# script.pl) enables it for the whole run and writes the trace at exit.
+
+my $code;
+BEGIN {
+   $code = <<'EOCODE';
+#include "HostKernel.h"
+#include "HostProfile.h"
+
+void profile_enable(int on) {
+   host_profile_enable(on);
+}
+
+void profile_reset() {
+   host_profile_reset();
+}
+
+int profile_write_trace(char *filename) {
+   return host_profile_write_trace(filename);
+}
+
+int profile_stats(SV *perl_stats) {
+   HV *hv, *stages, *counters, *tasks, *memory, *stage, *task;
+   const char *name;
+   uint64_t calls, total_ns, min_ns, max_ns, value, steals;
+   double utilisation, imbalance, workers;
+   size_t i, n;
+   host_memory_stats_t mem;
+
+   if( ! SvROK(perl_stats) || SvTYPE(SvRV(perl_stats)) != SVt_PVHV ){
+      fprintf(stderr, "profile_stats() : error, expecting a hash reference.\n");
+      return 1;
+   }
+   hv = (HV *)SvRV(perl_stats);
+   stages = newHV();
+   counters = newHV();
+   tasks = newHV();
+   hv_store(hv, "stages", 6, newRV_noinc((SV *)stages), 0);
+   hv_store(hv, "counters", 8, newRV_noinc((SV *)counters), 0);
+   hv_store(hv, "tasks", 5, newRV_noinc((SV *)tasks), 0);
+   // the allocator's counts are kept whether or not profiling is on
+   memory = newHV();
+   hv_store(hv, "memory", 6, newRV_noinc((SV *)memory), 0);
+   host_memory_stats(&mem);
+   hv_store(memory, "allocations", 11, newSVuv(mem.allocations), 0);
+   hv_store(memory, "frees", 5, newSVuv(mem.frees), 0);
+   hv_store(memory, "bytes_allocated", 15, newSVuv(mem.bytes_allocated), 0);
+   hv_store(memory, "bytes_in_use", 12, newSVuv(mem.bytes_in_use), 0);
+   hv_store(memory, "peak_bytes", 10, newSVuv(mem.peak_bytes), 0);
+   hv_store(memory, "huge_page_bytes", 15, newSVuv(mem.huge_page_bytes), 0);
+   hv_store(memory, "mapped_blocks", 13, newSVuv(mem.mapped_blocks), 0);
+   n = host_profile_stage_count();
+   for(i=0;i<n;i++){
+      host_profile_stage(i, &name, &calls, &total_ns, &min_ns, &max_ns);
+      stage = newHV();
+      hv_store(stage, "calls", 5, newSVuv(calls), 0);
+      hv_store(stage, "total_ms", 8, newSVnv(total_ns / 1e6), 0);
+      hv_store(stage, "mean_ms", 7, newSVnv(calls ? total_ns / 1e6 / calls : 0), 0);
+      hv_store(stage, "min_ms", 6, newSVnv(min_ns / 1e6), 0);
+      hv_store(stage, "max_ms", 6, newSVnv(max_ns / 1e6), 0);
+      hv_store(stages, name, strlen(name), newRV_noinc((SV *)stage), 0);
+   }
+   n = host_profile_counter_count();
+   for(i=0;i<n;i++){
+      host_profile_counter(i, &name, &value);
+      hv_store(counters, name, strlen(name), newSVuv(value), 0);
+   }
+   n = host_profile_task_count();
+   for(i=0;i<n;i++){
+      host_profile_task(i, &name, &calls, &total_ns, &utilisation, &imbalance, &workers, &steals);
+      task = newHV();
+      hv_store(task, "calls", 5, newSVuv(calls), 0);
+      hv_store(task, "total_ms", 8, newSVnv(total_ns / 1e6), 0);
+      hv_store(task, "utilisation", 11, newSVnv(utilisation), 0);
+      hv_store(task, "imbalance", 9, newSVnv(imbalance), 0);
+      hv_store(task, "workers", 7, newSVnv(workers), 0);
+      hv_store(task, "steals", 6, newSVuv(steals), 0);
+      hv_store(tasks, name, strlen(name), newRV_noinc((SV *)task), 0);
+   }
+   return 0;
+}
+EOCODE
+};
+
+use Inline CPP => Config =>
+        BUILD_NOISY => 0,
+        force_build => 0,
+        clean_after_build => 0,
+        warnings => 0,
+        INC => "-I" . abs_path(substr(__FILE__,0,-1*(length("/ML/Profile.pm"))) . "/inc")  . " -I" . abs_path("./inc") . " ",
+        LIBS => "-L" . abs_path(substr(__FILE__,0,-1*(length("/ML/Profile.pm"))) . "/lib") . " -L" . abs_path("./lib") . " -lHostKernel "
+;
+
+use Inline CPP => $code;
+
+sub enable {
+   profile_enable(1);
+}
+
+sub disable {
+   profile_enable(0);
+}
+
+sub reset {
+   # clears everything recorded so far, call between runs rather than during one
+   profile_reset();
+}
+
+sub stats {
+   my $stats = {};
+   return if profile_stats($stats);
+   return $stats;
+}
+
+sub write_trace {
+   my $class = shift;
+   my $filename = shift;
+   return !profile_write_trace($filename);
+}
+
+my $trace_file = $ENV{ML_PROFILE_TRACE};
+profile_enable(1) if $trace_file;
+
+END {
+   ML::Profile->write_trace($trace_file) if $trace_file;
+}
+
+1;
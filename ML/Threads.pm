@@ -0,0 +1,60 @@
+package ML::Threads;
+
+use Modern::Perl;
+
+use Cwd qw(abs_path);
+
+# The worker pool shared by all of the native host code (PCA, k-means, the CPU network, the CSV
+# loader).  Its size counts the calling thread, and defaults to ML_THREADS from the environment or
+# else the number of CPUs; with affinity each worker is pinned to its own CPU (ML_THREAD_AFFINITY=1
+# for the default).  Change them between runs rather than while one is going.
+#
+#   ML::Threads->set(threads => 8, affinity => 1);
+#   my $threads = ML::Threads->count();
+#
+# How well each parallel loop used the pool shows up as the tasks in ML::Profile->stats().
+
+my $code;
+BEGIN {
+   $code = <<'EOCODE';
+#include "HostKernel.h"
+
+void threads_set(int threads) {
+   host_set_threads(threads);
+}
+
+int threads_count() {
+   return host_get_threads();
+}
+
+void threads_affinity(int on) {
+   host_set_affinity(on);
+}
+EOCODE
+};
+
+use Inline CPP => Config =>
+        BUILD_NOISY => 0,
+        force_build => 0,
+        clean_after_build => 0,
+        warnings => 0,
+        INC => "-I" . abs_path(substr(__FILE__,0,-1*(length("/ML/Threads.pm"))) . "/inc")  . " -I" . abs_path("./inc") . " ",
+        LIBS => "-L" . abs_path(substr(__FILE__,0,-1*(length("/ML/Threads.pm"))) . "/lib") . " -L" . abs_path("./lib") . " -lHostKernel "
+;
+
+use Inline CPP => $code;
+
+sub set {
+   my $class = shift;
+   my %args = @_;
+   # threads => 0 goes back to the default
+   threads_set($args{threads}) if exists $args{threads};
+   threads_affinity($args{affinity} ? 1 : 0) if exists $args{affinity};
+   return threads_count();
+}
+
+sub count {
+   return threads_count();
+}
+
+1;
@@ -1,7 +1,12 @@
 use Modern::Perl;
 package ML::Util;
 use Exporter 'import';
-our @EXPORT_OK = qw(print_2d_array transpose add_2_arrays diagonal_matrix matmul print_1d_array rotate_matrix_180 conv2d);
+our @EXPORT_OK = qw(shape print_2d_array transpose add_2_arrays diagonal_matrix matmul print_1d_array rotate_matrix_180 conv2d);
+
+# matmul, transpose, add_2_arrays and conv2d run natively (ML::UtilNative, on the host library)
+# when it can be loaded, and as the Perl loops below when it can't or it turns the input down
+# (local $ML::Util::native = 0 forces the Perl loops, as t/util_native.t does to compare them)
+our $native = eval { require ML::UtilNative; 1 };
 
 sub print_2d_array {
    my ($title,$d) = @_;
@@ -13,6 +18,13 @@ sub print_2d_array {
    say "";
 }
 
+sub shape {
+   # rows and columns of an array of arrays or an ML::Matrix
+   my $d = shift;
+   return ($d->rows, $d->cols) if ref($d) eq "ML::Matrix";
+   return (scalar(@$d), scalar(@{$d->[0]}));
+}
+
 sub print_1d_array {
    my ($title,$d) = @_;
    say $title;
@@ -20,6 +32,10 @@ sub print_1d_array {
 }
 
 sub transpose {
+   if ($native) {
+      my $O = ML::UtilNative::transpose(@_);
+      return $O if $O;
+   }
    my $M = shift;   
    my $O = []; 
    foreach my $i (0 .. $#$M) {
@@ -31,6 +47,10 @@ sub transpose {
 }
 
 sub add_2_arrays { # same size assumed
+   if ($native) {
+      my $O = ML::UtilNative::add_2_arrays(@_);
+      return $O if $O;
+   }
    my ($M1, $M2) = @_;
    my $O = [];
    foreach my $i (0 .. $#$M1) {
@@ -58,6 +78,10 @@ sub diagonal_matrix {
 
 sub matmul {
    # matrix multiplication
+   if ($native) {
+      my $c = ML::UtilNative::matmul(@_);
+      return $c if $c;
+   }
    my ($il, $ol) = @_;
    my $ar = $#$il;
    my $ac = $#{$il->[0]};
@@ -95,6 +119,10 @@ sub rotate_matrix_180 {
 }
 
 sub conv2d {
+  if ($native) {
+     my $output = ML::UtilNative::conv2d(@_);
+     return $output if $output;
+  }
   my ($in, $filter, $operation) = @_;
   $operation = "padded" unless $operation eq "expand" or $operation eq "reduce";
   # operation:
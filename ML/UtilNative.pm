@@ -0,0 +1,184 @@
+package ML::UtilNative;
+
+use Modern::Perl;
+
+use Cwd qw(abs_path);
+
+# The native side of ML::Util: matmul, transpose, add_2_arrays and conv2d on the host library, in
+# double as the Perl versions work.  ML::Util uses these when this module loads and its own Perl
+# loops otherwise, so nothing else should need to use it directly.  Each returns undef rather than
+# dying when its input isn't what it expects, and ML::Util then leaves it to the Perl version.
+
+my $code;
+BEGIN {
+   $code = <<'EOCODE';
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+
+// This section is boilerplace code to move data from Perl -> C and back again
+
+static int is_rows(SV *array, size_t *array_sz) {
+   // quietly, a mismatch just means the Perl version is used
+   if( ! SvROK(array) || SvTYPE(SvRV(array)) != SVt_PVAV ){
+      return 0;
+   }
+   *array_sz = 1+av_len((AV *)SvRV(array));
+   return 1;
+}
+
+static int rows_in(SV *perl_rows, size_t cols, std::vector<double> &dst, size_t *rows, size_t *width) {
+   // an array of arrays as rows x width doubles, width being cols or else the first row's length,
+   // as the Perl versions size their loops; ragged input (a row shorter than that) is left to them
+   size_t n, rowlen, i, j;
+   if( ! is_rows(perl_rows, &n) || n == 0 ){
+      return 1;
+   }
+   AV *av = (AV *)SvRV(perl_rows);
+   if( cols == 0 ){
+      SV **first = av_fetch(av, 0, FALSE);
+      if( first == NULL || ! is_rows(*first, &cols) || cols == 0 ){
+         return 1;
+      }
+   }
+   HOST_PROFILE_SCOPE("marshal.rows_in");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(double) * n * cols);
+   dst.assign(n * cols, 0.0);
+   double *pd = dst.data();
+   for(i=0;i<n;i++){ // for each row
+      SV **ssubav = av_fetch(av, i, FALSE);
+      if( ssubav == NULL || ! is_rows(*ssubav, &rowlen) ){
+         return 1;
+      }
+      if( rowlen < cols ){
+         return 1;
+      }
+      AV *row = (AV *)SvRV(*ssubav);
+      for(j=0;j<cols;j++){ // for the cols of that row
+         SV **cell = av_fetch(row, j, FALSE);
+         pd[j] = (cell == NULL) ? 0 : SvNV(*cell);
+      }
+      pd += cols;
+   }
+   *rows = n;
+   *width = cols;
+   return 0;
+}
+
+static void rows_out(const double *src, size_t rows, size_t cols, SV *perl_R) {
+   HOST_PROFILE_SCOPE("marshal.rows_out");
+   HOST_PROFILE_COUNT("bytes_marshalled", sizeof(double) * rows * cols);
+   size_t i, j;
+   AV *av = (AV *)SvRV(perl_R); // the wrappers below always pass an empty array
+   av_extend(av, rows);
+   for(i=0;i<rows;i++){ // for each row
+      AV *av2 = newAV();
+      av_extend(av2, cols);
+      av_push(av, newRV_noinc((SV *)av2));
+      for(j=0;j<cols;j++){
+         av_store(av2, j, newSVnv(*src));
+         src++;
+      }
+   }
+}
+// end of Perl -> C -> Perl section
+
+int util_matmul(SV *perl_A, SV *perl_B, SV *perl_C) {
+   std::vector<double> a, b;
+   size_t ar, ac, br, bc;
+   if( rows_in(perl_A, 0, a, &ar, &ac) || rows_in(perl_B, 0, b, &br, &bc) || ac != br ){
+      return 1;
+   }
+   std::vector<double> c(ar * bc);
+   host_dgemm(0, 0, ar, bc, ac, 1.0, a.data(), ac, b.data(), bc, 0.0, c.data(), bc);
+   rows_out(c.data(), ar, bc, perl_C);
+   return 0;
+}
+
+int util_transpose(SV *perl_A, SV *perl_T) {
+   std::vector<double> a;
+   size_t rows, cols;
+   if( rows_in(perl_A, 0, a, &rows, &cols) ){
+      return 1;
+   }
+   std::vector<double> t(rows * cols);
+   host_dtranspose(a.data(), rows, cols, t.data());
+   rows_out(t.data(), cols, rows, perl_T);
+   return 0;
+}
+
+int util_add(SV *perl_A, SV *perl_B, SV *perl_C) {
+   std::vector<double> a, b;
+   size_t ar, ac, br, bc, i;
+   if( rows_in(perl_A, 0, a, &ar, &ac) || rows_in(perl_B, ac, b, &br, &bc) || br < ar ){
+      return 1;
+   }
+   for(i=0;i<ar*ac;i++){
+      a[i] += b[i];
+   }
+   rows_out(a.data(), ar, ac, perl_C);
+   return 0;
+}
+
+int util_conv2d(SV *perl_In, SV *perl_Filter, int mode, SV *perl_Out) {
+   std::vector<double> in, filter;
+   size_t n, k, cols;
+   // both are taken as square, as many columns as rows, as the Perl version does
+   if( ! is_rows(perl_In, &n) || rows_in(perl_In, n, in, &n, &cols) ){
+      return 1;
+   }
+   if( ! is_rows(perl_Filter, &k) || rows_in(perl_Filter, k, filter, &k, &cols) ){
+      return 1;
+   }
+   size_t out_n = host_conv2d_size(n, k, mode);
+   std::vector<double> out(out_n * out_n);
+   host_dconv2d(in.data(), n, filter.data(), k, mode, out.data());
+   rows_out(out.data(), out_n, out_n, perl_Out);
+   return 0;
+}
+EOCODE
+};
+
+use Inline CPP => Config =>
+        BUILD_NOISY => 0,
+        force_build => 0,
+        clean_after_build => 0,
+        warnings => 0,
+        INC => "-I" . abs_path(substr(__FILE__,0,-1*(length("/ML/UtilNative.pm"))) . "/inc")  . " -I" . abs_path("./inc") . " ",
+        LIBS => "-L" . abs_path(substr(__FILE__,0,-1*(length("/ML/UtilNative.pm"))) . "/lib") . " -L" . abs_path("./lib") . " -lHostKernel "
+;
+
+use Inline CPP => $code;
+
+my %conv2d_modes = ( padded => 0, expand => 1, reduce => 2 );
+
+sub matmul {
+   my ($A, $B) = @_;
+   my $C = [];
+   return if util_matmul($A, $B, $C);
+   return $C;
+}
+
+sub transpose {
+   my $A = shift;
+   my $T = [];
+   return if util_transpose($A, $T);
+   return $T;
+}
+
+sub add_2_arrays {
+   my ($A, $B) = @_;
+   my $C = [];
+   return if util_add($A, $B, $C);
+   return $C;
+}
+
+sub conv2d {
+   my ($in, $filter, $operation) = @_;
+   my $out = [];
+   return if util_conv2d($in, $filter, $conv2d_modes{$operation // ""} // 0, $out);
+   return $out;
+}
+
+1;
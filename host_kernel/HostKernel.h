@@ -0,0 +1,224 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct host_pca_model {
+   size_t cols;          // number of features the model was fitted on
+   size_t k;             // number of components kept
+   float *means;         // 1 x cols
+   float *stddev;        // 1 x cols
+   float *components;    // cols x k, column j is the j'th eigenvector
+   float *scaled;        // k x cols, components / stddev, transposed, used by transform
+   float *offset;        // 1 x k, the projection of the means, used by transform
+} host_pca_model_t;
+
+typedef struct host_kmeans_index {
+   size_t lists;          // coarse centres, each with the list of centroids nearest to it
+   size_t probes;         // lists scanned per point, calibrated on each assign to meet the recall
+   float recall;          // target fraction of points given their exact nearest centroid
+   int audit;             // also count the differences from exact assignment over every point
+   int built, stale;      // the lists exist / the centroids have moved since they were built
+   float *coarse;         // lists x cols
+   float *coarse_t;       // cols x lists, transposed copy used to rank the lists
+   size_t *list_of;       // 1 x clusters, the list each centroid is in
+   size_t *list_start;    // 1 x (lists + 1), offsets into members
+   size_t *members;       // 1 x clusters, centroid ids grouped by list
+   float *members_t;      // per list, cols x list size, the members transposed
+   size_t sampled;        // points checked against exact assignment by the last assign
+   size_t sample_mismatches; // of those, how many weren't given their exact nearest centroid
+   long exact_mismatches; // over every point when audit is set, otherwise -1
+} host_kmeans_index_t;
+
+typedef struct host_kmeans {
+   size_t rows, cols, clusters;
+   const float *data;    // rows x cols, owned by the caller
+   float *centroids;     // clusters x cols
+   float *centroids_t;   // cols x clusters, transposed copy used by assign
+   size_t *cluster_map;  // 1 x rows, the cluster each row is assigned to
+   size_t *point_count;  // 1 x clusters, filled in by update
+   size_t *members;      // 1 x rows, the rows in cluster order, kept by update when it works per cluster
+   size_t *member_start; // 1 x (clusters + 1), where each cluster's rows end in members
+   double inertia;       // sum of squared distances to the assigned centroids, from the last assign
+   host_kmeans_index_t *index; // when set, assign searches only the nearest lists of centroids
+} host_kmeans_t;
+
+typedef struct host_layer {
+   size_t input_size, output_size;
+   float *weights;             // output_size x input_size
+   float *bias;                // 1 x output_size
+   float *weights_derivative;  // output_size x input_size, summed over the batch
+   float *bias_derivative;     // 1 x output_size, summed over the batch
+   float *activation;          // batch x output_size, sigmoid(input x weights^T + bias)
+   float *delta;               // batch x output_size
+} host_layer_t;
+
+typedef struct host_kmeans_job host_kmeans_job_t; // a k-means run on a background thread
+
+typedef struct host_kmeans_score {
+   size_t clusters;
+   size_t iterations;    // after the first assignment, as host_kmeans_run counts them
+   size_t changes;       // made by the last assignment, 0 if it converged
+   double inertia;       // sum of squared distances to the assigned centroids
+   double davies_bouldin; // lower is better, NaN with fewer than 2 non-empty clusters
+   double silhouette;    // mean over the sample, -1 .. 1 and higher is better, NaN without a sample
+} host_kmeans_score_t;
+
+typedef struct host_kmeans_anytime {
+   size_t iterations;        // on the full data, after its first assignment, as host_kmeans_run counts them
+   size_t changes;           // made by the assignment the labels come from, 0 if it converged
+   int converged;
+   int deadline_hit;         // stopped because the next iteration wouldn't have ended in time
+   size_t sample_rows;       // rows in the largest subsample the centroids were refined on, 0 for none
+   size_t sample_iterations; // over all of the subsamples
+   double inertia;           // of the labels and centroids left in the engine
+   double elapsed_ms;
+} host_kmeans_anytime_t;
+
+typedef struct host_network {
+   size_t layers;
+   host_layer_t *layer;
+   size_t batch_size;    // rows the activation and delta buffers can hold
+   size_t rows;          // rows in the batch last fed forward
+   int loss;             // 1 = quadratic, 2 = cross entropy, the same numbers as set_loss
+   float *partials;      // per-thread gradients, used when a batch is split between threads
+   size_t partials_chunks;
+} host_network_t;
+
+typedef struct host_checkpoint {
+   int loss;
+   size_t layers;
+   size_t *sizes;        // 1 x (layers + 1), the input size then each layer's output size
+   const float **weights; // per layer, output x input, pointing into the mapped file
+   const float **bias;    // per layer, 1 x output, pointing into the mapped file
+   void *map;
+   size_t map_size;
+} host_checkpoint_t;
+
+typedef struct host_inference {
+   size_t layers;
+   size_t *sizes;        // 1 x (layers + 1), the input size then each layer's output size
+   float **weights_t;    // per layer, input x output (transposed from the network's layout)
+   float **bias;         // per layer, 1 x output
+   float *parameters;    // the block weights_t and bias point into
+   size_t max_width;     // widest layer output, which sizes each thread's activation buffers
+} host_inference_t;
+
+typedef struct host_memory_stats {
+   uint64_t allocations, frees; // by host_alloc (and host_realloc) / host_free, since the start
+   uint64_t bytes_allocated;    // in total since the start
+   uint64_t bytes_in_use, peak_bytes;
+   uint64_t huge_page_bytes;    // of bytes_in_use, in blocks mapped with huge pages
+   uint64_t mapped_blocks;      // blocks big enough to be mapped on their own, in use
+} host_memory_stats_t;
+
+typedef struct host_matrix {
+   size_t rows, cols;
+   float *data;          // rows x cols
+   size_t mapped;        // bytes mapped when data is a mapped file (host_matrix_map), 0 when allocated
+} host_matrix_t;
+
+// receives a block of rows, first_row being the block's first row in the whole output; non-zero stops
+typedef int (*host_block_sink_t)( void *ctx, const float *block, size_t first_row, size_t rows, size_t cols );
+
+// 64-byte aligned, zeroed host memory, large blocks on huge pages and first touched by the workers;
+// for buffers that stay on the host, free with host_free.  ML_HUGE_PAGES=explicit uses reserved
+// huge pages, ML_HUGE_PAGES=0 none
+void *host_alloc( size_t bytes );
+void *host_realloc( void *p, size_t bytes );
+void host_free( void *p );
+void host_memory_stats( host_memory_stats_t *stats );
+
+void host_set_threads( int threads );  // the worker pool's size, counting the calling thread; ML_THREADS sets the default
+int host_get_threads();
+void host_set_affinity( int on );      // pin each worker to its own CPU; ML_THREAD_AFFINITY=1 sets the default
+
+void host_calc_covariance( const float *z, float *cov, size_t rows, size_t cols );
+void host_sgemm( int transa, int transb, size_t m, size_t n, size_t k, float alpha, const float *a, size_t lda,
+                 const float *b, size_t ldb, float beta, float *c, size_t ldc );
+void host_dgemm( int transa, int transb, size_t m, size_t n, size_t k, double alpha, const double *a, size_t lda,
+                 const double *b, size_t ldb, double beta, double *c, size_t ldc );
+void host_dtranspose( const double *a, size_t rows, size_t cols, double *out );
+// ML::Util::conv2d of the n x n in by the k x k filter, mode 0 = padded (out is n x n), 1 = expand
+// (grown by the filter's half width each side), 2 = reduce (shrunk by it); out is
+// host_conv2d_size(n, k, mode) squared
+size_t host_conv2d_size( size_t n, size_t k, int mode );
+void host_dconv2d( const double *in, size_t n, const double *filter, size_t k, int mode, double *out );
+
+host_pca_model_t *host_pca_model_create( size_t cols, size_t k, const float *means, const float *stddev, const float *components );
+void host_pca_model_free( host_pca_model_t *model );
+// principal axes of the rows x cols standardised data z by way of its rows x rows Gram matrix, for
+// cols much larger than rows: the first k (k <= rows) as cols x k components, and their variances
+int host_pca_gram( const float *z, size_t rows, size_t cols, size_t k, float *components, float *values );
+// PCA fitted and applied on its own to each of count small datasets packed one after another in
+// data (dataset d is rows[d] x cols[d]); each is projected onto its first min(k, cols[d])
+// components, and the projections are packed one after another in out the same way
+int host_pca_batch( const float *data, const size_t *rows, const size_t *cols, size_t count, size_t k, float *out );
+void host_pca_model_transform( const host_pca_model_t *model, const float *data, size_t rows, float *out );
+int host_pca_model_stream( const host_pca_model_t *model, const host_matrix_t *m, size_t block_rows,
+                           host_block_sink_t sink, void *ctx );
+int host_pca_model_project_file( const host_pca_model_t *model, const host_matrix_t *m, size_t block_rows, const char *filename );
+int host_pca_model_save( const host_pca_model_t *model, const char *filename );
+host_pca_model_t *host_pca_model_load( const char *filename );
+
+host_kmeans_t *host_kmeans_create( const float *data, size_t rows, size_t cols, size_t clusters );
+void host_kmeans_free( host_kmeans_t *km );
+void host_kmeans_set_centroids( host_kmeans_t *km, const float *centroids );
+void host_kmeans_init_plusplus( host_kmeans_t *km, unsigned int seed );
+size_t host_kmeans_assign( host_kmeans_t *km );
+void host_kmeans_update( host_kmeans_t *km );
+size_t host_kmeans_run( host_kmeans_t *km, size_t maxiter, size_t *iterations );
+int host_kmeans_set_index( host_kmeans_t *km, size_t lists, float recall, int audit );
+void host_kmeans_clear_index( host_kmeans_t *km );
+// k-means++ and Lloyd's within budget_ms, subsampling first; the best labelling reached is left in km
+int host_kmeans_run_deadline( host_kmeans_t *km, size_t maxiter, double budget_ms, unsigned int seed, host_kmeans_anytime_t *result );
+host_kmeans_job_t *host_kmeans_start( host_kmeans_t *km, size_t maxiter, unsigned int seed );
+int host_kmeans_job_poll( host_kmeans_job_t *job, size_t *iteration, size_t *changes, int *cancelled );
+void host_kmeans_job_cancel( host_kmeans_job_t *job );
+int host_kmeans_job_wait( host_kmeans_job_t *job );
+int host_kmeans_job_fd( const host_kmeans_job_t *job );
+void host_kmeans_job_free( host_kmeans_job_t *job );
+int host_kmeans_sweep( const float *data, size_t rows, size_t cols, const size_t *ks, size_t nks, size_t maxiter,
+                       unsigned int seed, size_t sample, host_kmeans_score_t *scores );
+
+host_network_t *host_network_create( size_t batch_size, int loss );
+void host_network_free( host_network_t *net );
+int host_network_add_layer( host_network_t *net, size_t input_size, size_t output_size, const float *weights, const float *bias );
+int host_network_reserve( host_network_t *net, size_t rows );
+int host_network_forward( host_network_t *net, const float *x, size_t rows );
+double host_network_cost( const host_network_t *net, const float *y );
+double host_network_weights_cost( const host_network_t *net );
+void host_network_cost_derivative( host_network_t *net, const float *y );
+int host_network_backprop( host_network_t *net, const float *x );
+void host_network_update( host_network_t *net, float modifier, float decay );
+void host_network_zero_derivatives( host_network_t *net );
+
+void host_shuffle_index( size_t *index, size_t n, unsigned long long seed );
+void host_gather_rows( const float *src, size_t cols, const size_t *index, size_t count, float *dst );
+int host_network_train_epoch( host_network_t *net, const float *x, const float *y, size_t n, const size_t *order,
+                              size_t batch_size, float eta, float decay );
+int host_network_evaluate( host_network_t *net, const float *x, const float *y, size_t n, size_t batch_size,
+                           double *cost, size_t *correct );
+
+int host_checkpoint_save( const char *filename, int loss, size_t layers, const size_t *sizes,
+                          const float *const *weights, const float *const *bias );
+host_checkpoint_t *host_checkpoint_open( const char *filename );
+void host_checkpoint_close( host_checkpoint_t *cp );
+int host_network_save( const host_network_t *net, const char *filename );
+host_network_t *host_network_load( const char *filename, size_t batch_size );
+
+host_inference_t *host_inference_create( size_t layers, const size_t *sizes, const float *const *weights, const float *const *bias );
+host_inference_t *host_inference_load( const char *filename );
+host_inference_t *host_inference_from_network( const host_network_t *net );
+void host_inference_free( host_inference_t *inf );
+int host_inference_predict( host_inference_t *inf, const float *x, size_t rows, float *out );
+int host_inference_classify( host_inference_t *inf, const float *x, size_t rows, int *labels );
+
+host_matrix_t *host_csv_load( const char *filename, char delimiter, size_t skip_lines,
+                              const size_t *columns, size_t ncolumns, double *mb_per_sec );
+host_matrix_t *host_matrix_map( const char *filename, size_t cols );
+void host_matrix_free( host_matrix_t *m );
+
+void host_density_bounds( const float *xy, size_t rows, size_t stride, float *bounds );
+int host_density_bin( const float *xy, size_t rows, size_t stride, const int *labels, size_t clusters,
+                      size_t width, size_t height, const double *transform, unsigned int *total, int *majority );
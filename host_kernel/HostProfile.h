@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Stage timers and counters shared by the host library and the Perl glue.  Nothing is recorded
+// until host_profile_enable(1); while disabled a timer costs one relaxed load of host_profile_on.  Build
+// with HOST_KERNEL_NO_PROFILE defined and the macros compile to nothing at all.
+//
+//    HOST_PROFILE_SCOPE("kmeans.assign");             // times the rest of the enclosing block
+//    HOST_PROFILE_SCOPE("nn.forward", l);             // per layer, reported as nn.forward[l]
+//    HOST_PROFILE_COUNT("bytes_marshalled", rows * cols * sizeof(float));
+//    HOST_PROFILE_BEGIN(t, "nn.backward", l); ... HOST_PROFILE_END(t);   // a span which isn't a block
+
+void host_profile_enable( int on );
+void host_profile_reset();
+uint64_t host_profile_now();
+void host_profile_record( const char *name, int index, uint64_t start_ns, uint64_t end_ns );
+void host_profile_count( const char *counter, uint64_t amount );
+// one host_parallel_for: busy_ns summed over the slots (the threads it could use), max_busy_ns the busiest one
+void host_profile_record_task( const char *name, uint64_t wall_ns, uint64_t busy_ns, uint64_t max_busy_ns,
+                               size_t slots, size_t workers, size_t steals );
+
+// a snapshot of the totals, taken by host_profile_stage_count / host_profile_counter_count
+size_t host_profile_stage_count();
+int host_profile_stage( size_t i, const char **name, uint64_t *calls, uint64_t *total_ns, uint64_t *min_ns, uint64_t *max_ns );
+size_t host_profile_counter_count();
+int host_profile_counter( size_t i, const char **name, uint64_t *value );
+// utilisation is the busy share of the slots' time, imbalance the busiest slot against the mean (1 = even)
+size_t host_profile_task_count();
+int host_profile_task( size_t i, const char **name, uint64_t *calls, uint64_t *wall_ns, double *utilisation,
+                       double *imbalance, double *workers, uint64_t *steals );
+
+int host_profile_write_trace( const char *filename );
+
+#ifdef __cplusplus
+#include <atomic>
+
+extern std::atomic<int> host_profile_on;
+
+static inline int host_profile_enabled() {
+   return host_profile_on.load(std::memory_order_relaxed);
+}
+
+class host_profile_scope {
+public:
+   explicit host_profile_scope( const char *name, int index = -1 )
+      : name(name), index(index), start(host_profile_enabled() ? host_profile_now() : 0) {}
+   ~host_profile_scope() {
+      stop();
+   }
+   void stop() {
+      if (start != 0) {
+         host_profile_record(name, index, start, host_profile_now());
+         start = 0;
+      }
+   }
+   host_profile_scope( const host_profile_scope & ) = delete;
+   host_profile_scope &operator=( const host_profile_scope & ) = delete;
+private:
+   const char *name;
+   int index;
+   uint64_t start;
+};
+#endif
+
+#define HOST_PROFILE_JOIN2(a, b) a##b
+#define HOST_PROFILE_JOIN(a, b) HOST_PROFILE_JOIN2(a, b)
+
+#ifdef HOST_KERNEL_NO_PROFILE
+#define HOST_PROFILE_SCOPE(...) do { } while (0)
+#define HOST_PROFILE_BEGIN(var, ...) do { } while (0)
+#define HOST_PROFILE_END(var) do { } while (0)
+#define HOST_PROFILE_COUNT(counter, amount) do { } while (0)
+#else
+#define HOST_PROFILE_SCOPE(...) host_profile_scope HOST_PROFILE_JOIN(host_profile_scope_, __LINE__)(__VA_ARGS__)
+#define HOST_PROFILE_BEGIN(var, ...) host_profile_scope var(__VA_ARGS__)
+#define HOST_PROFILE_END(var) var.stop()
+#define HOST_PROFILE_COUNT(counter, amount) do { if (host_profile_enabled()) host_profile_count(counter, amount); } while (0)
+#endif
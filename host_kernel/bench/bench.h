@@ -0,0 +1,27 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+// Shared by the benchmarks.  Inputs are seeded so every run (and every baseline) sees the same
+// data.  Rates are reported per iteration of the work actually done, FLOPS and BYTES print as
+// G/s, which is GFLOP/s and GB/s; the JSON output keeps the raw per-second values.
+
+static inline std::vector<float> bench_random( size_t n, unsigned int seed = 42 ) {
+   std::mt19937 gen(seed);
+   std::normal_distribution<float> dist(0.0f, 1.0f);
+   std::vector<float> v(n);
+   for (auto &x : v) {
+      x = dist(gen);
+   }
+   return v;
+}
+
+static inline void bench_rates( benchmark::State &state, double flops, double bytes ) {
+   if (flops > 0) {
+      state.counters["FLOPS"] = benchmark::Counter(flops, benchmark::Counter::kIsIterationInvariantRate, benchmark::Counter::kIs1000);
+   }
+   state.counters["BYTES"] = benchmark::Counter(bytes, benchmark::Counter::kIsIterationInvariantRate, benchmark::Counter::kIs1000);
+}
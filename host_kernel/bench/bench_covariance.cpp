@@ -0,0 +1,52 @@
+#include <cmath>
+#include <vector>
+
+#include "HostKernel.h"
+#include "bench.h"
+
+// reference implementation, the same calculation as gpu_calc_covariance done one cell at a time
+static void naive_covariance( const float *z, float *cov, size_t rows, size_t cols ) {
+   for (size_t row = 0; row < cols; row++) {
+      for (size_t col = 0; col < cols; col++) {
+         float sum = 0;
+         for (size_t i = 0; i < rows; i++) {
+            sum += (z[i * cols + col] * z[i * cols + row]) / rows;
+         }
+         cov[row * cols + col] = sum;
+      }
+   }
+}
+
+constexpr size_t BENCH_ROWS = 1000;
+
+static void BM_covariance_naive(benchmark::State &state) {
+   size_t cols = state.range(0);
+   auto z = bench_random(BENCH_ROWS * cols);
+   std::vector<float> cov(cols * cols);
+   for (auto _ : state) {
+      naive_covariance(z.data(), cov.data(), BENCH_ROWS, cols);
+      benchmark::DoNotOptimize(cov.data());
+   }
+   bench_rates(state, 2.0 * BENCH_ROWS * cols * cols, sizeof(float) * (BENCH_ROWS * cols + cols * cols));
+}
+
+static void BM_covariance_blocked(benchmark::State &state) {
+   size_t cols = state.range(0);
+   auto z = bench_random(BENCH_ROWS * cols);
+   std::vector<float> cov(cols * cols), ref(cols * cols);
+   for (auto _ : state) {
+      host_calc_covariance(z.data(), cov.data(), BENCH_ROWS, cols);
+      benchmark::DoNotOptimize(cov.data());
+   }
+   // full-matrix flops, so the rate is directly comparable with the naive version
+   bench_rates(state, 2.0 * BENCH_ROWS * cols * cols, sizeof(float) * (BENCH_ROWS * cols + cols * cols));
+   naive_covariance(z.data(), ref.data(), BENCH_ROWS, cols);
+   double max_diff = 0;
+   for (size_t i = 0; i < cols * cols; i++) {
+      max_diff = std::max(max_diff, (double)std::fabs(cov[i] - ref[i]));
+   }
+   state.counters["max_abs_diff"] = max_diff;
+}
+
+BENCHMARK(BM_covariance_naive)->Arg(10)->Arg(50)->Arg(100)->Arg(500)->Arg(1000)->Arg(2000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_covariance_blocked)->Arg(10)->Arg(50)->Arg(100)->Arg(500)->Arg(1000)->Arg(2000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "HostKernel.h"
+#include "bench.h"
+#include "gemm.h"
+
+// The host library's hot entry points, each across a sweep of shapes.  Only what the library
+// ships is timed here, so a regression in it shows up in the baseline; a new entry point on a hot
+// path gets its benchmark when it is added.
+
+// nearest centroid for every row, rows x cols points against clusters centroids
+static void BM_kmeans_assign(benchmark::State &state) {
+   size_t rows = state.range(0), cols = state.range(1), clusters = state.range(2);
+   auto data = bench_random(rows * cols);
+   host_kmeans_t *km = host_kmeans_create(data.data(), rows, cols, clusters);
+   host_kmeans_set_centroids(km, data.data()); // the first rows, as good as any
+   for (auto _ : state) {
+      benchmark::DoNotOptimize(host_kmeans_assign(km));
+   }
+   bench_rates(state, 3.0 * rows * cols * clusters, sizeof(float) * (rows + clusters) * cols + sizeof(size_t) * rows);
+   host_kmeans_free(km);
+}
+
+// centroid accumulation, summing every row into its assigned centroid
+static void BM_kmeans_update(benchmark::State &state) {
+   size_t rows = state.range(0), cols = state.range(1), clusters = state.range(2);
+   auto data = bench_random(rows * cols);
+   host_kmeans_t *km = host_kmeans_create(data.data(), rows, cols, clusters);
+   host_kmeans_set_centroids(km, data.data());
+   host_kmeans_assign(km);
+   for (auto _ : state) {
+      host_kmeans_update(km);
+      benchmark::DoNotOptimize(km->centroids);
+   }
+   bench_rates(state, 1.0 * rows * cols, sizeof(float) * rows * cols + sizeof(size_t) * rows);
+   host_kmeans_free(km);
+}
+
+// standardise and project new rows with a fitted model (ML::PCA->transform), the host path's
+// means/stddev work folded into the projection
+static void BM_pca_transform(benchmark::State &state) {
+   size_t rows = state.range(0), cols = state.range(1), k = state.range(2);
+   auto data = bench_random(rows * cols, 1), components = bench_random(cols * k, 2);
+   std::vector<float> means(cols, 0.5f), stddev(cols, 2.0f), out(rows * k);
+   host_pca_model_t *model = host_pca_model_create(cols, k, means.data(), stddev.data(), components.data());
+   for (auto _ : state) {
+      host_pca_model_transform(model, data.data(), rows, out.data());
+      benchmark::DoNotOptimize(out.data());
+   }
+   bench_rates(state, 2.0 * rows * cols * k, sizeof(float) * (rows * cols + rows * k));
+   host_pca_model_free(model);
+}
+
+// many small independent PCAs in one call (ML::PCA->project_batch), count datasets of rows x cols
+static void BM_pca_batch(benchmark::State &state) {
+   size_t count = state.range(0), rows = state.range(1), cols = state.range(2), k = 2;
+   auto data = bench_random(count * rows * cols);
+   std::vector<size_t> dataset_rows(count, rows), dataset_cols(count, cols);
+   std::vector<float> out(count * rows * k);
+   for (auto _ : state) {
+      host_pca_batch(data.data(), dataset_rows.data(), dataset_cols.data(), count, k, out.data());
+      benchmark::DoNotOptimize(out.data());
+   }
+   bench_rates(state, count * (2.0 * rows * cols * cols + 2.0 * rows * cols * k), sizeof(float) * count * rows * (cols + k));
+}
+
+// ML::Util::transpose, in double
+static void BM_transpose(benchmark::State &state) {
+   size_t rows = state.range(0), cols = state.range(1);
+   auto src = bench_random(rows * cols);
+   std::vector<double> a(src.begin(), src.end()), out(rows * cols);
+   for (auto _ : state) {
+      host_dtranspose(a.data(), rows, cols, out.data());
+      benchmark::DoNotOptimize(out.data());
+   }
+   bench_rates(state, 0, 2.0 * sizeof(double) * rows * cols);
+}
+
+// ML::Util::matmul, n x n by n x n in double
+static void BM_dgemm(benchmark::State &state) {
+   size_t n = state.range(0);
+   auto src = bench_random(2 * n * n);
+   std::vector<double> a(src.begin(), src.begin() + n * n), b(src.begin() + n * n, src.end()), c(n * n);
+   for (auto _ : state) {
+      host_dgemm(0, 0, n, n, n, 1.0, a.data(), n, b.data(), n, 0.0, c.data(), n);
+      benchmark::DoNotOptimize(c.data());
+   }
+   bench_rates(state, 2.0 * n * n * n, 3.0 * sizeof(double) * n * n);
+}
+
+// ML::Util::conv2d, an n x n input by a k x k filter, in each mode (0 padded, 1 expand, 2 reduce)
+static void BM_conv2d(benchmark::State &state) {
+   size_t n = state.range(0), k = state.range(1);
+   int mode = state.range(2);
+   auto in = bench_random(n * n, 1), filter = bench_random(k * k, 2);
+   std::vector<double> din(in.begin(), in.end()), dfilter(filter.begin(), filter.end());
+   size_t out_n = host_conv2d_size(n, k, mode);
+   std::vector<double> out(out_n * out_n);
+   for (auto _ : state) {
+      host_dconv2d(din.data(), n, dfilter.data(), k, mode, out.data());
+      benchmark::DoNotOptimize(out.data());
+   }
+   bench_rates(state, 2.0 * out_n * out_n * k * k, sizeof(double) * (n * n + out_n * out_n));
+}
+
+// C (m x n) = A (m x k) x B (k x n), or x B^T when the 4th argument is set (the network's layout)
+static void BM_sgemm(benchmark::State &state) {
+   size_t m = state.range(0), n = state.range(1), k = state.range(2);
+   int transb = state.range(3);
+   auto a = bench_random(m * k, 1), b = bench_random(k * n, 2);
+   std::vector<float> c(m * n);
+   for (auto _ : state) {
+      host_sgemm(0, transb, m, n, k, 1.0f, a.data(), k, b.data(), transb ? k : n, 0.0f, c.data(), n);
+      benchmark::DoNotOptimize(c.data());
+   }
+   bench_rates(state, 2.0 * m * n * k, sizeof(float) * (m * k + k * n + m * n));
+}
+
+// one network layer forward, sigmoid(batch x input x weights^T + bias) with the sigmoid fused
+static void BM_sigmoid_layer(benchmark::State &state) {
+   size_t batch = state.range(0), input = state.range(1), output = state.range(2);
+   auto x = bench_random(batch * input, 1), w = bench_random(output * input, 2), bias = bench_random(output, 3);
+   std::vector<float> act(batch * output);
+   for (auto _ : state) {
+      gemm_bias_sigmoid(1, batch, output, input, x.data(), input, w.data(), input, bias.data(), act.data(), output);
+      benchmark::DoNotOptimize(act.data());
+   }
+   bench_rates(state, 2.0 * batch * input * output + 4.0 * batch * output,
+               sizeof(float) * (batch * input + output * input + output + batch * output));
+}
+
+// a frozen network's forward pass (ML::MVKernels->predict), 784 -> 100 -> 10
+static void BM_inference_predict(benchmark::State &state) {
+   size_t rows = state.range(0);
+   size_t sizes[3] = { 784, 100, 10 };
+   auto w0 = bench_random(sizes[1] * sizes[0], 1), w1 = bench_random(sizes[2] * sizes[1], 2);
+   auto b0 = bench_random(sizes[1], 3), b1 = bench_random(sizes[2], 4), x = bench_random(rows * sizes[0], 5);
+   const float *weights[2] = { w0.data(), w1.data() }, *bias[2] = { b0.data(), b1.data() };
+   host_inference_t *inf = host_inference_create(2, sizes, weights, bias);
+   std::vector<float> out(rows * sizes[2]);
+   for (auto _ : state) {
+      host_inference_predict(inf, x.data(), rows, out.data());
+      benchmark::DoNotOptimize(out.data());
+   }
+   bench_rates(state, 2.0 * rows * (sizes[0] * sizes[1] + sizes[1] * sizes[2]), sizeof(float) * rows * (sizes[0] + sizes[2]));
+   host_inference_free(inf);
+}
+
+// binning labelled points into an 800 x 600 image (ML::Matrix->density)
+static void BM_density_bin(benchmark::State &state) {
+   size_t rows = state.range(0), clusters = state.range(1), width = 800, height = 600;
+   auto xy = bench_random(rows * 2);
+   std::vector<int> labels(rows);
+   for (size_t i = 0; i < rows; i++) {
+      labels[i] = (int)(i % clusters);
+   }
+   double transform[4] = { width / 2.0, width / 8.0, height / 2.0, height / 8.0 };
+   std::vector<unsigned int> total(width * height);
+   std::vector<int> majority(width * height);
+   for (auto _ : state) {
+      host_density_bin(xy.data(), rows, 2, labels.data(), clusters, width, height, transform, total.data(), majority.data());
+      benchmark::DoNotOptimize(total.data());
+   }
+   bench_rates(state, 0, sizeof(float) * rows * 2 + sizeof(int) * rows + sizeof(unsigned int) * width * height * clusters);
+}
+
+BENCHMARK(BM_kmeans_assign)->ArgsProduct({{1 << 16}, {2, 16, 64}, {8, 64, 512}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_kmeans_update)->ArgsProduct({{1 << 16}, {2, 16, 64}, {8, 512}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_pca_transform)->Args({150, 4, 2})->Args({100000, 4, 2})->Args({100000, 64, 8})->Args({10000, 1000, 16})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_pca_batch)->Args({1000, 200, 12})->Args({100, 1000, 64})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_transpose)->Args({1000, 4})->Args({784, 1024})->Args({4096, 4096})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_dgemm)->Arg(64)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_conv2d)->ArgsProduct({{64, 512}, {3, 4}, {0, 1, 2}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_sgemm)->Args({64, 64, 64, 0})->Args({256, 256, 256, 0})->Args({1024, 1024, 1024, 0})
+                   ->Args({1024, 100, 784, 1})->Args({4096, 2, 64, 0})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_sigmoid_layer)->ArgsProduct({{1, 64, 1024}, {784}, {30, 100}})->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_inference_predict)->Arg(1)->Arg(1024)->Arg(1 << 14)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_density_bin)->ArgsProduct({{1 << 20}, {1, 50}})->Unit(benchmark::kMillisecond);
@@ -0,0 +1,56 @@
+#!/usr/bin/env perl
+# Compares two host_kernel_bench JSON files, e.g. the saved baseline against a fresh run:
+#
+#   ./bench/compare.pl build/native_baseline.json new.json [threshold %, default 5]
+#
+# Prints the change in time and in each rate counter per benchmark, marks the ones slower than
+# the threshold, and exits 1 if there were any.
+
+use strict;
+use warnings;
+
+use JSON::PP;
+
+die "usage: $0 old.json new.json [threshold]\n" if @ARGV < 2;
+my ($old_file, $new_file, $threshold) = @ARGV;
+$threshold //= 5;
+
+sub load {
+   my $file = shift;
+   open(my $fh, "<", $file) or die "unable to open $file: $!\n";
+   local $/;
+   my $json = decode_json(<$fh>);
+   close($fh);
+   # with repetitions, only the medians are compared
+   my (%runs, @order);
+   for my $b (@{$json->{benchmarks}}) {
+      next if ($b->{run_type} // "") eq "aggregate" && ($b->{aggregate_name} // "") ne "median";
+      my $name = $b->{run_name} // $b->{name};
+      push(@order, $name) if ! exists $runs{$name};
+      $runs{$name} = $b;
+   }
+   return (\%runs, \@order);
+}
+
+my ($old, $old_order) = load($old_file);
+my ($new, $new_order) = load($new_file);
+
+my $regressions = 0;
+printf("%-48s %12s %12s %8s %8s %8s\n", "benchmark", "old", "new", "time", "FLOPS", "BYTES");
+for my $name (@$new_order) {
+   my $n = $new->{$name};
+   my $o = $old->{$name};
+   if( ! defined $o ){
+      printf("%-48s %12s %12.3f %s\n", $name, "-", $n->{real_time}, $n->{time_unit});
+      next;
+   }
+   my $time = $o->{real_time} > 0 ? 100 * ($n->{real_time} / $o->{real_time} - 1) : 0;
+   my @rates = map { $o->{$_} && defined $n->{$_} ? sprintf("%+7.1f%%", 100 * ($n->{$_} / $o->{$_} - 1)) : "       -" } qw(FLOPS BYTES);
+   my $slower = $time > $threshold;
+   $regressions++ if $slower;
+   printf("%-48s %12.3f %12.3f %+7.1f%% %s %s%s\n", $name, $o->{real_time}, $n->{real_time}, $time, @rates, $slower ? "  <-- slower" : "");
+}
+for my $name (grep { ! exists $new->{$_} } @$old_order) {
+   printf("%-48s %12.3f %12s\n", $name, $old->{$name}{real_time}, "gone");
+}
+exit($regressions ? 1 : 0);
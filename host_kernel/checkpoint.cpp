@@ -0,0 +1,189 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "HostKernel.h"
+
+// Network checkpoints.  The file is a fixed header, the layer sizes, then each layer's weights
+// (output x input) and biases as float32, so a checkpoint can be mapped and the blocks used in
+// place (the header is a multiple of 8 bytes, so every float block is suitably aligned).
+//
+//    char     magic[4]     "MVNN"
+//    uint32_t version      1
+//    uint32_t loss         1 = quadratic, 2 = cross entropy
+//    uint32_t reserved
+//    uint64_t layers
+//    uint64_t sizes[layers + 1]
+//    for each layer: float weights[sizes[l + 1] * sizes[l]], float bias[sizes[l + 1]]
+
+static const char CHECKPOINT_MAGIC[4] = { 'M', 'V', 'N', 'N' };
+static const uint32_t CHECKPOINT_VERSION = 1;
+static const uint64_t CHECKPOINT_MAX_WIDTH = (uint64_t)1 << 24; // units in a layer, well past any real one
+
+typedef struct checkpoint_header {
+   char magic[4];
+   uint32_t version;
+   uint32_t loss;
+   uint32_t reserved;
+   uint64_t layers;
+} checkpoint_header_t;
+
+int host_checkpoint_save( const char *filename, int loss, size_t layers, const size_t *sizes,
+                          const float *const *weights, const float *const *bias ) {
+   // written to a temporary file and renamed, so a checkpoint taken during training is never half written
+   std::string tmp = std::string(filename) + ".tmp";
+   FILE *fh = fopen(tmp.c_str(), "wb");
+   if (fh == NULL) {
+      fprintf(stderr, "host_checkpoint_save() : error, unable to open %s for writing.\n", tmp.c_str());
+      return 1;
+   }
+   checkpoint_header_t header;
+   memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+   header.version = CHECKPOINT_VERSION;
+   header.loss = loss;
+   header.reserved = 0;
+   header.layers = layers;
+   std::vector<uint64_t> sizes64(sizes, sizes + layers + 1);
+   int ok = fwrite(&header, sizeof(header), 1, fh) == 1
+         && fwrite(sizes64.data(), sizeof(uint64_t), layers + 1, fh) == layers + 1;
+   for (size_t l = 0; ok && l < layers; l++) {
+      size_t nw = sizes[l + 1] * sizes[l];
+      ok = fwrite(weights[l], sizeof(float), nw, fh) == nw
+        && fwrite(bias[l], sizeof(float), sizes[l + 1], fh) == sizes[l + 1];
+   }
+   if (fclose(fh) != 0 || !ok) {
+      fprintf(stderr, "host_checkpoint_save() : error, failed writing %s.\n", tmp.c_str());
+      unlink(tmp.c_str());
+      return 1;
+   }
+   if (rename(tmp.c_str(), filename) != 0) {
+      fprintf(stderr, "host_checkpoint_save() : error, unable to rename %s to %s.\n", tmp.c_str(), filename);
+      unlink(tmp.c_str());
+      return 1;
+   }
+   return 0;
+}
+
+host_checkpoint_t *host_checkpoint_open( const char *filename ) {
+   int fd = open(filename, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "host_checkpoint_open() : error, unable to open %s.\n", filename);
+      return NULL;
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(checkpoint_header_t)) {
+      fprintf(stderr, "host_checkpoint_open() : error, %s is not a network checkpoint.\n", filename);
+      close(fd);
+      return NULL;
+   }
+   size_t size = st.st_size;
+   void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "host_checkpoint_open() : error, unable to map %s.\n", filename);
+      return NULL;
+   }
+   const checkpoint_header_t *header = (const checkpoint_header_t *)map;
+   if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 || header->version != CHECKPOINT_VERSION) {
+      fprintf(stderr, "host_checkpoint_open() : error, %s is not a version %u network checkpoint.\n", filename, CHECKPOINT_VERSION);
+      munmap(map, size);
+      return NULL;
+   }
+   size_t layers = header->layers;
+   size_t offset = sizeof(checkpoint_header_t) + sizeof(uint64_t) * (layers + 1);
+   if (layers == 0 || layers > size / sizeof(uint64_t) || offset > size) {
+      fprintf(stderr, "host_checkpoint_open() : error, %s is truncated.\n", filename);
+      munmap(map, size);
+      return NULL;
+   }
+   host_checkpoint_t *cp = (host_checkpoint_t *)calloc(1, sizeof(host_checkpoint_t));
+   if (cp == NULL) {
+      fprintf(stderr, "host_checkpoint_open() : error, failed to allocate for %zu layers.\n", layers);
+      munmap(map, size);
+      return NULL;
+   }
+   cp->map = map;
+   cp->map_size = size;
+   cp->sizes = (size_t *)malloc(sizeof(size_t) * (layers + 1));
+   cp->weights = (const float **)malloc(sizeof(float *) * layers);
+   cp->bias = (const float **)malloc(sizeof(float *) * layers);
+   if (cp->sizes == NULL || cp->weights == NULL || cp->bias == NULL) {
+      fprintf(stderr, "host_checkpoint_open() : error, failed to allocate for %zu layers.\n", layers);
+      host_checkpoint_close(cp);
+      return NULL;
+   }
+   cp->loss = header->loss;
+   cp->layers = layers;
+   const uint64_t *sizes = (const uint64_t *)((const char *)map + sizeof(checkpoint_header_t));
+   for (size_t l = 0; l <= layers; l++) {
+      if (sizes[l] == 0 || sizes[l] > CHECKPOINT_MAX_WIDTH) {
+         fprintf(stderr, "host_checkpoint_open() : error, %s has a layer of %llu units.\n", filename, (unsigned long long)sizes[l]);
+         host_checkpoint_close(cp);
+         return NULL;
+      }
+      cp->sizes[l] = sizes[l];
+   }
+   for (size_t l = 0; l < layers; l++) {
+      // the sizes are bounded, but their product needn't fit once it is in bytes
+      size_t nw, bytes;
+      if (__builtin_mul_overflow(cp->sizes[l + 1], cp->sizes[l], &nw) ||
+          __builtin_mul_overflow(nw + cp->sizes[l + 1], sizeof(float), &bytes) ||
+          bytes > size - offset) {
+         fprintf(stderr, "host_checkpoint_open() : error, %s is truncated.\n", filename);
+         host_checkpoint_close(cp);
+         return NULL;
+      }
+      cp->weights[l] = (const float *)((const char *)map + offset);
+      offset += sizeof(float) * nw;
+      cp->bias[l] = (const float *)((const char *)map + offset);
+      offset += sizeof(float) * cp->sizes[l + 1];
+   }
+   return cp;
+}
+
+void host_checkpoint_close( host_checkpoint_t *cp ) {
+   if (cp == NULL) {
+      return;
+   }
+   munmap(cp->map, cp->map_size);
+   free(cp->sizes);
+   free(cp->weights);
+   free(cp->bias);
+   free(cp);
+}
+
+int host_network_save( const host_network_t *net, const char *filename ) {
+   std::vector<size_t> sizes(net->layers + 1);
+   std::vector<const float *> weights(net->layers), bias(net->layers);
+   sizes[0] = net->layer[0].input_size;
+   for (size_t l = 0; l < net->layers; l++) {
+      sizes[l + 1] = net->layer[l].output_size;
+      weights[l] = net->layer[l].weights;
+      bias[l] = net->layer[l].bias;
+   }
+   return host_checkpoint_save(filename, net->loss, net->layers, sizes.data(), weights.data(), bias.data());
+}
+
+host_network_t *host_network_load( const char *filename, size_t batch_size ) {
+   host_checkpoint_t *cp = host_checkpoint_open(filename);
+   if (cp == NULL) {
+      return NULL;
+   }
+   host_network_t *net = host_network_create(batch_size, cp->loss);
+   for (size_t l = 0; net != NULL && l < cp->layers; l++) {
+      if (host_network_add_layer(net, cp->sizes[l], cp->sizes[l + 1], cp->weights[l], cp->bias[l]) != 0) {
+         host_network_free(net);
+         net = NULL;
+      }
+   }
+   host_checkpoint_close(cp);
+   return net;
+}
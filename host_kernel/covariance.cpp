@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "parallel.h"
+
+// The covariance of the standardised data is Zt x Z / rows, which is symmetric, so only the
+// tiles on or above the diagonal are calculated (SYRK style) and then mirrored into the lower
+// triangle.  Each tile walks the rows of Z in order, so Z is read along its rows rather than
+// down its columns, and the inner loop is contiguous in both Z and the tile so it vectorises.
+
+constexpr size_t COV_TILE = 64;       // columns per tile, a TILE x TILE float block sits in L1
+constexpr size_t COV_ROW_CHUNK = 256; // rows summed in float before being folded into double
+
+static void cov_tile( const float *z, float *cov, size_t rows, size_t cols, size_t i0, size_t j0 ) {
+   size_t ni = std::min(COV_TILE, cols - i0);
+   size_t nj = std::min(COV_TILE, cols - j0);
+   alignas(64) float part[COV_TILE * COV_TILE];
+   std::vector<double> acc(ni * COV_TILE, 0.0);
+
+   for (size_t r0 = 0; r0 < rows; r0 += COV_ROW_CHUNK) {
+      size_t r1 = std::min(r0 + COV_ROW_CHUNK, rows);
+      std::fill(part, part + ni * COV_TILE, 0.0f);
+      size_t r = r0;
+      // four rows at a time, so each load/store of the tile feeds four FMAs
+      for (; r + 4 <= r1; r += 4) {
+         const float *z0 = z + r * cols;
+         const float *z1 = z0 + cols;
+         const float *z2 = z1 + cols;
+         const float *z3 = z2 + cols;
+         for (size_t a = 0; a < ni; a++) {
+            float a0 = z0[i0 + a], a1 = z1[i0 + a], a2 = z2[i0 + a], a3 = z3[i0 + a];
+            float *p = part + a * COV_TILE;
+            #pragma omp simd
+            for (size_t b = 0; b < nj; b++) {
+               p[b] += a0 * z0[j0 + b] + a1 * z1[j0 + b] + a2 * z2[j0 + b] + a3 * z3[j0 + b];
+            }
+         }
+      }
+      for (; r < r1; r++) {
+         const float *z0 = z + r * cols;
+         for (size_t a = 0; a < ni; a++) {
+            float a0 = z0[i0 + a];
+            float *p = part + a * COV_TILE;
+            #pragma omp simd
+            for (size_t b = 0; b < nj; b++) {
+               p[b] += a0 * z0[j0 + b];
+            }
+         }
+      }
+      for (size_t a = 0; a < ni; a++) {
+         for (size_t b = 0; b < nj; b++) {
+            acc[a * COV_TILE + b] += part[a * COV_TILE + b];
+         }
+      }
+   }
+
+   for (size_t a = 0; a < ni; a++) {
+      for (size_t b = 0; b < nj; b++) {
+         float v = (float)(acc[a * COV_TILE + b] / rows);
+         cov[(i0 + a) * cols + j0 + b] = v;
+         cov[(j0 + b) * cols + i0 + a] = v; // mirror into the lower triangle
+      }
+   }
+}
+
+void host_calc_covariance( const float *z, float *cov, size_t rows, size_t cols ) {
+   HOST_PROFILE_SCOPE("pca.covariance_host");
+   size_t tiles = (cols + COV_TILE - 1) / COV_TILE;
+   // enumerate the (i, j) tile pairs with j >= i
+   std::vector<std::pair<size_t, size_t>> pairs;
+   pairs.reserve(tiles * (tiles + 1) / 2);
+   for (size_t i = 0; i < tiles; i++) {
+      for (size_t j = i; j < tiles; j++) {
+         pairs.emplace_back(i * COV_TILE, j * COV_TILE);
+      }
+   }
+   host_parallel_for(pairs.size(), 1, [&](size_t begin, size_t end) {
+      for (size_t p = begin; p < end; p++) {
+         cov_tile(z, cov, rows, cols, pairs[p].first, pairs[p].second);
+      }
+   }, "pca.covariance_host");
+}
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "parallel.h"
+
+// Delimited text -> packed float matrix.  The file is mapped and cut into chunks at newline
+// boundaries; the threads first count the rows in each chunk, which gives every chunk its first
+// output row, then parse their chunks straight into the matrix.  Fields are parsed with
+// std::from_chars, so there are no per-cell allocations.  Quoted fields are unquoted but may not
+// contain the delimiter or a newline.  Empty or non-numeric cells are 0, as Perl would numify them,
+// but a row without one of the wanted fields at all is an error rather than a row of made up zeros.
+
+constexpr size_t CSV_CHUNK_BYTES = 1 << 20; // smallest chunk handed to a thread
+
+static const char *line_end( const char *p, const char *end ) {
+   const char *nl = (const char *)memchr(p, '\n', end - p);
+   return nl == NULL ? end : nl;
+}
+
+static bool blank_line( const char *p, const char *eol ) {
+   return p == eol || (p + 1 == eol && *p == '\r');
+}
+
+static float parse_field( const char *p, const char *e ) {
+   while (p < e && (*p == ' ' || *p == '\t' || *p == '"')) {
+      p++;
+   }
+   while (e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '"' || e[-1] == '\r')) {
+      e--;
+   }
+   if (p < e && *p == '+') { // from_chars only takes a leading '-'
+      p++;
+   }
+   float value = 0;
+   std::from_chars(p, e, value);
+   return value;
+}
+
+static size_t count_fields( const char *p, const char *eol, char delimiter ) {
+   return std::count(p, eol, delimiter) + 1;
+}
+
+host_matrix_t *host_csv_load( const char *filename, char delimiter, size_t skip_lines,
+                              const size_t *columns, size_t ncolumns, double *mb_per_sec ) {
+   HOST_PROFILE_SCOPE("csv.load");
+   auto start = std::chrono::steady_clock::now();
+   int fd = open(filename, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "host_csv_load() : error, unable to open %s.\n", filename);
+      return NULL;
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0) {
+      fprintf(stderr, "host_csv_load() : error, unable to stat %s.\n", filename);
+      close(fd);
+      return NULL;
+   }
+   size_t size = st.st_size;
+   void *map = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+   close(fd);
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "host_csv_load() : error, unable to map %s.\n", filename);
+      return NULL;
+   }
+   if (map != NULL) {
+      madvise(map, size, MADV_SEQUENTIAL);
+   }
+   const char *begin = (const char *)map, *end = begin + size;
+   for (size_t s = 0; s < skip_lines && begin < end; s++) {
+      begin = std::min(line_end(begin, end) + 1, end);
+   }
+   const char *first = begin;
+   while (first < end && blank_line(first, line_end(first, end))) {
+      first = std::min(line_end(first, end) + 1, end);
+   }
+
+   // output column of each field, -1 for the fields which aren't wanted
+   std::vector<long> field_column;
+   size_t cols;
+   if (columns != NULL && ncolumns > 0) {
+      cols = ncolumns;
+      field_column.assign(*std::max_element(columns, columns + ncolumns) + 1, -1);
+      for (size_t c = 0; c < ncolumns; c++) {
+         if (field_column[columns[c]] >= 0) {
+            fprintf(stderr, "host_csv_load() : error, column %zu is asked for more than once.\n", columns[c]);
+            if (map != NULL) {
+               munmap(map, size);
+            }
+            return NULL;
+         }
+         field_column[columns[c]] = c;
+      }
+   } else {
+      cols = first < end ? count_fields(first, line_end(first, end), delimiter) : 0;
+      field_column.resize(cols);
+      for (size_t c = 0; c < cols; c++) {
+         field_column[c] = c;
+      }
+   }
+
+   // chunk boundaries, each chunk after the first starting just past a newline
+   size_t threads = host_get_threads();
+   size_t chunk_bytes = std::max(CSV_CHUNK_BYTES, (size_t)(end - begin) / (threads * 4) + 1);
+   std::vector<const char *> bounds(1, begin);
+   for (const char *p = begin + chunk_bytes; p < end; p += chunk_bytes) {
+      const char *b = std::min(line_end(p, end) + 1, end);
+      if (b > bounds.back()) {
+         bounds.push_back(b);
+      }
+      p = b;
+   }
+   if (bounds.back() < end) {
+      bounds.push_back(end);
+   }
+   size_t chunks = bounds.size() - 1;
+
+   std::vector<size_t> row_start(chunks + 1, 0);
+   host_parallel_for(chunks, 1, [&](size_t c0, size_t c1) {
+      for (size_t c = c0; c < c1; c++) {
+         HOST_PROFILE_SCOPE("csv.count_rows");
+         size_t rows = 0;
+         for (const char *p = bounds[c]; p < bounds[c + 1];) {
+            const char *eol = line_end(p, bounds[c + 1]);
+            rows += !blank_line(p, eol);
+            p = eol + 1;
+         }
+         row_start[c + 1] = rows;
+      }
+   }, "csv.count_rows");
+   for (size_t c = 0; c < chunks; c++) {
+      row_start[c + 1] += row_start[c];
+   }
+
+   host_matrix_t *m = (host_matrix_t *)calloc(1, sizeof(host_matrix_t));
+   if (m == NULL || (m->data = (float *)host_alloc(sizeof(float) * std::max(row_start[chunks] * cols, (size_t)1))) == NULL) {
+      fprintf(stderr, "host_csv_load() : error, failed to allocate %zu x %zu matrix.\n", row_start[chunks], cols);
+      free(m);
+      if (map != NULL) {
+         munmap(map, size);
+      }
+      return NULL;
+   }
+   m->rows = row_start[chunks];
+   m->cols = cols;
+   HOST_PROFILE_COUNT("bytes_allocated", sizeof(float) * m->rows * cols);
+
+   std::vector<size_t> short_row(chunks, SIZE_MAX); // the first row of each chunk missing a wanted field
+   host_parallel_for(chunks, 1, [&](size_t c0, size_t c1) {
+      for (size_t c = c0; c < c1; c++) {
+         HOST_PROFILE_SCOPE("csv.parse");
+         float *row = m->data + row_start[c] * cols;
+         for (const char *p = bounds[c]; p < bounds[c + 1];) {
+            const char *eol = line_end(p, bounds[c + 1]);
+            if (!blank_line(p, eol)) {
+               const char *f = p;
+               size_t field = 0;
+               for (; field < field_column.size() && f <= eol; field++) {
+                  const char *fe = (const char *)memchr(f, delimiter, eol - f);
+                  if (fe == NULL) {
+                     fe = eol;
+                  }
+                  if (field_column[field] >= 0) {
+                     row[field_column[field]] = parse_field(f, fe);
+                  }
+                  f = fe + 1;
+               }
+               if (field < field_column.size() && short_row[c] == SIZE_MAX) {
+                  short_row[c] = (row - m->data) / cols;
+               }
+               row += cols;
+            }
+            p = eol + 1;
+         }
+      }
+   }, "csv.parse");
+
+   if (map != NULL) {
+      munmap(map, size);
+   }
+   size_t bad = *std::min_element(short_row.begin(), short_row.end());
+   if (bad != SIZE_MAX) {
+      fprintf(stderr, "host_csv_load() : error, data row %zu of %s has fewer than the %zu fields wanted.\n",
+              bad + 1, filename, field_column.size());
+      host_matrix_free(m);
+      return NULL;
+   }
+   if (mb_per_sec != NULL) {
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      *mb_per_sec = seconds > 0 ? size / (1024.0 * 1024.0) / seconds : 0;
+   }
+   return m;
+}
+
+// a raw file of native floats, cols to a row, mapped read only so rows are paged in as they're
+// read (and can be dropped again) rather than the whole file being loaded
+host_matrix_t *host_matrix_map( const char *filename, size_t cols ) {
+   int fd = open(filename, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "host_matrix_map() : error, unable to open %s.\n", filename);
+      return NULL;
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0 || cols == 0 || st.st_size == 0 || st.st_size % (sizeof(float) * cols) != 0) {
+      fprintf(stderr, "host_matrix_map() : error, %s is not a whole number of %zu float rows.\n", filename, cols);
+      close(fd);
+      return NULL;
+   }
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "host_matrix_map() : error, unable to map %s.\n", filename);
+      return NULL;
+   }
+   madvise(map, st.st_size, MADV_SEQUENTIAL);
+   host_matrix_t *m = (host_matrix_t *)calloc(1, sizeof(host_matrix_t));
+   if (m == NULL) {
+      munmap(map, st.st_size);
+      return NULL;
+   }
+   m->rows = st.st_size / (sizeof(float) * cols);
+   m->cols = cols;
+   m->data = (float *)map;
+   m->mapped = st.st_size;
+   return m;
+}
+
+void host_matrix_free( host_matrix_t *m ) {
+   if (m == NULL) {
+      return;
+   }
+   if (m->mapped) {
+      munmap(m->data, m->mapped);
+   } else {
+      host_free(m->data);
+   }
+   free(m);
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "parallel.h"
+
+// 2-D binning of points into a pixel grid, for plotting millions of points at the cost of the
+// image size rather than the point count.  There is one grid of counts per pixel and cluster, cut
+// into bands of pixel rows, one per thread: each thread reads every point but only counts those
+// that land in its own band, so no two threads touch the same cell and the memory is that of the
+// one grid, whatever the thread count.
+
+constexpr size_t DENSITY_MIN_ROWS = 1 << 16; // fewest points worth a band of their own
+
+void host_density_bounds( const float *xy, size_t rows, size_t stride, float *bounds ) {
+   float inf = std::numeric_limits<float>::infinity();
+   bounds[0] = inf;
+   bounds[1] = -inf;
+   bounds[2] = inf;
+   bounds[3] = -inf;
+   for (size_t i = 0; i < rows; i++) {
+      const float *p = xy + i * stride;
+      bounds[0] = std::min(bounds[0], p[0]);
+      bounds[1] = std::max(bounds[1], p[0]);
+      bounds[2] = std::min(bounds[2], p[1]);
+      bounds[3] = std::max(bounds[3], p[1]);
+   }
+}
+
+int host_density_bin( const float *xy, size_t rows, size_t stride, const int *labels, size_t clusters,
+                      size_t width, size_t height, const double *transform, unsigned int *total, int *majority ) {
+   HOST_PROFILE_SCOPE("density.bin");
+   size_t pixels = width * height;
+   if (clusters == 0 || pixels == 0) {
+      fprintf(stderr, "host_density_bin() : error, %zu clusters on a %zu x %zu grid.\n", clusters, width, height);
+      return 1;
+   }
+   size_t bands = std::max((size_t)1, std::min({ (size_t)host_get_threads(), rows / DENSITY_MIN_ROWS, height }));
+   std::vector<unsigned int> counts(pixels * clusters, 0); // pixel x cluster
+
+   host_parallel_for(bands, 1, [&](size_t b0, size_t b1) {
+      for (size_t b = b0; b < b1; b++) {
+         double first = (double)(b * height / bands), last = (double)((b + 1) * height / bands);
+         for (size_t i = 0; i < rows; i++) {
+            const float *p = xy + i * stride;
+            double row = std::floor(transform[2] + transform[3] * p[1]);
+            if (!(row >= first && row < last)) { // another band's, or off the grid (or NaN)
+               continue;
+            }
+            double col = std::floor(transform[0] + transform[1] * p[0]);
+            if (!(col >= 0 && col < width)) {
+               continue;
+            }
+            size_t c = 0;
+            if (labels != NULL) {
+               if (labels[i] < 0 || (size_t)labels[i] >= clusters) {
+                  continue;
+               }
+               c = labels[i];
+            }
+            counts[((size_t)row * width + (size_t)col) * clusters + c]++;
+         }
+      }
+   }, "density.bin");
+
+   host_parallel_for(pixels, 4096, [&](size_t begin, size_t end) {
+      for (size_t p = begin; p < end; p++) {
+         const unsigned int *cell = counts.data() + p * clusters;
+         unsigned int all = 0;
+         size_t best = 0;
+         for (size_t c = 0; c < clusters; c++) {
+            all += cell[c];
+            if (cell[c] > cell[best]) {
+               best = c;
+            }
+         }
+         total[p] = all;
+         majority[p] = all > 0 ? (int)best : -1;
+      }
+   }, "density.bin");
+   return 0;
+}
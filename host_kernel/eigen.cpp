@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+#include "eigen.h"
+
+// Symmetric eigen decomposition in double: a Householder reduction to tridiagonal form followed
+// by the implicit QL algorithm (tred2 / tql2, as in EISPACK and JAMA), which is exact to rounding
+// rather than stopping after a number of iterations.
+
+// v (n x n, row major) is replaced by the orthogonal transformation, d and e by the diagonal and
+// off diagonal of the tridiagonal matrix
+static void eigen_tred2( std::vector<double> &v, size_t n, std::vector<double> &d, std::vector<double> &e ) {
+   auto V = [&](size_t i, size_t j) -> double & { return v[i * n + j]; };
+   for (size_t j = 0; j < n; j++) {
+      d[j] = V(n - 1, j);
+   }
+   for (size_t i = n - 1; i > 0; i--) {
+      double scale = 0, h = 0;
+      for (size_t k = 0; k < i; k++) {
+         scale += std::fabs(d[k]);
+      }
+      if (scale == 0) {
+         e[i] = d[i - 1];
+         for (size_t j = 0; j < i; j++) {
+            d[j] = V(i - 1, j);
+            V(i, j) = 0;
+            V(j, i) = 0;
+         }
+      } else {
+         for (size_t k = 0; k < i; k++) {
+            d[k] /= scale;
+            h += d[k] * d[k];
+         }
+         double f = d[i - 1];
+         double g = std::sqrt(h);
+         if (f > 0) {
+            g = -g;
+         }
+         e[i] = scale * g;
+         h -= f * g;
+         d[i - 1] = f - g;
+         for (size_t j = 0; j < i; j++) {
+            e[j] = 0;
+         }
+         for (size_t j = 0; j < i; j++) {
+            f = d[j];
+            V(j, i) = f;
+            g = e[j] + V(j, j) * f;
+            for (size_t k = j + 1; k < i; k++) {
+               g += V(k, j) * d[k];
+               e[k] += V(k, j) * f;
+            }
+            e[j] = g;
+         }
+         f = 0;
+         for (size_t j = 0; j < i; j++) {
+            e[j] /= h;
+            f += e[j] * d[j];
+         }
+         double hh = f / (h + h);
+         for (size_t j = 0; j < i; j++) {
+            e[j] -= hh * d[j];
+         }
+         for (size_t j = 0; j < i; j++) {
+            f = d[j];
+            g = e[j];
+            for (size_t k = j; k < i; k++) {
+               V(k, j) -= f * e[k] + g * d[k];
+            }
+            d[j] = V(i - 1, j);
+            V(i, j) = 0;
+         }
+      }
+      d[i] = h;
+   }
+   // accumulate the transformations
+   for (size_t i = 0; i + 1 < n; i++) {
+      V(n - 1, i) = V(i, i);
+      V(i, i) = 1;
+      double h = d[i + 1];
+      if (h != 0) {
+         for (size_t k = 0; k <= i; k++) {
+            d[k] = V(k, i + 1) / h;
+         }
+         for (size_t j = 0; j <= i; j++) {
+            double g = 0;
+            for (size_t k = 0; k <= i; k++) {
+               g += V(k, i + 1) * V(k, j);
+            }
+            for (size_t k = 0; k <= i; k++) {
+               V(k, j) -= g * d[k];
+            }
+         }
+      }
+      for (size_t k = 0; k <= i; k++) {
+         V(k, i + 1) = 0;
+      }
+   }
+   for (size_t j = 0; j < n; j++) {
+      d[j] = V(n - 1, j);
+      V(n - 1, j) = 0;
+   }
+   V(n - 1, n - 1) = 1;
+   e[0] = 0;
+}
+
+// d and e to the eigenvalues (unsorted), and vt, the transformation transposed, to the eigenvectors one per row
+static void eigen_tql2( std::vector<double> &vt, size_t n, std::vector<double> &d, std::vector<double> &e ) {
+   // transposed, each rotation works on two contiguous rows
+   for (size_t i = 1; i < n; i++) {
+      e[i - 1] = e[i];
+   }
+   e[n - 1] = 0;
+   double f = 0, tst1 = 0;
+   const double eps = std::ldexp(1.0, -52);
+   for (size_t l = 0; l < n; l++) {
+      tst1 = std::max(tst1, std::fabs(d[l]) + std::fabs(e[l]));
+      size_t m = l;
+      while (m < n - 1 && std::fabs(e[m]) > eps * tst1) {
+         m++;
+      }
+      if (m > l) {
+         do {
+            double g = d[l];
+            double p = (d[l + 1] - g) / (2 * e[l]);
+            double r = std::hypot(p, 1.0);
+            if (p < 0) {
+               r = -r;
+            }
+            d[l] = e[l] / (p + r);
+            d[l + 1] = e[l] * (p + r);
+            double dl1 = d[l + 1];
+            double h = g - d[l];
+            for (size_t i = l + 2; i < n; i++) {
+               d[i] -= h;
+            }
+            f += h;
+            p = d[m];
+            double c = 1, c2 = 1, c3 = 1, s = 0, s2 = 0;
+            double el1 = e[l + 1];
+            for (size_t i = m; i-- > l;) {
+               c3 = c2;
+               c2 = c;
+               s2 = s;
+               g = c * e[i];
+               h = c * p;
+               r = std::hypot(p, e[i]);
+               e[i + 1] = s * r;
+               s = e[i] / r;
+               c = p / r;
+               p = c * d[i] - s * g;
+               d[i + 1] = h + s * (c * g + s * d[i]);
+               double *vi = vt.data() + i * n, *vi1 = vi + n;
+               #pragma omp simd
+               for (size_t k = 0; k < n; k++) {
+                  double t = vi1[k];
+                  vi1[k] = s * vi[k] + c * t;
+                  vi[k] = c * vi[k] - s * t;
+               }
+            }
+            p = -s * s2 * c3 * el1 * e[l] / dl1;
+            e[l] = s * p;
+            d[l] = c * p;
+         } while (std::fabs(e[l]) > eps * tst1);
+      }
+      d[l] += f;
+      e[l] = 0;
+   }
+}
+
+void host_symmetric_eigen( const double *a, size_t n, double *vectors, double *values ) {
+   if (n == 0) {
+      return;
+   }
+   std::vector<double> v(a, a + n * n), d(n), e(n);
+   eigen_tred2(v, n, d, e);
+   std::vector<double> vt(n * n);
+   for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+         vt[j * n + i] = v[i * n + j];
+      }
+   }
+   eigen_tql2(vt, n, d, e);
+   std::vector<size_t> order(n);
+   std::iota(order.begin(), order.end(), (size_t)0);
+   std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) { return d[x] > d[y]; });
+   for (size_t i = 0; i < n; i++) {
+      values[i] = d[order[i]];
+      std::copy(vt.begin() + order[i] * n, vt.begin() + (order[i] + 1) * n, vectors + i * n);
+   }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+// eigen decomposition of the symmetric n x n matrix a (row major): vectors gets the eigenvectors,
+// one per row, and values the eigenvalues, largest first
+void host_symmetric_eigen( const double *a, size_t n, double *vectors, double *values );
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "HostKernel.h"
+#include "gemm.h"
+#include "parallel.h"
+
+// C = alpha * op(A) x op(B) + beta * C, all row major.  op(A) is m x k, op(B) is k x n.
+// C is split into GEMM_MC x GEMM_NC tiles which are handed out to the worker threads.  Within a
+// tile, K is walked in GEMM_KC chunks; transposed operands are packed so the micro kernel
+// always sees A by rows and B by rows.  The micro kernel keeps a 4 x 16 block of C in registers.
+// An epilogue can be applied to each finished row of a tile while it is still in cache, which is
+// how the network layers fuse the bias + sigmoid and the delta x sigmoid' steps into the GEMM.
+// The same tiles do double (host_dgemm) for ML::Util, whose arrays are Perl's doubles.
+
+constexpr size_t GEMM_MC = 64;
+constexpr size_t GEMM_NC = 256;
+constexpr size_t GEMM_KC = 256;
+constexpr size_t GEMM_MR = 4;
+constexpr size_t GEMM_NR = 16;
+
+template <typename T>
+static void gemm_micro_4x16( const T *a, size_t lda, const T *b, size_t ldb, T *c, size_t ldc, size_t kc ) {
+   T r0[GEMM_NR] = {0}, r1[GEMM_NR] = {0}, r2[GEMM_NR] = {0}, r3[GEMM_NR] = {0};
+   for (size_t p = 0; p < kc; p++) {
+      const T *bp = b + p * ldb;
+      T a0 = a[p], a1 = a[lda + p], a2 = a[2 * lda + p], a3 = a[3 * lda + p];
+      #pragma omp simd
+      for (size_t j = 0; j < GEMM_NR; j++) {
+         r0[j] += a0 * bp[j];
+         r1[j] += a1 * bp[j];
+         r2[j] += a2 * bp[j];
+         r3[j] += a3 * bp[j];
+      }
+   }
+   #pragma omp simd
+   for (size_t j = 0; j < GEMM_NR; j++) {
+      c[j] += r0[j];
+      c[ldc + j] += r1[j];
+      c[2 * ldc + j] += r2[j];
+      c[3 * ldc + j] += r3[j];
+   }
+}
+
+template <typename T>
+static void gemm_micro_edge( const T *a, size_t lda, const T *b, size_t ldb, T *c, size_t ldc, size_t mr, size_t nr, size_t kc ) {
+   for (size_t i = 0; i < mr; i++) {
+      for (size_t p = 0; p < kc; p++) {
+         T av = a[i * lda + p];
+         const T *bp = b + p * ldb;
+         #pragma omp simd
+         for (size_t j = 0; j < nr; j++) {
+            c[i * ldc + j] += av * bp[j];
+         }
+      }
+   }
+}
+
+template <typename T, typename Epilogue>
+static void gemm_tiles( int transa, int transb, size_t m, size_t n, size_t k, T alpha, const T *a, size_t lda,
+                        const T *b, size_t ldb, T beta, T *c, size_t ldc, Epilogue epilogue ) {
+   size_t mtiles = (m + GEMM_MC - 1) / GEMM_MC;
+   size_t ntiles = (n + GEMM_NC - 1) / GEMM_NC;
+   host_parallel_for(mtiles * ntiles, 1, [&](size_t begin, size_t end) {
+      // kept per thread, so small GEMMs (a single row at inference time) don't pay for allocating
+      // and clearing a whole tile on every call
+      static thread_local std::vector<T> acc, apack, bpack;
+      acc.resize(GEMM_MC * GEMM_NC);
+      if (transa) apack.resize(GEMM_MC * GEMM_KC);
+      if (transb) bpack.resize(GEMM_KC * GEMM_NC);
+      for (size_t t = begin; t < end; t++) {
+         size_t i0 = (t / ntiles) * GEMM_MC, j0 = (t % ntiles) * GEMM_NC;
+         size_t mc = std::min(GEMM_MC, m - i0), nc = std::min(GEMM_NC, n - j0);
+         std::fill(acc.begin(), acc.begin() + mc * GEMM_NC, T(0));
+         for (size_t p0 = 0; p0 < k; p0 += GEMM_KC) {
+            size_t kc = std::min(GEMM_KC, k - p0);
+            const T *ap; size_t ald;
+            const T *bp; size_t bld;
+            if (transa) { // op(A)(i, p) = A(p, i)
+               for (size_t i = 0; i < mc; i++)
+                  for (size_t p = 0; p < kc; p++)
+                     apack[i * GEMM_KC + p] = a[(p0 + p) * lda + i0 + i];
+               ap = apack.data(); ald = GEMM_KC;
+            } else {
+               ap = a + i0 * lda + p0; ald = lda;
+            }
+            if (transb) { // op(B)(p, j) = B(j, p)
+               for (size_t j = 0; j < nc; j++)
+                  for (size_t p = 0; p < kc; p++)
+                     bpack[p * GEMM_NC + j] = b[(j0 + j) * ldb + p0 + p];
+               bp = bpack.data(); bld = GEMM_NC;
+            } else {
+               bp = b + p0 * ldb + j0; bld = ldb;
+            }
+            size_t i = 0;
+            for (; i + GEMM_MR <= mc; i += GEMM_MR) {
+               size_t j = 0;
+               for (; j + GEMM_NR <= nc; j += GEMM_NR) {
+                  gemm_micro_4x16(ap + i * ald, ald, bp + j, bld, acc.data() + i * GEMM_NC + j, GEMM_NC, kc);
+               }
+               if (j < nc) {
+                  gemm_micro_edge(ap + i * ald, ald, bp + j, bld, acc.data() + i * GEMM_NC + j, GEMM_NC, GEMM_MR, nc - j, kc);
+               }
+            }
+            if (i < mc) {
+               gemm_micro_edge(ap + i * ald, ald, bp, bld, acc.data() + i * GEMM_NC, GEMM_NC, mc - i, nc, kc);
+            }
+         }
+         for (size_t i = 0; i < mc; i++) {
+            T *crow = c + (i0 + i) * ldc + j0;
+            const T *arow = acc.data() + i * GEMM_NC;
+            if (beta == 0) { // don't read C, it may not be initialised
+               #pragma omp simd
+               for (size_t j = 0; j < nc; j++) crow[j] = alpha * arow[j];
+            } else {
+               #pragma omp simd
+               for (size_t j = 0; j < nc; j++) crow[j] = alpha * arow[j] + beta * crow[j];
+            }
+            epilogue(i0 + i, j0, crow, nc);
+         }
+      }
+   }, "gemm");
+}
+
+void host_sgemm( int transa, int transb, size_t m, size_t n, size_t k, float alpha, const float *a, size_t lda,
+                 const float *b, size_t ldb, float beta, float *c, size_t ldc ) {
+   gemm_tiles(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, [](size_t, size_t, float *, size_t) {});
+}
+
+void host_dgemm( int transa, int transb, size_t m, size_t n, size_t k, double alpha, const double *a, size_t lda,
+                 const double *b, size_t ldb, double beta, double *c, size_t ldc ) {
+   gemm_tiles(transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, [](size_t, size_t, double *, size_t) {});
+}
+
+void gemm_bias_sigmoid( int transw, size_t m, size_t n, size_t k, const float *a, size_t lda, const float *w, size_t ldw,
+                        const float *bias, float *c, size_t ldc ) {
+   gemm_tiles(0, transw, m, n, k, 1.0f, a, lda, w, ldw, 0.0f, c, ldc, [bias](size_t, size_t j0, float *crow, size_t nc) {
+      const float *b = bias + j0;
+      #pragma omp simd
+      for (size_t j = 0; j < nc; j++) {
+         crow[j] = 1.0f / (1.0f + expf(-(crow[j] + b[j])));
+      }
+   });
+}
+
+void gemm_sigmoid_prime( size_t m, size_t n, size_t k, const float *a, size_t lda, const float *b, size_t ldb,
+                         const float *act, size_t ldact, float *c, size_t ldc ) {
+   gemm_tiles(0, 0, m, n, k, 1.0f, a, lda, b, ldb, 0.0f, c, ldc, [act, ldact](size_t i, size_t j0, float *crow, size_t nc) {
+      const float *s = act + i * ldact + j0;
+      #pragma omp simd
+      for (size_t j = 0; j < nc; j++) {
+         crow[j] *= s[j] * (1.0f - s[j]);
+      }
+   });
+}
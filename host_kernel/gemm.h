@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+// GEMMs with a fused element-wise step, used by the network layers.  All row major.
+
+// c (m x n) = sigmoid(a (m x k) x op(w) + bias), w is n x k when transw is set (the layout the
+// network keeps its weights in), otherwise k x n, and bias is 1 x n
+void gemm_bias_sigmoid( int transw, size_t m, size_t n, size_t k, const float *a, size_t lda, const float *w, size_t ldw,
+                        const float *bias, float *c, size_t ldc );
+
+// c (m x n) = (a (m x k) x b (k x n)) * act * (1 - act), act is the m x n sigmoid output
+void gemm_sigmoid_prime( size_t m, size_t n, size_t k, const float *a, size_t lda, const float *b, size_t ldb,
+                         const float *act, size_t ldact, float *c, size_t ldc );
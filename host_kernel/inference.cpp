@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "gemm.h"
+#include "parallel.h"
+
+// A frozen copy of a network for prediction only.  It keeps just the weights, stored transposed
+// (input x output) so each layer is a plain GEMM with no packing.  Rows are handed out to the
+// threads in blocks of INFERENCE_ROWS, and each thread runs its block through every layer in two
+// activation buffers of its own, INFERENCE_ROWS x the widest layer, which the layers alternate
+// between; so the memory is the weights plus two small buffers per thread however many rows are
+// predicted, and the layers never wait on each other.
+
+constexpr size_t INFERENCE_ROWS = 64; // rows per work item
+
+host_inference_t *host_inference_create( size_t layers, const size_t *sizes, const float *const *weights, const float *const *bias ) {
+   host_inference_t *inf = (host_inference_t *)calloc(1, sizeof(host_inference_t));
+   if (inf == NULL) {
+      return NULL;
+   }
+   size_t parameters = 0;
+   for (size_t l = 0; l < layers; l++) {
+      parameters += sizes[l + 1] * (sizes[l] + 1);
+   }
+   inf->layers = layers;
+   inf->sizes = (size_t *)malloc(sizeof(size_t) * (layers + 1));
+   inf->weights_t = (float **)malloc(sizeof(float *) * layers);
+   inf->bias = (float **)malloc(sizeof(float *) * layers);
+   inf->parameters = (float *)host_alloc(sizeof(float) * parameters);
+   if (inf->sizes == NULL || inf->weights_t == NULL || inf->bias == NULL || inf->parameters == NULL) {
+      fprintf(stderr, "host_inference_create() : error, failed to allocate %zu parameters.\n", parameters);
+      host_inference_free(inf);
+      return NULL;
+   }
+   memcpy(inf->sizes, sizes, sizeof(size_t) * (layers + 1));
+   inf->max_width = *std::max_element(sizes + 1, sizes + layers + 1);
+   float *p = inf->parameters;
+   for (size_t l = 0; l < layers; l++) {
+      size_t in = sizes[l], out = sizes[l + 1];
+      inf->weights_t[l] = p;
+      for (size_t o = 0; o < out; o++) {
+         for (size_t i = 0; i < in; i++) {
+            p[i * out + o] = weights[l][o * in + i];
+         }
+      }
+      p += in * out;
+      inf->bias[l] = p;
+      memcpy(p, bias[l], sizeof(float) * out);
+      p += out;
+   }
+   return inf;
+}
+
+host_inference_t *host_inference_load( const char *filename ) {
+   host_checkpoint_t *cp = host_checkpoint_open(filename);
+   if (cp == NULL) {
+      return NULL;
+   }
+   host_inference_t *inf = host_inference_create(cp->layers, cp->sizes, cp->weights, cp->bias);
+   host_checkpoint_close(cp);
+   return inf;
+}
+
+host_inference_t *host_inference_from_network( const host_network_t *net ) {
+   std::vector<size_t> sizes(net->layers + 1);
+   std::vector<const float *> weights(net->layers), bias(net->layers);
+   sizes[0] = net->layer[0].input_size;
+   for (size_t l = 0; l < net->layers; l++) {
+      sizes[l + 1] = net->layer[l].output_size;
+      weights[l] = net->layer[l].weights;
+      bias[l] = net->layer[l].bias;
+   }
+   return host_inference_create(net->layers, sizes.data(), weights.data(), bias.data());
+}
+
+void host_inference_free( host_inference_t *inf ) {
+   if (inf == NULL) {
+      return;
+   }
+   free(inf->sizes);
+   free(inf->weights_t);
+   free(inf->bias);
+   host_free(inf->parameters);
+   free(inf);
+}
+
+// runs rows [begin, end), at most INFERENCE_ROWS of them, through every layer, the last one writing
+// to out (or to the calling thread's ping pong buffers when out is NULL), and returns where the
+// final activations are
+static const float *inference_rows( const host_inference_t *inf, const float *x, size_t begin, size_t end, float *out ) {
+   static thread_local std::vector<float> ping_pong;
+   size_t rows = end - begin;
+   const float *input = x + begin * inf->sizes[0];
+   if (ping_pong.size() < 2 * INFERENCE_ROWS * inf->max_width) {
+      ping_pong.resize(2 * INFERENCE_ROWS * inf->max_width);
+   }
+   float *buffers[2] = { ping_pong.data(), ping_pong.data() + INFERENCE_ROWS * inf->max_width };
+   for (size_t l = 0; l < inf->layers; l++) {
+      size_t in = inf->sizes[l], width = inf->sizes[l + 1];
+      float *output = buffers[l % 2];
+      if (l + 1 == inf->layers && out != NULL) {
+         output = out + begin * width;
+      }
+      gemm_bias_sigmoid(0, rows, width, in, input, in, inf->weights_t[l], width, inf->bias[l], output, width);
+      input = output;
+   }
+   return input;
+}
+
+int host_inference_predict( host_inference_t *inf, const float *x, size_t rows, float *out ) {
+   HOST_PROFILE_SCOPE("inference.predict");
+   host_parallel_for(rows, INFERENCE_ROWS, [&](size_t begin, size_t end) {
+      for (size_t b = begin; b < end; b += INFERENCE_ROWS) {
+         inference_rows(inf, x, b, std::min(end, b + INFERENCE_ROWS), out);
+      }
+   }, "inference.predict");
+   return 0;
+}
+
+int host_inference_classify( host_inference_t *inf, const float *x, size_t rows, int *labels ) {
+   HOST_PROFILE_SCOPE("inference.classify");
+   size_t width = inf->sizes[inf->layers];
+   host_parallel_for(rows, INFERENCE_ROWS, [&](size_t begin, size_t end) {
+      for (size_t b = begin; b < end; b += INFERENCE_ROWS) {
+         size_t e = std::min(end, b + INFERENCE_ROWS);
+         const float *a = inference_rows(inf, x, b, e, NULL);
+         for (size_t i = 0; i < e - b; i++) { // first maximum wins, as in ML::MVKernels::argmax
+            size_t best = 0;
+            for (size_t j = 1; j < width; j++) {
+               if (a[i * width + j] > a[i * width + best]) {
+                  best = j;
+               }
+            }
+            labels[b + i] = (int)best;
+         }
+      }
+   }, "inference.classify");
+   return 0;
+}
@@ -0,0 +1,567 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "parallel.h"
+
+// Lloyd's algorithm over a packed rows x cols buffer.  assign() keeps a transposed copy of the
+// centroids (cols x clusters) so the distances from one point to a block of centroids are
+// calculated with the centroids in the SIMD lanes, which works for any number of columns.
+// update() accumulates into one partial sum per thread and then reduces them.
+//
+// For very large numbers of clusters an optional index (an IVF style coarse quantizer) groups the
+// centroids into lists around coarse centres, and assign() only searches the lists whose centres
+// are nearest each point.  How many lists are probed is recalibrated on every assign, from a
+// sample of points searched exactly, to give the requested fraction of points their exact
+// nearest centroid; a second sample measures how many actually differ.
+
+constexpr size_t KMEANS_ASSIGN_ROWS = 1024;   // rows per work item in assign
+constexpr size_t KMEANS_CENTROID_BLOCK = 256; // centroids per distance block, keeps dist[] in L1
+constexpr size_t KMEANS_INDEX_SAMPLE = 512;   // points searched exactly to calibrate, and again to check
+constexpr size_t KMEANS_INDEX_ROUNDS = 8;     // Lloyd rounds over the centroids when the lists are first built
+constexpr size_t KMEANS_UPDATE_PARTIALS = (size_t)32 << 20; // bytes of per-thread sums update may use
+constexpr size_t KMEANS_UPDATE_CLUSTERS = 64; // clusters per work item when update is split by cluster
+
+static void kmeans_transpose_centroids( host_kmeans_t *km ) {
+   for (size_t k = 0; k < km->clusters; k++) {
+      for (size_t c = 0; c < km->cols; c++) {
+         km->centroids_t[c * km->clusters + k] = km->centroids[k * km->cols + c];
+      }
+   }
+   if (km->index != NULL) { // called whenever the centroids change
+      km->index->stale = 1;
+   }
+}
+
+// squared distances from x to n centroids held transposed, column c of centroid k at ct[c * ld + k]
+static inline void kmeans_distances( const float *x, size_t cols, const float *ct, size_t ld, size_t n, float *dist ) {
+   std::fill(dist, dist + n, 0.0f);
+   for (size_t c = 0; c < cols; c++) {
+      float xc = x[c];
+      const float *row = ct + c * ld;
+      #pragma omp simd
+      for (size_t k = 0; k < n; k++) {
+         float diff = xc - row[k];
+         dist[k] += diff * diff;
+      }
+   }
+}
+
+// nearest of n transposed centroids, numbered ids[k] (or k when ids is NULL).  *min and *minidx
+// carry the best so far between calls; on a tie the lower number wins, as the first minimum does
+// in a search of every centroid in order.
+static inline void kmeans_nearest( const float *x, size_t cols, const float *ct, size_t ld, size_t n, const size_t *ids,
+                                   float *min, size_t *minidx ) {
+   alignas(64) float dist[KMEANS_CENTROID_BLOCK];
+   float best = *min;
+   size_t bestidx = *minidx;
+   for (size_t k0 = 0; k0 < n; k0 += KMEANS_CENTROID_BLOCK) {
+      size_t nk = std::min(KMEANS_CENTROID_BLOCK, n - k0);
+      kmeans_distances(x, cols, ct + k0, ld, nk, dist);
+      if (ids == NULL) {
+         for (size_t k = 0; k < nk; k++) {
+            if (dist[k] < best) {
+               best = dist[k];
+               bestidx = k0 + k;
+            }
+         }
+      } else {
+         for (size_t k = 0; k < nk; k++) {
+            if (dist[k] < best || (dist[k] == best && ids[k0 + k] < bestidx)) {
+               best = dist[k];
+               bestidx = ids[k0 + k];
+            }
+         }
+      }
+   }
+   *min = best;
+   *minidx = bestidx;
+}
+
+static size_t kmeans_exact( const host_kmeans_t *km, const float *x ) {
+   float min = FLT_MAX;
+   size_t minidx = 0;
+   kmeans_nearest(x, km->cols, km->centroids_t, km->clusters, km->clusters, NULL, &min, &minidx);
+   return minidx;
+}
+
+host_kmeans_t *host_kmeans_create( const float *data, size_t rows, size_t cols, size_t clusters ) {
+   host_kmeans_t *km = (host_kmeans_t *)calloc(1, sizeof(host_kmeans_t));
+   if (km == NULL) {
+      return NULL;
+   }
+   km->data = data;
+   km->rows = rows;
+   km->cols = cols;
+   km->clusters = clusters;
+   km->centroids = (float *)host_alloc(sizeof(float) * clusters * cols);
+   km->centroids_t = (float *)host_alloc(sizeof(float) * clusters * cols);
+   km->cluster_map = (size_t *)host_alloc(sizeof(size_t) * rows);
+   km->point_count = (size_t *)host_alloc(sizeof(size_t) * clusters);
+   if (km->centroids == NULL || km->centroids_t == NULL || km->cluster_map == NULL || km->point_count == NULL) {
+      fprintf(stderr, "host_kmeans_create() : error, failed to allocate for %zu rows x %zu cols, %zu clusters.\n", rows, cols, clusters);
+      host_kmeans_free(km);
+      return NULL;
+   }
+   for (size_t i = 0; i < rows; i++) {
+      km->cluster_map[i] = SIZE_MAX; // so that the first assign counts every point as a change
+   }
+   HOST_PROFILE_COUNT("bytes_allocated", sizeof(float) * clusters * cols * 2 + sizeof(size_t) * (rows + clusters));
+   return km;
+}
+
+void host_kmeans_free( host_kmeans_t *km ) {
+   if (km == NULL) {
+      return;
+   }
+   host_free(km->centroids);
+   host_free(km->centroids_t);
+   host_free(km->cluster_map);
+   host_free(km->point_count);
+   host_free(km->members);
+   host_free(km->member_start);
+   host_kmeans_clear_index(km);
+   free(km);
+}
+
+void host_kmeans_set_centroids( host_kmeans_t *km, const float *centroids ) {
+   memcpy(km->centroids, centroids, sizeof(float) * km->clusters * km->cols);
+   kmeans_transpose_centroids(km);
+}
+
+void host_kmeans_init_plusplus( host_kmeans_t *km, unsigned int seed ) {
+   HOST_PROFILE_SCOPE("kmeans.init");
+   // k-means++: the first centroid is a random point, each following one is a point picked with
+   // probability proportional to its squared distance from the nearest centroid chosen so far
+   std::mt19937_64 gen(seed);
+   size_t rows = km->rows, cols = km->cols;
+   std::vector<double> nearest(rows, DBL_MAX);
+   size_t pick = std::uniform_int_distribution<size_t>(0, rows - 1)(gen);
+   for (size_t k = 0; k < km->clusters; k++) {
+      memcpy(km->centroids + k * cols, km->data + pick * cols, sizeof(float) * cols);
+      if (k + 1 == km->clusters) {
+         break;
+      }
+      const float *centroid = km->centroids + k * cols;
+      // summed in fixed chunks, so the picks don't depend on the number of threads
+      double total = host_parallel_reduce(rows, KMEANS_ASSIGN_ROWS, 0.0, [&](size_t begin, size_t end) {
+         double sum = 0;
+         for (size_t i = begin; i < end; i++) {
+            const float *x = km->data + i * cols;
+            float d = 0;
+            #pragma omp simd reduction(+:d)
+            for (size_t c = 0; c < cols; c++) {
+               float diff = x[c] - centroid[c];
+               d += diff * diff;
+            }
+            if (d < nearest[i]) {
+               nearest[i] = d;
+            }
+            sum += nearest[i];
+         }
+         return sum;
+      }, std::plus<double>(), "kmeans.init");
+      if (total <= 0) { // fewer distinct points than clusters, just reuse one
+         pick = std::uniform_int_distribution<size_t>(0, rows - 1)(gen);
+         continue;
+      }
+      double target = std::uniform_real_distribution<double>(0.0, total)(gen);
+      pick = rows - 1;
+      for (size_t i = 0; i < rows; i++) {
+         target -= nearest[i];
+         if (target <= 0) {
+            pick = i;
+            break;
+         }
+      }
+   }
+   kmeans_transpose_centroids(km);
+}
+
+static void kmeans_index_build( host_kmeans_t *km );
+static void kmeans_index_calibrate( host_kmeans_t *km );
+static void kmeans_index_check( host_kmeans_t *km );
+static size_t kmeans_approximate( const host_kmeans_t *km, const float *x, float *min, float *coarse_dist, size_t *order );
+
+size_t host_kmeans_assign( host_kmeans_t *km ) {
+   HOST_PROFILE_SCOPE("kmeans.assign");
+   size_t rows = km->rows, cols = km->cols, clusters = km->clusters;
+   host_kmeans_index_t *index = km->index;
+   if (index != NULL) {
+      if (index->stale) {
+         kmeans_index_build(km);
+      }
+      kmeans_index_calibrate(km);
+   }
+   typedef std::pair<size_t, double> changes_inertia_t;
+   changes_inertia_t total = host_parallel_reduce(rows, KMEANS_ASSIGN_ROWS, changes_inertia_t(0, 0.0), [&](size_t begin, size_t end) {
+      std::vector<float> coarse_dist(index != NULL ? index->lists : 0);
+      std::vector<size_t> order(index != NULL ? index->lists : 0);
+      size_t changes = 0;
+      double inertia = 0;
+      for (size_t i = begin; i < end; i++) {
+         const float *x = km->data + i * cols;
+         float min = FLT_MAX;
+         size_t minidx = 0;
+         if (index != NULL) {
+            minidx = kmeans_approximate(km, x, &min, coarse_dist.data(), order.data());
+         } else {
+            kmeans_nearest(x, cols, km->centroids_t, clusters, clusters, NULL, &min, &minidx);
+         }
+         inertia += min;
+         if (km->cluster_map[i] != minidx) {
+            changes++;
+            km->cluster_map[i] = minidx;
+         }
+      }
+      return changes_inertia_t(changes, inertia);
+   }, [](const changes_inertia_t &a, const changes_inertia_t &b) {
+      return changes_inertia_t(a.first + b.first, a.second + b.second);
+   }, "kmeans.assign");
+   size_t changes = total.first;
+   km->inertia = total.second;
+   if (index != NULL) {
+      kmeans_index_check(km);
+   }
+   return changes;
+}
+
+static int kmeans_update_by_cluster( host_kmeans_t *km ) {
+   // the rows are sorted by cluster (a counting sort, so two passes over the map), and each
+   // cluster's mean is then taken by the one thread which owns it: no partial sums at all, for the
+   // cluster counts where one set per thread won't fit
+   size_t rows = km->rows, cols = km->cols, clusters = km->clusters;
+   if (km->members == NULL) {
+      km->members = (size_t *)host_alloc(sizeof(size_t) * rows);
+      km->member_start = (size_t *)host_alloc(sizeof(size_t) * (clusters + 1));
+      if (km->members == NULL || km->member_start == NULL) {
+         host_free(km->members);
+         host_free(km->member_start);
+         km->members = km->member_start = NULL;
+         return 1;
+      }
+   }
+   size_t *start = km->member_start;
+   std::fill(start, start + clusters + 1, 0);
+   for (size_t i = 0; i < rows; i++) {
+      start[km->cluster_map[i] + 1]++;
+   }
+   for (size_t k = 0; k < clusters; k++) {
+      start[k + 1] += start[k];
+   }
+   for (size_t i = 0; i < rows; i++) { // leaves start[k] at the end of cluster k, the start of k + 1
+      km->members[start[km->cluster_map[i]]++] = i;
+   }
+   host_parallel_for(clusters, KMEANS_UPDATE_CLUSTERS, [&](size_t begin, size_t end) {
+      std::vector<double> sum(cols);
+      for (size_t k = begin; k < end; k++) {
+         size_t first = k == 0 ? 0 : start[k - 1], last = start[k];
+         km->point_count[k] = last - first;
+         if (last == first) { // an empty cluster keeps its previous centroid
+            continue;
+         }
+         std::fill(sum.begin(), sum.end(), 0.0);
+         for (size_t m = first; m < last; m++) {
+            const float *x = km->data + km->members[m] * cols;
+            #pragma omp simd
+            for (size_t c = 0; c < cols; c++) {
+               sum[c] += x[c];
+            }
+         }
+         for (size_t c = 0; c < cols; c++) {
+            km->centroids[k * cols + c] = (float)(sum[c] / (last - first));
+         }
+      }
+   }, "kmeans.update");
+   return 0;
+}
+
+void host_kmeans_update( host_kmeans_t *km ) {
+   HOST_PROFILE_SCOPE("kmeans.update");
+   size_t rows = km->rows, cols = km->cols, clusters = km->clusters;
+   size_t chunks = std::max((size_t)1, std::min((size_t)host_get_threads(), rows));
+   // a set of sums per thread, merged at the end, while they fit in KMEANS_UPDATE_PARTIALS; with
+   // many clusters (and so many sets of sums) the work is split by cluster instead
+   if (chunks * clusters * (cols * sizeof(double) + sizeof(size_t)) > KMEANS_UPDATE_PARTIALS &&
+       kmeans_update_by_cluster(km) == 0) {
+      kmeans_transpose_centroids(km);
+      return;
+   }
+   size_t grain = (rows + chunks - 1) / chunks;
+   chunks = (rows + grain - 1) / grain;
+   std::vector<double> sums(chunks * clusters * cols, 0.0);
+   std::vector<size_t> counts(chunks * clusters, 0);
+   host_parallel_for(rows, grain, [&](size_t begin, size_t end) {
+      size_t chunk = begin / grain;
+      double *s = sums.data() + chunk * clusters * cols;
+      size_t *n = counts.data() + chunk * clusters;
+      for (size_t i = begin; i < end; i++) {
+         size_t k = km->cluster_map[i];
+         const float *x = km->data + i * cols;
+         double *sk = s + k * cols;
+         n[k]++;
+         #pragma omp simd
+         for (size_t c = 0; c < cols; c++) {
+            sk[c] += x[c];
+         }
+      }
+   }, "kmeans.update");
+   for (size_t k = 0; k < clusters; k++) {
+      size_t n = 0;
+      for (size_t chunk = 0; chunk < chunks; chunk++) {
+         n += counts[chunk * clusters + k];
+      }
+      km->point_count[k] = n;
+      if (n == 0) { // an empty cluster keeps its previous centroid
+         continue;
+      }
+      for (size_t c = 0; c < cols; c++) {
+         double s = 0;
+         for (size_t chunk = 0; chunk < chunks; chunk++) {
+            s += sums[(chunk * clusters + k) * cols + c];
+         }
+         km->centroids[k * cols + c] = (float)(s / n);
+      }
+   }
+   kmeans_transpose_centroids(km);
+}
+
+size_t host_kmeans_run( host_kmeans_t *km, size_t maxiter, size_t *iterations ) {
+   size_t changes = host_kmeans_assign(km);
+   size_t iteration = 0; // not counting the first assignment as an iteration
+   while (iteration < maxiter && changes > 0) {
+      iteration++;
+      host_kmeans_update(km);
+      changes = host_kmeans_assign(km);
+   }
+   if (iterations != NULL) {
+      *iterations = iteration;
+   }
+   return changes;
+}
+
+int host_kmeans_set_index( host_kmeans_t *km, size_t lists, float recall, int audit ) {
+   size_t clusters = km->clusters, cols = km->cols;
+   if (lists == 0) {
+      lists = (size_t)std::lround(std::sqrt((double)clusters));
+   }
+   if (lists < 1 || lists > clusters || !(recall > 0 && recall <= 1)) {
+      fprintf(stderr, "host_kmeans_set_index() : error, %zu lists for %zu clusters with recall %g.\n", lists, clusters, recall);
+      return 1;
+   }
+   host_kmeans_clear_index(km);
+   host_kmeans_index_t *index = (host_kmeans_index_t *)calloc(1, sizeof(host_kmeans_index_t));
+   if (index == NULL) {
+      return 1;
+   }
+   index->lists = lists;
+   index->probes = lists;
+   index->recall = recall;
+   index->audit = audit;
+   index->stale = 1;
+   index->exact_mismatches = -1;
+   index->coarse = (float *)host_alloc(sizeof(float) * lists * cols);
+   index->coarse_t = (float *)host_alloc(sizeof(float) * lists * cols);
+   index->list_of = (size_t *)host_alloc(sizeof(size_t) * clusters);
+   index->list_start = (size_t *)host_alloc(sizeof(size_t) * (lists + 1));
+   index->members = (size_t *)host_alloc(sizeof(size_t) * clusters);
+   index->members_t = (float *)host_alloc(sizeof(float) * clusters * cols);
+   km->index = index;
+   if (index->coarse == NULL || index->coarse_t == NULL || index->list_of == NULL || index->list_start == NULL ||
+       index->members == NULL || index->members_t == NULL) {
+      fprintf(stderr, "host_kmeans_set_index() : error, failed to allocate the index for %zu clusters x %zu cols.\n", clusters, cols);
+      host_kmeans_clear_index(km);
+      return 1;
+   }
+   HOST_PROFILE_COUNT("bytes_allocated", sizeof(float) * (2 * lists + clusters) * cols + sizeof(size_t) * (2 * clusters + lists + 1));
+   return 0;
+}
+
+void host_kmeans_clear_index( host_kmeans_t *km ) {
+   host_kmeans_index_t *index = km->index;
+   if (index == NULL) {
+      return;
+   }
+   host_free(index->coarse);
+   host_free(index->coarse_t);
+   host_free(index->list_of);
+   host_free(index->list_start);
+   host_free(index->members);
+   host_free(index->members_t);
+   free(index);
+   km->index = NULL;
+}
+
+static void kmeans_index_build( host_kmeans_t *km ) {
+   HOST_PROFILE_SCOPE("kmeans.index_build");
+   // Lloyd's over the centroids themselves: each round puts every centroid in the list of its
+   // nearest coarse centre, then moves the centres to the means of their lists.  The first build
+   // starts from evenly spaced centroids and runs several rounds; after that the centroids have
+   // only moved a little since the last update, so one round repairs the lists.
+   host_kmeans_index_t *index = km->index;
+   size_t clusters = km->clusters, cols = km->cols, lists = index->lists;
+   size_t rounds = 1;
+   if (!index->built) {
+      for (size_t l = 0; l < lists; l++) {
+         memcpy(index->coarse + l * cols, km->centroids + (l * clusters / lists) * cols, sizeof(float) * cols);
+      }
+      rounds = KMEANS_INDEX_ROUNDS;
+   }
+   std::vector<double> sums(lists * cols);
+   std::vector<size_t> counts(lists);
+   for (size_t round = 0; round < rounds; round++) {
+      for (size_t l = 0; l < lists; l++) {
+         for (size_t c = 0; c < cols; c++) {
+            index->coarse_t[c * lists + l] = index->coarse[l * cols + c];
+         }
+      }
+      host_parallel_for(clusters, KMEANS_CENTROID_BLOCK, [&](size_t begin, size_t end) {
+         for (size_t k = begin; k < end; k++) {
+            float min = FLT_MAX;
+            size_t minidx = 0;
+            kmeans_nearest(km->centroids + k * cols, cols, index->coarse_t, lists, lists, NULL, &min, &minidx);
+            index->list_of[k] = minidx;
+         }
+      }, "kmeans.index_build");
+      std::fill(sums.begin(), sums.end(), 0.0);
+      std::fill(counts.begin(), counts.end(), 0);
+      for (size_t k = 0; k < clusters; k++) {
+         size_t l = index->list_of[k];
+         counts[l]++;
+         for (size_t c = 0; c < cols; c++) {
+            sums[l * cols + c] += km->centroids[k * cols + c];
+         }
+      }
+      for (size_t l = 0; l < lists; l++) {
+         if (counts[l] == 0) { // an empty list keeps its centre
+            continue;
+         }
+         for (size_t c = 0; c < cols; c++) {
+            index->coarse[l * cols + c] = (float)(sums[l * cols + c] / counts[l]);
+         }
+      }
+   }
+   for (size_t l = 0; l < lists; l++) {
+      for (size_t c = 0; c < cols; c++) {
+         index->coarse_t[c * lists + l] = index->coarse[l * cols + c];
+      }
+   }
+
+   // the members of each list, in centroid order, and their centroids transposed list by list
+   index->list_start[0] = 0;
+   for (size_t l = 0; l < lists; l++) {
+      index->list_start[l + 1] = index->list_start[l] + counts[l];
+   }
+   std::vector<size_t> fill(index->list_start, index->list_start + lists);
+   for (size_t k = 0; k < clusters; k++) {
+      index->members[fill[index->list_of[k]]++] = k;
+   }
+   host_parallel_for(lists, 1, [&](size_t begin, size_t end) {
+      for (size_t l = begin; l < end; l++) {
+         size_t start = index->list_start[l], n = index->list_start[l + 1] - start;
+         float *block = index->members_t + start * cols;
+         for (size_t j = 0; j < n; j++) {
+            const float *centroid = km->centroids + index->members[start + j] * cols;
+            for (size_t c = 0; c < cols; c++) {
+               block[c * n + j] = centroid[c];
+            }
+         }
+      }
+   }, "kmeans.index_build");
+   index->built = 1;
+   index->stale = 0;
+}
+
+// searches the index->probes lists with the nearest coarse centres, coarse_dist and order are
+// scratch space of index->lists each
+static size_t kmeans_approximate( const host_kmeans_t *km, const float *x, float *min, float *coarse_dist, size_t *order ) {
+   const host_kmeans_index_t *index = km->index;
+   size_t cols = km->cols, lists = index->lists, probes = index->probes;
+   kmeans_distances(x, cols, index->coarse_t, lists, lists, coarse_dist);
+   for (size_t l = 0; l < lists; l++) {
+      order[l] = l;
+   }
+   if (probes < lists) {
+      std::nth_element(order, order + probes, order + lists, [coarse_dist](size_t a, size_t b) {
+         return coarse_dist[a] < coarse_dist[b];
+      });
+   }
+   size_t minidx = 0;
+   for (size_t p = 0; p < probes; p++) {
+      size_t start = index->list_start[order[p]], n = index->list_start[order[p] + 1] - start;
+      kmeans_nearest(x, cols, index->members_t + start * cols, n, n, index->members + start, min, &minidx);
+   }
+   if (*min == FLT_MAX) { // only empty lists were probed
+      kmeans_nearest(x, cols, km->centroids_t, km->clusters, km->clusters, NULL, min, &minidx);
+   }
+   return minidx;
+}
+
+// the sample rows, "offset" 0 for the calibration sample and 1 for the check, which lie half way
+// between the calibration rows (the same rows when there are too few points to keep them apart)
+static size_t kmeans_sample_row( size_t rows, size_t samples, size_t i, size_t offset ) {
+   return (2 * i + offset) * rows / (2 * samples);
+}
+
+static void kmeans_index_calibrate( host_kmeans_t *km ) {
+   HOST_PROFILE_SCOPE("kmeans.index_calibrate");
+   // for each sample point, the rank of its exact nearest centroid's list among the lists ordered
+   // by distance to their centres; enough probes for the recall'th fraction of the sample
+   host_kmeans_index_t *index = km->index;
+   size_t lists = index->lists, samples = std::min(km->rows, KMEANS_INDEX_SAMPLE);
+   std::vector<size_t> needed(samples);
+   host_parallel_for(samples, 16, [&](size_t begin, size_t end) {
+      std::vector<float> coarse_dist(lists);
+      for (size_t i = begin; i < end; i++) {
+         const float *x = km->data + kmeans_sample_row(km->rows, samples, i, 0) * km->cols;
+         size_t exact_list = index->list_of[kmeans_exact(km, x)];
+         kmeans_distances(x, km->cols, index->coarse_t, lists, lists, coarse_dist.data());
+         size_t rank = 0;
+         for (size_t l = 0; l < lists; l++) {
+            rank += coarse_dist[l] < coarse_dist[exact_list];
+         }
+         needed[i] = rank + 1;
+      }
+   }, "kmeans.index_calibrate");
+   std::sort(needed.begin(), needed.end());
+   size_t at = (size_t)std::ceil(index->recall * samples);
+   index->probes = samples == 0 ? lists : std::min(lists, needed[std::max(at, (size_t)1) - 1]);
+}
+
+static void kmeans_index_check( host_kmeans_t *km ) {
+   HOST_PROFILE_SCOPE("kmeans.index_check");
+   host_kmeans_index_t *index = km->index;
+   size_t rows = km->rows, samples = std::min(rows, KMEANS_INDEX_SAMPLE);
+   std::vector<size_t> wrong(samples, 0);
+   host_parallel_for(samples, 16, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+         size_t row = kmeans_sample_row(rows, samples, i, 1);
+         wrong[i] = km->cluster_map[row] != kmeans_exact(km, km->data + row * km->cols);
+      }
+   }, "kmeans.index_check");
+   index->sampled = samples;
+   index->sample_mismatches = std::accumulate(wrong.begin(), wrong.end(), (size_t)0);
+   index->exact_mismatches = -1;
+   if (index->audit) {
+      size_t chunks = (rows + KMEANS_ASSIGN_ROWS - 1) / KMEANS_ASSIGN_ROWS;
+      std::vector<size_t> chunk_wrong(chunks, 0);
+      host_parallel_for(rows, KMEANS_ASSIGN_ROWS, [&](size_t begin, size_t end) {
+         size_t n = 0;
+         for (size_t i = begin; i < end; i++) {
+            n += km->cluster_map[i] != kmeans_exact(km, km->data + i * km->cols);
+         }
+         chunk_wrong[begin / KMEANS_ASSIGN_ROWS] = n;
+      }, "kmeans.index_check");
+      index->exact_mismatches = std::accumulate(chunk_wrong.begin(), chunk_wrong.end(), (size_t)0);
+   }
+}
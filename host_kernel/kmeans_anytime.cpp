@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "parallel.h"
+
+// k-means within a time budget.  The centroids are first found on random subsamples of the rows,
+// each KMEANS_ANYTIME_GROWTH times the last (k-means++ on the first, each following one starting
+// from where the last got to), which settle in a fraction of the time a pass over every row takes.
+// The rest of the budget goes on full Lloyd iterations, each started only if the last one's time
+// says it will end before the deadline.  Every point is always assigned at least once, so there
+// is a labelling however short the budget, and the state with the lowest inertia seen on the
+// full data is the one left in the engine.
+
+constexpr size_t KMEANS_ANYTIME_SAMPLE = 4096;       // rows in the first subsample, at least
+constexpr size_t KMEANS_ANYTIME_GROWTH = 4;          // each subsample is this many times the last
+constexpr double KMEANS_ANYTIME_SAMPLE_SHARE = 0.5;  // of the budget, at most, spent on the subsamples
+constexpr double KMEANS_ANYTIME_SETTLED = 1e-3;      // a subsample is done once fewer of its rows than this change
+
+typedef std::chrono::steady_clock anytime_clock;
+
+static double anytime_ms( anytime_clock::time_point since ) {
+   return std::chrono::duration<double, std::milli>(anytime_clock::now() - since).count();
+}
+
+static void kmeans_anytime_gather( const host_kmeans_t *km, size_t n, uint64_t seed, float *out ) {
+   // one row picked at random from each of n equal strata, so the sample covers the whole input
+   // even when it is ordered
+   size_t rows = km->rows, cols = km->cols;
+   host_parallel_for(n, 1024, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+         size_t lo = i * rows / n, hi = (i + 1) * rows / n;
+         uint64_t h = seed + i * 0x9e3779b97f4a7c15ULL; // splitmix64
+         h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+         h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+         h ^= h >> 31;
+         memcpy(out + i * cols, km->data + (lo + h % (hi - lo)) * cols, sizeof(float) * cols);
+      }
+   }, "kmeans.anytime_gather");
+}
+
+int host_kmeans_run_deadline( host_kmeans_t *km, size_t maxiter, double budget_ms, unsigned int seed, host_kmeans_anytime_t *result ) {
+   HOST_PROFILE_SCOPE("kmeans.anytime");
+   anytime_clock::time_point start = anytime_clock::now();
+   size_t rows = km->rows, cols = km->cols, clusters = km->clusters;
+   memset(result, 0, sizeof(host_kmeans_anytime_t));
+
+   // the subsamples, only when the data is several times the size of the first
+   size_t first = std::max(KMEANS_ANYTIME_SAMPLE, 32 * clusters);
+   size_t largest = 0;
+   for (size_t n = first; n * KMEANS_ANYTIME_GROWTH <= rows; n *= KMEANS_ANYTIME_GROWTH) {
+      largest = n;
+   }
+   int initialised = 0;
+   if (largest > 0) {
+      float *sample = (float *)host_alloc(sizeof(float) * largest * cols);
+      if (sample == NULL) {
+         return 1;
+      }
+      double sample_budget = budget_ms * KMEANS_ANYTIME_SAMPLE_SHARE;
+      double row_ms = 0; // what assigning one row cost on the last subsample
+      for (size_t n = first; n <= largest; n *= KMEANS_ANYTIME_GROWTH) {
+         // with room left for this subsample's first pass and then one over every row
+         if (initialised && (anytime_ms(start) > sample_budget || anytime_ms(start) + row_ms * (n + rows) > budget_ms)) {
+            break;
+         }
+         kmeans_anytime_gather(km, n, seed + n, sample);
+         host_kmeans_t *sub = host_kmeans_create(sample, n, cols, clusters);
+         if (sub == NULL) {
+            host_free(sample);
+            return 1;
+         }
+         if (initialised) {
+            host_kmeans_set_centroids(sub, km->centroids);
+         } else {
+            host_kmeans_init_plusplus(sub, seed);
+         }
+         anytime_clock::time_point pass = anytime_clock::now();
+         size_t changes = host_kmeans_assign(sub);
+         row_ms = anytime_ms(pass) / n;
+         size_t iteration = 0;
+         while (iteration < maxiter && changes > n * KMEANS_ANYTIME_SETTLED && anytime_ms(start) + 2 * row_ms * n <= sample_budget) {
+            iteration++;
+            host_kmeans_update(sub);
+            changes = host_kmeans_assign(sub);
+         }
+         host_kmeans_set_centroids(km, sub->centroids);
+         host_kmeans_free(sub);
+         initialised = 1;
+         result->sample_iterations += iteration;
+         result->sample_rows = n;
+      }
+      host_free(sample);
+   }
+   if (!initialised) {
+      host_kmeans_init_plusplus(km, seed);
+   }
+
+   // the full data, keeping the best state (Lloyd's can't raise the inertia, but an indexed
+   // assignment is approximate and can)
+   float *best_centroids = (float *)host_alloc(sizeof(float) * clusters * cols);
+   size_t *best_map = (size_t *)host_alloc(sizeof(size_t) * rows);
+   if (best_centroids == NULL || best_map == NULL) {
+      host_free(best_centroids);
+      host_free(best_map);
+      return 1;
+   }
+   anytime_clock::time_point pass = anytime_clock::now();
+   size_t changes = host_kmeans_assign(km);
+   double pass_ms = anytime_ms(pass);
+   double best_inertia = km->inertia;
+   size_t best_changes = changes;
+   memcpy(best_centroids, km->centroids, sizeof(float) * clusters * cols);
+   memcpy(best_map, km->cluster_map, sizeof(size_t) * rows);
+   size_t iteration = 0;
+   while (iteration < maxiter && changes > 0) {
+      if (anytime_ms(start) + pass_ms > budget_ms) {
+         result->deadline_hit = 1;
+         break;
+      }
+      iteration++;
+      pass = anytime_clock::now();
+      host_kmeans_update(km);
+      changes = host_kmeans_assign(km);
+      pass_ms = anytime_ms(pass);
+      if (km->inertia <= best_inertia) {
+         best_inertia = km->inertia;
+         best_changes = changes;
+         memcpy(best_centroids, km->centroids, sizeof(float) * clusters * cols);
+         memcpy(best_map, km->cluster_map, sizeof(size_t) * rows);
+      }
+   }
+   if (km->inertia > best_inertia) {
+      host_kmeans_set_centroids(km, best_centroids);
+      memcpy(km->cluster_map, best_map, sizeof(size_t) * rows);
+      km->inertia = best_inertia;
+      changes = best_changes;
+   }
+   host_free(best_centroids);
+   host_free(best_map);
+
+   result->iterations = iteration;
+   result->changes = changes;
+   result->converged = changes == 0;
+   result->inertia = km->inertia;
+   result->elapsed_ms = anytime_ms(start);
+   return 0;
+}
@@ -0,0 +1,104 @@
+#include <atomic>
+#include <cstdio>
+#include <fcntl.h>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+
+// k-means run on a thread of its own, so the caller (a Perl event loop) carries on while it works.
+// The job initialises the centroids with k-means++ and then runs the same loop as host_kmeans_run,
+// publishing the iteration and the changes after each assignment.  Cancelling takes effect before
+// the next update, never between an update and its assignment, so the labels and centroids left
+// are always a matching pair (and there is always a first assignment).  When the run ends, one byte is written to a pipe, so the read end can be watched by an
+// event loop; the engine (labels and centroids) must not be touched until then.
+
+struct host_kmeans_job {
+   host_kmeans_t *km;
+   size_t maxiter;
+   unsigned int seed;
+   std::atomic<size_t> iteration{0}, changes{0};
+   std::atomic<int> cancel{0}, done{0}, cancelled{0}; // cancelled: the run stopped short
+   int pipe_fd[2] = { -1, -1 };
+   std::mutex join_lock;
+   std::thread thread;
+};
+
+static void kmeans_job_run( host_kmeans_job_t *job ) {
+   HOST_PROFILE_SCOPE("kmeans.job");
+   host_kmeans_t *km = job->km;
+   host_kmeans_init_plusplus(km, job->seed);
+   size_t iteration = 0; // not counting the first assignment as an iteration, as host_kmeans_run
+   size_t changes = host_kmeans_assign(km);
+   job->changes = changes;
+   while (iteration < job->maxiter && changes > 0 && !job->cancel) {
+      iteration++;
+      host_kmeans_update(km);
+      changes = host_kmeans_assign(km);
+      job->iteration = iteration;
+      job->changes = changes;
+   }
+   job->cancelled = job->cancel && changes > 0 && iteration < job->maxiter;
+   job->done = 1;
+   char byte = 1;
+   if (write(job->pipe_fd[1], &byte, 1) != 1) {
+      fprintf(stderr, "host_kmeans_start() : warning, failed to signal the end of the run.\n");
+   }
+}
+
+host_kmeans_job_t *host_kmeans_start( host_kmeans_t *km, size_t maxiter, unsigned int seed ) {
+   host_kmeans_job_t *job = new host_kmeans_job;
+   job->km = km;
+   job->maxiter = maxiter;
+   job->seed = seed;
+   if (pipe(job->pipe_fd) != 0) {
+      fprintf(stderr, "host_kmeans_start() : error, failed to create the completion pipe.\n");
+      delete job;
+      return NULL;
+   }
+   for (int fd : job->pipe_fd) {
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+   }
+   job->thread = std::thread(kmeans_job_run, job);
+   return job;
+}
+
+// 1 once the run has ended (converged, reached maxiter or was cancelled), 0 while it's going
+int host_kmeans_job_poll( host_kmeans_job_t *job, size_t *iteration, size_t *changes, int *cancelled ) {
+   int done = job->done;
+   *iteration = job->iteration;
+   *changes = job->changes;
+   *cancelled = job->cancelled;
+   return done;
+}
+
+void host_kmeans_job_cancel( host_kmeans_job_t *job ) {
+   job->cancel = 1;
+}
+
+// blocks until the run has ended, then returns 1 if it was cancelled
+int host_kmeans_job_wait( host_kmeans_job_t *job ) {
+   std::lock_guard<std::mutex> guard(job->join_lock);
+   if (job->thread.joinable()) {
+      job->thread.join();
+   }
+   return job->cancelled;
+}
+
+int host_kmeans_job_fd( const host_kmeans_job_t *job ) {
+   return job->pipe_fd[0];
+}
+
+void host_kmeans_job_free( host_kmeans_job_t *job ) {
+   if (job == NULL) {
+      return;
+   }
+   host_kmeans_job_cancel(job);
+   host_kmeans_job_wait(job);
+   close(job->pipe_fd[0]);
+   close(job->pipe_fd[1]);
+   delete job;
+}
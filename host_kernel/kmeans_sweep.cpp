@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "parallel.h"
+
+// k-means for a list of cluster counts over one packed copy of the data, scoring each result.
+// The K values are handed out to the worker threads one at a time, largest first as they take
+// longest; the k-means calls inside each run on their own thread (nested parallel_for calls run
+// inline), so the sweep scales with the number of K values rather than within each one.
+//
+// The silhouette is computed on a random sample of the rows, as its exact form is O(rows^2): the
+// sample and the distances between its points are shared by every K, only the labels differ.
+
+static float sweep_distance( const float *a, const float *b, size_t cols ) {
+   float d = 0;
+   #pragma omp simd reduction(+:d)
+   for (size_t c = 0; c < cols; c++) {
+      float diff = a[c] - b[c];
+      d += diff * diff;
+   }
+   return std::sqrt(d);
+}
+
+// the mean over the clusters of the worst (scatter_i + scatter_j) / distance(centroid_i, centroid_j),
+// scatter being the mean distance of a cluster's points to its centroid
+static double sweep_davies_bouldin( const host_kmeans_t *km ) {
+   size_t clusters = km->clusters, cols = km->cols;
+   std::vector<double> scatter(clusters, 0.0);
+   std::vector<size_t> count(clusters, 0);
+   for (size_t i = 0; i < km->rows; i++) {
+      size_t k = km->cluster_map[i];
+      scatter[k] += sweep_distance(km->data + i * cols, km->centroids + k * cols, cols);
+      count[k]++;
+   }
+   double sum = 0;
+   size_t used = 0;
+   for (size_t i = 0; i < clusters; i++) {
+      if (count[i] == 0) {
+         continue;
+      }
+      double worst = 0;
+      for (size_t j = 0; j < clusters; j++) {
+         if (j == i || count[j] == 0) {
+            continue;
+         }
+         double d = sweep_distance(km->centroids + i * cols, km->centroids + j * cols, cols);
+         double r = (scatter[i] / count[i] + scatter[j] / count[j]) / d; // inf for coincident centroids
+         worst = std::max(worst, r);
+      }
+      sum += worst;
+      used++;
+   }
+   return used < 2 ? std::numeric_limits<double>::quiet_NaN() : sum / used;
+}
+
+// mean silhouette of the sample points, from the sample's pairwise distances and their labels;
+// a point alone in its cluster (within the sample) scores 0
+static double sweep_silhouette( const std::vector<float> &pair, const std::vector<size_t> &labels, size_t clusters ) {
+   size_t n = labels.size();
+   if (n < 2) {
+      return std::numeric_limits<double>::quiet_NaN();
+   }
+   std::vector<double> sum(clusters);
+   std::vector<size_t> count(clusters);
+   double total = 0;
+   for (size_t i = 0; i < n; i++) {
+      std::fill(sum.begin(), sum.end(), 0.0);
+      std::fill(count.begin(), count.end(), 0);
+      for (size_t j = 0; j < n; j++) {
+         if (j != i) {
+            sum[labels[j]] += pair[i * n + j];
+            count[labels[j]]++;
+         }
+      }
+      size_t own = labels[i];
+      if (count[own] == 0) {
+         continue;
+      }
+      double a = sum[own] / count[own], b = std::numeric_limits<double>::infinity();
+      for (size_t k = 0; k < clusters; k++) {
+         if (k != own && count[k] > 0) {
+            b = std::min(b, sum[k] / count[k]);
+         }
+      }
+      if (std::isfinite(b) && std::max(a, b) > 0) {
+         total += (b - a) / std::max(a, b);
+      }
+   }
+   return total / n;
+}
+
+int host_kmeans_sweep( const float *data, size_t rows, size_t cols, const size_t *ks, size_t nks, size_t maxiter,
+                       unsigned int seed, size_t sample, host_kmeans_score_t *scores ) {
+   HOST_PROFILE_SCOPE("kmeans.sweep");
+   for (size_t t = 0; t < nks; t++) {
+      if (ks[t] < 1 || ks[t] > rows) {
+         fprintf(stderr, "host_kmeans_sweep() : error, can't make %zu clusters from %zu rows.\n", ks[t], rows);
+         return 1;
+      }
+   }
+
+   sample = std::min(sample, rows);
+   std::vector<size_t> picked(rows);
+   host_shuffle_index(picked.data(), rows, seed);
+   picked.resize(sample);
+   std::sort(picked.begin(), picked.end());
+   std::vector<float> pair(sample * sample, 0.0f);
+   host_parallel_for(sample, 16, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+         for (size_t j = 0; j < sample; j++) {
+            pair[i * sample + j] = sweep_distance(data + picked[i] * cols, data + picked[j] * cols, cols);
+         }
+      }
+   }, "kmeans.sweep_pairs");
+
+   std::vector<size_t> order(nks);
+   std::iota(order.begin(), order.end(), (size_t)0);
+   std::stable_sort(order.begin(), order.end(), [ks](size_t a, size_t b) { return ks[a] > ks[b]; });
+   std::vector<int> failed(nks, 0);
+   host_parallel_for(nks, 1, [&](size_t begin, size_t end) {
+      for (size_t t = begin; t < end; t++) {
+         size_t s = order[t], clusters = ks[s];
+         HOST_PROFILE_SCOPE("kmeans.sweep_k", (int)clusters);
+         host_kmeans_t *km = host_kmeans_create(data, rows, cols, clusters);
+         if (km == NULL) {
+            failed[s] = 1;
+            continue;
+         }
+         host_kmeans_init_plusplus(km, seed);
+         host_kmeans_score_t *score = scores + s;
+         score->clusters = clusters;
+         score->changes = host_kmeans_run(km, maxiter, &score->iterations);
+         score->inertia = km->inertia;
+         score->davies_bouldin = sweep_davies_bouldin(km);
+         std::vector<size_t> labels(sample);
+         for (size_t i = 0; i < sample; i++) {
+            labels[i] = km->cluster_map[picked[i]];
+         }
+         score->silhouette = sweep_silhouette(pair, labels, clusters);
+         host_kmeans_free(km);
+      }
+   }, "kmeans.sweep");
+   return std::accumulate(failed.begin(), failed.end(), 0) > 0;
+}
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "HostKernel.h"
+#include "parallel.h"
+
+// The allocator for the host buffers that never go to a device (those that do are pinned by the
+// GPU glue, and only those).  Every block is 64-byte aligned, for the SIMD loads and so no two
+// threads' rows share a cache line, and is returned zeroed.  A block of HOST_ALLOC_HUGE or more is
+// mapped on its own with huge pages (transparent ones by default, reserved ones with
+// ML_HUGE_PAGES=explicit, none with ML_HUGE_PAGES=0) so that scans over it don't miss the TLB on
+// every 4k page, and its pages are first touched by the worker threads, in the same contiguous
+// ranges the parallel loops hand out, so on a NUMA machine each lands on the node of a thread that
+// uses it.  A 64-byte header in front of each block keeps its size and how it was allocated.
+
+constexpr size_t HOST_ALLOC_ALIGN = 64;
+constexpr size_t HOST_ALLOC_HUGE = (size_t)2 << 20; // one x86 huge page, and where they start paying off
+
+typedef struct host_block {
+   size_t bytes;   // as asked for
+   size_t mapped;  // length of the mapping, 0 when it came from posix_memalign
+   void *base;     // start of the mapping or allocation
+   int huge;       // 1 = transparent huge pages advised, 2 = reserved (MAP_HUGETLB) huge pages
+} host_block_t;
+static_assert(sizeof(host_block_t) <= HOST_ALLOC_ALIGN, "host_block_t must fit in the alignment");
+
+static std::atomic<uint64_t> mem_allocations{0}, mem_frees{0}, mem_bytes_allocated{0}, mem_in_use{0}, mem_peak{0},
+                             mem_huge_bytes{0}, mem_mapped{0};
+
+static int huge_mode() {
+   // 0 = none, 1 = transparent, 2 = reserved, falling back to transparent
+   static const int mode = []() {
+      const char *value = getenv("ML_HUGE_PAGES");
+      if (value == NULL || *value == '\0') {
+         return 1;
+      }
+      return strcmp(value, "explicit") == 0 ? 2 : atoi(value) ? 1 : 0;
+   }();
+   return mode;
+}
+
+static host_block_t *block_of( void *p ) {
+   return (host_block_t *)((char *)p - HOST_ALLOC_ALIGN);
+}
+
+static void *map_block( size_t bytes ) {
+   size_t length = bytes + HOST_ALLOC_ALIGN;
+   void *base = MAP_FAILED;
+   int huge = 0;
+   if (huge_mode() == 2) {
+      size_t rounded = (length + HOST_ALLOC_HUGE - 1) / HOST_ALLOC_HUGE * HOST_ALLOC_HUGE;
+      base = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (base != MAP_FAILED) {
+         length = rounded;
+         huge = 2;
+      }
+   }
+   if (base == MAP_FAILED) { // none reserved, or not asked for
+      base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (base == MAP_FAILED) {
+         return NULL;
+      }
+      if (huge_mode() > 0 && madvise(base, length, MADV_HUGEPAGE) == 0) {
+         huge = 1;
+      }
+   }
+   // the mapping is already zero, writing one byte per page just decides which thread (and so
+   // which node) faults it in
+   static const size_t page = sysconf(_SC_PAGESIZE);
+   size_t step = huge == 2 ? HOST_ALLOC_HUGE : page;
+   size_t pages = (length + step - 1) / step;
+   char *c = (char *)base;
+   host_parallel_for(pages, std::max((size_t)1, HOST_ALLOC_HUGE / step), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+         c[i * step] = 0;
+      }
+   }, "memory.first_touch");
+   host_block_t *b = (host_block_t *)base;
+   b->mapped = length;
+   b->base = base;
+   b->huge = huge;
+   if (huge) {
+      mem_huge_bytes += bytes;
+   }
+   mem_mapped++;
+   return c + HOST_ALLOC_ALIGN;
+}
+
+void *host_alloc( size_t bytes ) {
+   void *p;
+   if (bytes >= HOST_ALLOC_HUGE) {
+      if ((p = map_block(bytes)) == NULL) {
+         fprintf(stderr, "host_alloc() : error, failed to map %zu bytes.\n", bytes);
+         return NULL;
+      }
+   } else {
+      void *base;
+      if (posix_memalign(&base, HOST_ALLOC_ALIGN, bytes + HOST_ALLOC_ALIGN) != 0) {
+         fprintf(stderr, "host_alloc() : error, failed to allocate %zu bytes.\n", bytes);
+         return NULL;
+      }
+      memset(base, 0, bytes + HOST_ALLOC_ALIGN);
+      host_block_t *b = (host_block_t *)base;
+      b->base = base;
+      p = (char *)base + HOST_ALLOC_ALIGN;
+   }
+   block_of(p)->bytes = bytes;
+   mem_allocations++;
+   mem_bytes_allocated += bytes;
+   uint64_t in_use = mem_in_use += bytes;
+   uint64_t peak = mem_peak;
+   while (in_use > peak && !mem_peak.compare_exchange_weak(peak, in_use)) {
+   }
+   return p;
+}
+
+void host_free( void *p ) {
+   if (p == NULL) {
+      return;
+   }
+   host_block_t *b = block_of(p);
+   mem_frees++;
+   mem_in_use -= b->bytes;
+   if (b->mapped) {
+      if (b->huge) {
+         mem_huge_bytes -= b->bytes;
+      }
+      mem_mapped--;
+      munmap(b->base, b->mapped);
+   } else {
+      free(b->base);
+   }
+}
+
+void *host_realloc( void *p, size_t bytes ) {
+   // a fresh block with the old contents, as realloc; what's beyond them is zero
+   if (p == NULL) {
+      return host_alloc(bytes);
+   }
+   size_t old = block_of(p)->bytes;
+   if (bytes <= old && (bytes >= HOST_ALLOC_HUGE) == (old >= HOST_ALLOC_HUGE)) {
+      return p; // shrinking within the same kind of block, keep it
+   }
+   void *q = host_alloc(bytes);
+   if (q == NULL) {
+      return NULL; // p is still valid, as realloc leaves it
+   }
+   memcpy(q, p, std::min(old, bytes));
+   host_free(p);
+   return q;
+}
+
+void host_memory_stats( host_memory_stats_t *stats ) {
+   stats->allocations = mem_allocations;
+   stats->frees = mem_frees;
+   stats->bytes_allocated = mem_bytes_allocated;
+   stats->bytes_in_use = mem_in_use;
+   stats->peak_bytes = mem_peak;
+   stats->huge_page_bytes = mem_huge_bytes;
+   stats->mapped_blocks = mem_mapped;
+}
@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "gemm.h"
+#include "parallel.h"
+
+// The feed forward network from MVKernels.c, on the CPU.  The layer and loss maths are the same
+// as the GPU kernels (sigmoid activations, quadratic or cross entropy loss, W = decay * W -
+// modifier * dW) but the batch is stored one row per sample, so the rows of a batch can be split
+// between the worker threads.  Each thread runs its rows through every layer and keeps its own
+// partial gradients, which are summed once the whole batch has been back propagated.  Small
+// batches are run as a whole, with the threads working on the GEMM tiles instead.
+
+constexpr size_t NETWORK_CHUNK_ROWS = 32;   // fewest rows worth giving a thread of their own
+constexpr size_t NETWORK_ELEMENT_GRAIN = 16384;
+
+static size_t network_chunk_grain( size_t rows ) {
+   size_t threads = host_get_threads();
+   if (threads <= 1 || rows < 2 * NETWORK_CHUNK_ROWS) {
+      return rows;
+   }
+   return std::max(NETWORK_CHUNK_ROWS, (rows + threads - 1) / threads);
+}
+
+host_network_t *host_network_create( size_t batch_size, int loss ) {
+   host_network_t *net = (host_network_t *)calloc(1, sizeof(host_network_t));
+   if (net == NULL) {
+      return NULL;
+   }
+   net->batch_size = batch_size;
+   net->loss = loss;
+   return net;
+}
+
+void host_network_free( host_network_t *net ) {
+   if (net == NULL) {
+      return;
+   }
+   for (size_t l = 0; l < net->layers; l++) {
+      host_layer_t *layer = &net->layer[l];
+      host_free(layer->weights);
+      host_free(layer->bias);
+      host_free(layer->weights_derivative);
+      host_free(layer->bias_derivative);
+      host_free(layer->activation);
+      host_free(layer->delta);
+   }
+   free(net->layer);
+   host_free(net->partials);
+   free(net);
+}
+
+int host_network_add_layer( host_network_t *net, size_t input_size, size_t output_size, const float *weights, const float *bias ) {
+   if (net->layers > 0 && net->layer[net->layers - 1].output_size != input_size) {
+      fprintf(stderr, "host_network_add_layer() : error, layer input size %zu does not match the previous output size %zu.\n",
+              input_size, net->layer[net->layers - 1].output_size);
+      return 1;
+   }
+   host_layer_t *layers = (host_layer_t *)realloc(net->layer, sizeof(host_layer_t) * (net->layers + 1));
+   if (layers == NULL) {
+      fprintf(stderr, "host_network_add_layer() : error, failed to allocate layer %zu.\n", net->layers);
+      return 1;
+   }
+   net->layer = layers;
+   host_layer_t *layer = &net->layer[net->layers];
+   memset(layer, 0, sizeof(host_layer_t));
+   layer->input_size = input_size;
+   layer->output_size = output_size;
+   layer->weights = (float *)host_alloc(sizeof(float) * output_size * input_size);
+   layer->bias = (float *)host_alloc(sizeof(float) * output_size);
+   layer->weights_derivative = (float *)host_alloc(sizeof(float) * output_size * input_size);
+   layer->bias_derivative = (float *)host_alloc(sizeof(float) * output_size);
+   layer->activation = (float *)host_alloc(sizeof(float) * net->batch_size * output_size);
+   layer->delta = (float *)host_alloc(sizeof(float) * net->batch_size * output_size);
+   net->layers++; // counted now so host_network_free releases whatever was allocated
+   if (layer->weights == NULL || layer->bias == NULL || layer->weights_derivative == NULL || layer->bias_derivative == NULL
+       || layer->activation == NULL || layer->delta == NULL) {
+      fprintf(stderr, "host_network_add_layer() : error, failed to allocate a %zu x %zu layer.\n", output_size, input_size);
+      return 1;
+   }
+   memcpy(layer->weights, weights, sizeof(float) * output_size * input_size);
+   memcpy(layer->bias, bias, sizeof(float) * output_size);
+   return 0;
+}
+
+int host_network_reserve( host_network_t *net, size_t rows ) {
+   if (rows <= net->batch_size) {
+      return 0;
+   }
+   for (size_t l = 0; l < net->layers; l++) {
+      host_layer_t *layer = &net->layer[l];
+      HOST_PROFILE_COUNT("bytes_allocated", 2 * sizeof(float) * (rows - net->batch_size) * layer->output_size);
+      float *activation = (float *)host_realloc(layer->activation, sizeof(float) * rows * layer->output_size);
+      if (activation != NULL) {
+         layer->activation = activation;
+      }
+      float *delta = (float *)host_realloc(layer->delta, sizeof(float) * rows * layer->output_size);
+      if (delta != NULL) {
+         layer->delta = delta;
+      }
+      if (activation == NULL || delta == NULL) {
+         fprintf(stderr, "host_network_reserve() : error, failed to allocate for a batch of %zu rows.\n", rows);
+         return 1;
+      }
+   }
+   net->batch_size = rows;
+   return 0;
+}
+
+static void network_forward_rows( host_network_t *net, const float *x, size_t begin, size_t end ) {
+   const float *input = x + begin * net->layer[0].input_size;
+   for (size_t l = 0; l < net->layers; l++) {
+      HOST_PROFILE_SCOPE("nn.forward", (int)l);
+      host_layer_t *layer = &net->layer[l];
+      float *output = layer->activation + begin * layer->output_size;
+      gemm_bias_sigmoid(1, end - begin, layer->output_size, layer->input_size, input, layer->input_size,
+                        layer->weights, layer->input_size, layer->bias, output, layer->output_size);
+      input = output;
+   }
+}
+
+int host_network_forward( host_network_t *net, const float *x, size_t rows ) {
+   if (host_network_reserve(net, rows) != 0) {
+      return 1;
+   }
+   net->rows = rows;
+   size_t grain = network_chunk_grain(rows);
+   if (grain >= rows) {
+      network_forward_rows(net, x, 0, rows);
+   } else {
+      host_parallel_for(rows, grain, [&](size_t begin, size_t end) {
+         network_forward_rows(net, x, begin, end);
+      }, "nn.forward");
+   }
+   return 0;
+}
+
+double host_network_cost( const host_network_t *net, const float *y ) {
+   const host_layer_t *last = &net->layer[net->layers - 1];
+   size_t n = net->rows * last->output_size;
+   const float *a = last->activation;
+   double sum = 0;
+   for (size_t i = 0; i < n; i++) {
+      if (net->loss == 2) { // cross entropy, treating log(0) as 0 as gpu_cle_cost does
+         float arg1 = a[i] > 0 ? logf(a[i]) : 0;
+         float arg2 = (1 - a[i]) > 0 ? logf(1 - a[i]) : 0;
+         sum += -y[i] * arg1 - (1 - y[i]) * arg2;
+      } else {
+         sum += (a[i] - y[i]) * (a[i] - y[i]) / 2;
+      }
+   }
+   return sum;
+}
+
+double host_network_weights_cost( const host_network_t *net ) {
+   double sum = 0;
+   for (size_t l = 0; l < net->layers; l++) {
+      const host_layer_t *layer = &net->layer[l];
+      size_t n = layer->output_size * layer->input_size;
+      float part = 0;
+      #pragma omp simd reduction(+:part)
+      for (size_t i = 0; i < n; i++) {
+         part += layer->weights[i] * layer->weights[i];
+      }
+      sum += part;
+   }
+   return sum;
+}
+
+void host_network_cost_derivative( host_network_t *net, const float *y ) {
+   host_layer_t *last = &net->layer[net->layers - 1];
+   const float *a = last->activation;
+   float *d = last->delta;
+   int cel = net->loss == 2;
+   host_parallel_for(net->rows * last->output_size, NETWORK_ELEMENT_GRAIN, [&](size_t begin, size_t end) {
+      if (cel) {
+         #pragma omp simd
+         for (size_t i = begin; i < end; i++) {
+            d[i] = a[i] - y[i];
+         }
+      } else {
+         #pragma omp simd
+         for (size_t i = begin; i < end; i++) {
+            d[i] = (a[i] - y[i]) * (a[i] * (1 - a[i]));
+         }
+      }
+   }, "nn.cost_derivative");
+}
+
+static size_t network_gradient_size( const host_network_t *net ) {
+   size_t size = 0;
+   for (size_t l = 0; l < net->layers; l++) {
+      size += net->layer[l].output_size * (net->layer[l].input_size + 1);
+   }
+   return size;
+}
+
+// back propagate rows [begin, end) and write the gradients of just those rows to grad, which
+// holds each layer's weights derivative followed by its bias derivative, or when grad is NULL,
+// straight into the layers' own derivatives
+static void network_backprop_rows( host_network_t *net, const float *x, size_t begin, size_t end, float *grad ) {
+   size_t rows = end - begin;
+   for (size_t l = net->layers; l-- > 0;) {
+      HOST_PROFILE_SCOPE("nn.backward", (int)l);
+      host_layer_t *layer = &net->layer[l];
+      size_t out = layer->output_size, in = layer->input_size;
+      const float *delta = layer->delta + begin * out;
+      if (l + 1 < net->layers) {
+         // delta = (delta(next) x W(next)) * sigmoid'(activation)
+         host_layer_t *next = &net->layer[l + 1];
+         gemm_sigmoid_prime(rows, out, next->output_size, next->delta + begin * next->output_size, next->output_size,
+                            next->weights, out, layer->activation + begin * out, out,
+                            layer->delta + begin * out, out);
+      }
+      const float *input = (l == 0) ? x + begin * in : net->layer[l - 1].activation + begin * in;
+      float *dw = grad ? grad : layer->weights_derivative;
+      float *db = grad ? grad + out * in : layer->bias_derivative;
+      host_sgemm(1, 0, out, in, rows, 1.0f, delta, out, input, in, 0.0f, dw, in);
+      std::fill(db, db + out, 0.0f);
+      for (size_t i = 0; i < rows; i++) {
+         #pragma omp simd
+         for (size_t j = 0; j < out; j++) {
+            db[j] += delta[i * out + j];
+         }
+      }
+      if (grad) {
+         grad += out * (in + 1);
+      }
+   }
+}
+
+int host_network_backprop( host_network_t *net, const float *x ) {
+   size_t rows = net->rows;
+   size_t grain = network_chunk_grain(rows);
+   if (grain >= rows) {
+      network_backprop_rows(net, x, 0, rows, NULL);
+      return 0;
+   }
+   size_t chunks = (rows + grain - 1) / grain;
+   size_t size = network_gradient_size(net);
+   if (chunks > net->partials_chunks) {
+      float *partials = (float *)host_realloc(net->partials, sizeof(float) * size * chunks);
+      if (partials == NULL) {
+         fprintf(stderr, "host_network_backprop() : error, failed to allocate gradients for %zu threads.\n", chunks);
+         return 1;
+      }
+      net->partials = partials;
+      net->partials_chunks = chunks;
+   }
+   host_parallel_for(rows, grain, [&](size_t begin, size_t end) {
+      network_backprop_rows(net, x, begin, end, net->partials + (begin / grain) * size);
+   }, "nn.backward");
+   // sum the partial gradients into the layers, in the same (last layer first) order
+   HOST_PROFILE_SCOPE("nn.reduce_gradients");
+   size_t offset = 0;
+   for (size_t l = net->layers; l-- > 0;) {
+      host_layer_t *layer = &net->layer[l];
+      size_t nw = layer->output_size * layer->input_size;
+      host_parallel_for(nw + layer->output_size, NETWORK_ELEMENT_GRAIN, [&](size_t begin, size_t end) {
+         for (size_t i = begin; i < end; i++) {
+            float sum = 0;
+            for (size_t c = 0; c < chunks; c++) {
+               sum += net->partials[c * size + offset + i];
+            }
+            if (i < nw) {
+               layer->weights_derivative[i] = sum;
+            } else {
+               layer->bias_derivative[i - nw] = sum;
+            }
+         }
+      }, "nn.reduce_gradients");
+      offset += nw + layer->output_size;
+   }
+   return 0;
+}
+
+void host_network_update( host_network_t *net, float modifier, float decay ) {
+   HOST_PROFILE_SCOPE("nn.update");
+   for (size_t l = 0; l < net->layers; l++) {
+      host_layer_t *layer = &net->layer[l];
+      float *w = layer->weights, *dw = layer->weights_derivative;
+      host_parallel_for(layer->output_size * layer->input_size, NETWORK_ELEMENT_GRAIN, [&](size_t begin, size_t end) {
+         #pragma omp simd
+         for (size_t i = begin; i < end; i++) {
+            w[i] = decay * w[i] - modifier * dw[i];
+         }
+      }, "nn.update");
+      for (size_t j = 0; j < layer->output_size; j++) {
+         layer->bias[j] -= modifier * layer->bias_derivative[j];
+      }
+   }
+}
+
+void host_network_zero_derivatives( host_network_t *net ) {
+   for (size_t l = 0; l < net->layers; l++) {
+      host_layer_t *layer = &net->layer[l];
+      memset(layer->weights_derivative, 0, sizeof(float) * layer->output_size * layer->input_size);
+      memset(layer->bias_derivative, 0, sizeof(float) * layer->output_size);
+   }
+}
+
+void host_shuffle_index( size_t *index, size_t n, unsigned long long seed ) {
+   std::iota(index, index + n, (size_t)0);
+   std::mt19937_64 gen(seed);
+   std::shuffle(index, index + n, gen);
+}
+
+void host_gather_rows( const float *src, size_t cols, const size_t *index, size_t count, float *dst ) {
+   host_parallel_for(count, std::max((size_t)1, NETWORK_ELEMENT_GRAIN / std::max((size_t)1, cols)), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+         memcpy(dst + i * cols, src + index[i] * cols, sizeof(float) * cols);
+      }
+   }, "gather_rows");
+}
+
+int host_network_train_epoch( host_network_t *net, const float *x, const float *y, size_t n, const size_t *order,
+                              size_t batch_size, float eta, float decay ) {
+   if (batch_size == 0) {
+      fprintf(stderr, "host_network_train_epoch() : error, the batch size must be at least 1.\n");
+      return 1;
+   }
+   size_t insize = net->layer[0].input_size, outsize = net->layer[net->layers - 1].output_size;
+   std::vector<float> batch_x(batch_size * insize), batch_y(batch_size * outsize);
+   for (size_t b = 0; b < n; b += batch_size) {
+      size_t rows = std::min(batch_size, n - b);
+      host_gather_rows(x, insize, order + b, rows, batch_x.data());
+      host_gather_rows(y, outsize, order + b, rows, batch_y.data());
+      if (host_network_forward(net, batch_x.data(), rows) != 0) {
+         return 1;
+      }
+      host_network_cost_derivative(net, batch_y.data());
+      if (host_network_backprop(net, batch_x.data()) != 0) {
+         return 1;
+      }
+      host_network_update(net, eta / rows, decay);
+   }
+   return 0;
+}
+
+int host_network_evaluate( host_network_t *net, const float *x, const float *y, size_t n, size_t batch_size,
+                           double *cost, size_t *correct ) {
+   if (batch_size == 0) {
+      fprintf(stderr, "host_network_evaluate() : error, the batch size must be at least 1.\n");
+      return 1;
+   }
+   size_t insize = net->layer[0].input_size, outsize = net->layer[net->layers - 1].output_size;
+   *cost = 0;
+   *correct = 0;
+   for (size_t b = 0; b < n; b += batch_size) {
+      size_t rows = std::min(batch_size, n - b);
+      if (host_network_forward(net, x + b * insize, rows) != 0) {
+         return 1;
+      }
+      const float *target = y + b * outsize;
+      *cost += host_network_cost(net, target);
+      const float *a = net->layer[net->layers - 1].activation;
+      for (size_t i = 0; i < rows; i++) { // first maximum wins, as in ML::MVKernels::argmax
+         size_t guess = 0, actual = 0;
+         for (size_t j = 1; j < outsize; j++) {
+            if (a[i * outsize + j] > a[i * outsize + guess]) guess = j;
+            if (target[i * outsize + j] > target[i * outsize + actual]) actual = j;
+         }
+         if (guess == actual) {
+            (*correct)++;
+         }
+      }
+   }
+   return 0;
+}
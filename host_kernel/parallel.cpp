@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "parallel.h"
+
+// One pool of host_get_threads() - 1 workers, started on first use and restarted when the size or
+// affinity changes.  Each host_parallel_for call posts a job whose chunks are split into one
+// contiguous range per thread that may take part (the caller owns the first).  A thread runs
+// chunks from the front of its own range and, once it is empty, steals the back half of the
+// largest range left, so a thread that is late to join (busy with another caller's job) or slow
+// costs nothing but its share being run elsewhere.  Jobs from different callers (the k-means job
+// thread, the PCA stream's producer, the Perl thread) run side by side on the same workers.
+
+// set from the Perl thread, read from any thread that posts a job (the k-means job thread too)
+static std::atomic<int> host_threads{0};   // 0 = not set, use ML_THREADS or else the hardware concurrency
+static std::atomic<int> host_affinity{-1}; // -1 = not set, use ML_THREAD_AFFINITY
+static thread_local bool host_in_parallel = false; // nested calls run on the calling worker
+
+typedef struct pool_slot {
+   std::mutex lock;
+   size_t begin = 0, end = 0; // chunks not yet taken
+   uint64_t busy_ns = 0;      // time spent in fn, when profiling
+} pool_slot_t;
+
+typedef struct pool_job {
+   size_t n, grain, slots;
+   const std::function<void(size_t, size_t)> *fn;
+   std::unique_ptr<pool_slot_t[]> slot;
+   size_t next_slot = 1; // under pool_lock, as are the two below; slot 0 is the caller's
+   int inside = 0;       // workers running the job
+   int joined = 0;
+   std::atomic<size_t> steals{0};
+   bool timed;
+} pool_job_t;
+
+typedef struct pool {
+   std::mutex lock;
+   std::condition_variable wake, done;
+   std::vector<pool_job_t *> jobs; // posted and still taking workers
+   std::vector<std::thread> workers;
+   std::atomic<size_t> started{0}; // workers.size(), readable without a lock
+   bool stop = false;
+} pool_t;
+
+// never freed: the workers are left running at exit rather than joined during static destruction,
+// and after a fork the child's copy is abandoned for a fresh one (its threads didn't come along)
+static pool_t *host_pool = new pool_t;
+static std::mutex pool_start_lock;
+
+static int env_int( const char *name, int dflt ) {
+   const char *value = getenv(name);
+   return value != NULL && *value ? atoi(value) : dflt;
+}
+
+static void pool_stop() {
+   std::lock_guard<std::mutex> start(pool_start_lock);
+   pool_t *p = host_pool;
+   {
+      std::lock_guard<std::mutex> guard(p->lock);
+      p->stop = true;
+   }
+   p->wake.notify_all();
+   for (auto &t : p->workers) {
+      t.join();
+   }
+   p->workers.clear();
+   p->started = 0;
+   p->stop = false;
+}
+
+void host_set_threads( int threads ) {
+   // between runs: the workers finish the jobs they are in, then exit and are restarted at the new size
+   host_threads.store(threads > 0 ? threads : 0, std::memory_order_relaxed);
+   pool_stop();
+}
+
+int host_get_threads() {
+   int set = host_threads.load(std::memory_order_relaxed);
+   if (set > 0) {
+      return set;
+   }
+   static const int threads = env_int("ML_THREADS", 0);
+   if (threads > 0) {
+      return threads;
+   }
+   static const int hw = (int)std::thread::hardware_concurrency(); // reads /sys, so only once
+   return hw > 0 ? hw : 1;
+}
+
+void host_set_affinity( int on ) {
+   host_affinity.store(on ? 1 : 0, std::memory_order_relaxed);
+   pool_stop();
+}
+
+static void pool_pin( size_t id ) {
+   // worker id goes on the id-th CPU this process may use; the calling threads are left alone
+   cpu_set_t allowed, one;
+   if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+      return;
+   }
+   int cpus = CPU_COUNT(&allowed);
+   if (cpus <= 0) {
+      return;
+   }
+   size_t nth = id % cpus;
+   for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed) && nth-- == 0) {
+         CPU_ZERO(&one);
+         CPU_SET(cpu, &one);
+         pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+         return;
+      }
+   }
+}
+
+static bool pool_take( pool_job_t *job, size_t s, size_t *chunk ) {
+   pool_slot_t &own = job->slot[s];
+   std::lock_guard<std::mutex> guard(own.lock);
+   if (own.begin == own.end) {
+      return false;
+   }
+   *chunk = own.begin++;
+   return true;
+}
+
+static bool pool_steal( pool_job_t *job, size_t s, size_t *chunk ) {
+   for (;;) {
+      size_t victim = s, most = 0;
+      for (size_t v = 0; v < job->slots; v++) {
+         if (v == s) {
+            continue;
+         }
+         std::lock_guard<std::mutex> guard(job->slot[v].lock);
+         size_t left = job->slot[v].end - job->slot[v].begin;
+         if (left > most) {
+            most = left;
+            victim = v;
+         }
+      }
+      if (victim == s) {
+         return false;
+      }
+      size_t begin, end;
+      {
+         pool_slot_t &v = job->slot[victim];
+         std::lock_guard<std::mutex> guard(v.lock);
+         if (v.begin == v.end) {
+            continue; // taken meanwhile, look again
+         }
+         end = v.end;
+         begin = v.end - (v.end - v.begin + 1) / 2;
+         v.end = begin;
+      }
+      job->steals.fetch_add(1, std::memory_order_relaxed);
+      *chunk = begin;
+      if (end - begin > 1) {
+         pool_slot_t &own = job->slot[s];
+         std::lock_guard<std::mutex> guard(own.lock);
+         own.begin = begin + 1;
+         own.end = end;
+      }
+      return true;
+   }
+}
+
+static void pool_run( pool_job_t *job, size_t s ) {
+   size_t chunk;
+   uint64_t busy = 0;
+   while (pool_take(job, s, &chunk) || pool_steal(job, s, &chunk)) {
+      size_t begin = chunk * job->grain;
+      uint64_t start = job->timed ? host_profile_now() : 0;
+      (*job->fn)(begin, std::min(begin + job->grain, job->n));
+      if (job->timed) {
+         busy += host_profile_now() - start;
+      }
+   }
+   job->slot[s].busy_ns = busy;
+}
+
+static void pool_worker( pool_t *p, size_t id, bool pin ) {
+   if (pin) {
+      pool_pin(id);
+   }
+   host_in_parallel = true;
+   std::unique_lock<std::mutex> guard(p->lock);
+   for (;;) {
+      pool_job_t *job = NULL;
+      p->wake.wait(guard, [&]() {
+         for (auto *j : p->jobs) {
+            if (j->next_slot < j->slots) {
+               job = j;
+               return true;
+            }
+         }
+         return p->stop;
+      });
+      if (job == NULL) {
+         return;
+      }
+      size_t s = job->next_slot++;
+      job->inside++;
+      job->joined++;
+      guard.unlock();
+      pool_run(job, s);
+      guard.lock();
+      if (--job->inside == 0) {
+         p->done.notify_all();
+      }
+   }
+}
+
+static void pool_after_fork() {
+   host_pool = new pool_t;
+}
+
+static pool_t *pool_start( size_t threads ) {
+   pool_t *p = host_pool;
+   if (p->started + 1 >= threads) {
+      return p;
+   }
+   std::lock_guard<std::mutex> start(pool_start_lock);
+   p = host_pool;
+   static std::once_flag atfork;
+   std::call_once(atfork, []() { pthread_atfork(NULL, NULL, pool_after_fork); });
+   int expected = -1;
+   host_affinity.compare_exchange_strong(expected, env_int("ML_THREAD_AFFINITY", 0) ? 1 : 0, std::memory_order_relaxed);
+   bool pinned = host_affinity.load(std::memory_order_relaxed) == 1;
+   std::lock_guard<std::mutex> guard(p->lock);
+   for (size_t id = p->workers.size() + 1; id < threads; id++) {
+      p->workers.emplace_back(pool_worker, p, id, pinned);
+   }
+   p->started = p->workers.size();
+   return p;
+}
+
+void host_parallel_for( size_t n, size_t grain, const std::function<void(size_t, size_t)> &fn, const char *task ) {
+   if (n == 0) {
+      return;
+   }
+   if (grain == 0) {
+      grain = 1;
+   }
+   size_t chunks = (n + grain - 1) / grain;
+   size_t threads = host_get_threads();
+   size_t slots = std::min(threads, chunks);
+   if (slots <= 1 || host_in_parallel) {
+      for (size_t begin = 0; begin < n; begin += grain) {
+         fn(begin, std::min(begin + grain, n));
+      }
+      return;
+   }
+   pool_t *p = pool_start(threads);
+   pool_job_t job;
+   job.n = n;
+   job.grain = grain;
+   job.slots = slots;
+   job.fn = &fn;
+   job.timed = host_profile_enabled() != 0;
+   job.slot.reset(new pool_slot_t[slots]);
+   for (size_t s = 0; s < slots; s++) {
+      job.slot[s].begin = chunks * s / slots;
+      job.slot[s].end = chunks * (s + 1) / slots;
+   }
+   uint64_t start = job.timed ? host_profile_now() : 0;
+   {
+      std::lock_guard<std::mutex> guard(p->lock);
+      p->jobs.push_back(&job);
+   }
+   for (size_t s = 1; s < slots; s++) {
+      p->wake.notify_one();
+   }
+   host_in_parallel = true;
+   pool_run(&job, 0);
+   host_in_parallel = false;
+   {
+      // no more workers join once it's off the list, then wait for those still running chunks
+      std::unique_lock<std::mutex> guard(p->lock);
+      p->jobs.erase(std::find(p->jobs.begin(), p->jobs.end(), &job));
+      p->done.wait(guard, [&]() { return job.inside == 0; });
+   }
+   if (job.timed) {
+      uint64_t busy = 0, max_busy = 0;
+      for (size_t s = 0; s < slots; s++) {
+         busy += job.slot[s].busy_ns;
+         max_busy = std::max(max_busy, job.slot[s].busy_ns);
+      }
+      host_profile_record_task(task, host_profile_now() - start, busy, max_busy, slots, job.joined + 1, job.steals);
+   }
+}
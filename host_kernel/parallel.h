@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// The host worker pool, one set of threads for the whole process shared by every native routine,
+// so PCA, k-means and the loaders running at the same time don't each start their own.
+//
+// host_parallel_for hands out [0, n) in chunks of "grain" items.  fn(begin, end) is called once
+// per chunk; the calling thread takes part too, and idle threads steal chunks from busy ones.  A
+// call made from inside fn runs its chunks in order on that thread rather than going to the pool.
+// "task" names the loop in the profile (ML::Profile) along with its utilisation and imbalance.
+void host_parallel_for( size_t n, size_t grain, const std::function<void(size_t, size_t)> &fn, const char *task = "parallel" );
+
+// map(begin, end) gives each chunk's value and combine(a, b) folds them, always in chunk order,
+// so the result doesn't depend on the number of threads or which of them ran what
+template <typename T, typename Map, typename Combine>
+T host_parallel_reduce( size_t n, size_t grain, T init, Map map, Combine combine, const char *task = "parallel" ) {
+   if (grain == 0) {
+      grain = 1;
+   }
+   std::vector<T> partial((n + grain - 1) / grain, init);
+   host_parallel_for(n, grain, [&](size_t begin, size_t end) {
+      partial[begin / grain] = map(begin, end);
+   }, task);
+   for (const T &p : partial) {
+      init = combine(init, p);
+   }
+   return init;
+}
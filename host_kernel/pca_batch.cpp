@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "eigen.h"
+#include "parallel.h"
+
+// PCA of many small independent datasets (e.g. tens of thousands of 200 x 12 segments) in one
+// call.  Each dataset is standardised, its covariance formed and decomposed, and it is projected,
+// all by one thread in its own small buffers, and the datasets are spread across the threads.
+// The calculation is the one the device path makes (stddev over rows - 1, covariance over rows,
+// a column of zeros where the stddev is 0, and the sign of each component from
+// gpu_eigenvector_signs), with the components in order of variance.
+
+constexpr size_t PCA_BATCH_GRAIN = 16; // datasets per work item
+
+typedef struct pca_batch_scratch {
+   std::vector<double> means, stddev, cov, vectors, values;
+   std::vector<float> z;
+} pca_batch_scratch_t;
+
+static void pca_batch_one( const float *x, size_t rows, size_t cols, size_t k, float *out, pca_batch_scratch_t &s ) {
+   s.means.assign(cols, 0.0);
+   s.stddev.assign(cols, 0.0);
+   s.cov.assign(cols * cols, 0.0);
+   s.vectors.resize(cols * cols);
+   s.values.resize(cols);
+   s.z.resize(rows * cols);
+   for (size_t i = 0; i < rows; i++) {
+      for (size_t c = 0; c < cols; c++) {
+         s.means[c] += x[i * cols + c];
+      }
+   }
+   for (size_t c = 0; c < cols; c++) {
+      s.means[c] /= rows;
+   }
+   for (size_t i = 0; i < rows; i++) {
+      for (size_t c = 0; c < cols; c++) {
+         double d = x[i * cols + c] - s.means[c];
+         s.stddev[c] += d * d;
+      }
+   }
+   for (size_t c = 0; c < cols; c++) {
+      s.stddev[c] = rows > 1 ? std::sqrt(s.stddev[c] / (rows - 1)) : 0;
+   }
+   for (size_t i = 0; i < rows; i++) {
+      float *z = s.z.data() + i * cols;
+      for (size_t c = 0; c < cols; c++) {
+         z[c] = s.stddev[c] == 0 ? 0.0f : (float)((x[i * cols + c] - s.means[c]) / s.stddev[c]);
+      }
+      // the upper triangle, mirrored below
+      for (size_t a = 0; a < cols; a++) {
+         double za = z[a];
+         double *ca = s.cov.data() + a * cols;
+         for (size_t b = a; b < cols; b++) {
+            ca[b] += za * z[b];
+         }
+      }
+   }
+   for (size_t a = 0; a < cols; a++) {
+      for (size_t b = a; b < cols; b++) {
+         s.cov[a * cols + b] /= rows;
+         s.cov[b * cols + a] = s.cov[a * cols + b];
+      }
+   }
+   host_symmetric_eigen(s.cov.data(), cols, s.vectors.data(), s.values.data());
+   for (size_t j = 0; j < k; j++) {
+      double *v = s.vectors.data() + j * cols;
+      double sum = 0;
+      for (size_t c = 0; c < cols; c++) {
+         sum += v[c];
+      }
+      if (sum < 1) {
+         for (size_t c = 0; c < cols; c++) {
+            v[c] = -v[c];
+         }
+      }
+   }
+   for (size_t i = 0; i < rows; i++) {
+      const float *z = s.z.data() + i * cols;
+      for (size_t j = 0; j < k; j++) {
+         const double *v = s.vectors.data() + j * cols;
+         double p = 0;
+         for (size_t c = 0; c < cols; c++) {
+            p += z[c] * v[c];
+         }
+         out[i * k + j] = (float)p;
+      }
+   }
+}
+
+int host_pca_batch( const float *data, const size_t *rows, const size_t *cols, size_t count, size_t k, float *out ) {
+   HOST_PROFILE_SCOPE("pca.batch");
+   if (k == 0) {
+      fprintf(stderr, "host_pca_batch() : error, no components requested.\n");
+      return 1;
+   }
+   // where each dataset starts, in data and in out
+   std::vector<size_t> in_at(count + 1, 0), out_at(count + 1, 0);
+   for (size_t d = 0; d < count; d++) {
+      if (rows[d] == 0 || cols[d] == 0) {
+         fprintf(stderr, "host_pca_batch() : error, dataset %zu is empty.\n", d);
+         return 1;
+      }
+      in_at[d + 1] = in_at[d] + rows[d] * cols[d];
+      out_at[d + 1] = out_at[d] + rows[d] * std::min(k, cols[d]);
+   }
+   host_parallel_for(count, PCA_BATCH_GRAIN, [&](size_t begin, size_t end) {
+      pca_batch_scratch_t scratch;
+      for (size_t d = begin; d < end; d++) {
+         pca_batch_one(data + in_at[d], rows[d], cols[d], std::min(k, cols[d]), out + out_at[d], scratch);
+      }
+   }, "pca.batch");
+   return 0;
+}
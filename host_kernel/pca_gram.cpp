@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "eigen.h"
+#include "parallel.h"
+
+// PCA of wide data (many more columns than rows) through the rows x rows Gram matrix rather than
+// the cols x cols covariance.  With Z the standardised rows x cols data, C = Zt x Z / rows and
+// G = Z x Zt / rows have the same non-zero eigenvalues, and if G u = l u then Zt u is an
+// eigenvector of C with length sqrt(rows l).  So G, which is small, is decomposed (in double, by
+// host_symmetric_eigen) and the principal axes are recovered with one rows x cols product; memory
+// and time go with the rows.
+
+int host_pca_gram( const float *z, size_t rows, size_t cols, size_t k, float *components, float *values ) {
+   HOST_PROFILE_SCOPE("pca.gram");
+   if (rows == 0 || k == 0 || k > rows) {
+      fprintf(stderr, "host_pca_gram() : error, can't find %zu components from %zu rows.\n", k, rows);
+      return 1;
+   }
+   size_t n = rows;
+   std::vector<float> gram(n * n);
+   HOST_PROFILE_BEGIN(product, "pca.gram_product");
+   host_sgemm(0, 1, n, n, cols, 1.0f / rows, z, cols, z, cols, 0.0f, gram.data(), n); // same 1 / rows as the covariance
+   HOST_PROFILE_END(product);
+   HOST_PROFILE_COUNT("bytes_allocated", sizeof(float) * n * n + sizeof(double) * n * n * 2);
+
+   HOST_PROFILE_BEGIN(eigen, "pca.gram_eigen");
+   std::vector<double> g(n * n), vectors(n * n), values_d(n);
+   for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+         g[i * n + j] = 0.5 * ((double)gram[i * n + j] + gram[j * n + i]); // exactly symmetric
+      }
+   }
+   host_symmetric_eigen(g.data(), n, vectors.data(), values_d.data());
+   HOST_PROFILE_END(eigen);
+
+   // the k largest, as a rows x k block of u / sqrt(rows l) so the product gives unit vectors.
+   // G was summed in float, so an eigenvalue within a few float roundings of the largest is noise
+   double floor = std::max(values_d[0], 0.0) * 8 * std::numeric_limits<float>::epsilon();
+   std::vector<float> u(n * k, 0.0f);
+   for (size_t j = 0; j < k; j++) {
+      double l = values_d[j];
+      values[j] = (float)std::max(l, 0.0);
+      if (l <= floor) { // beyond the rank of the data (centring removes one), no direction to recover
+         continue;
+      }
+      double scale = 1.0 / std::sqrt(rows * l);
+      const double *uj = vectors.data() + j * n;
+      for (size_t i = 0; i < n; i++) {
+         u[i * k + j] = (float)(uj[i] * scale);
+      }
+   }
+   HOST_PROFILE_BEGIN(recover, "pca.gram_recover");
+   host_sgemm(1, 0, cols, k, n, 1.0f, z, cols, u.data(), k, 0.0f, components, k);
+   HOST_PROFILE_END(recover);
+
+   // the same sign convention as gpu_eigenvector_signs: a component summing to less than 1 is negated
+   std::vector<double> sums = host_parallel_reduce(cols, 4096, std::vector<double>(k, 0.0), [&](size_t begin, size_t end) {
+      std::vector<double> s(k, 0.0);
+      for (size_t c = begin; c < end; c++) {
+         for (size_t j = 0; j < k; j++) {
+            s[j] += components[c * k + j];
+         }
+      }
+      return s;
+   }, [](std::vector<double> a, const std::vector<double> &b) {
+      for (size_t j = 0; j < a.size(); j++) {
+         a[j] += b[j];
+      }
+      return a;
+   }, "pca.gram_signs");
+   host_parallel_for(cols, 4096, [&](size_t begin, size_t end) {
+      for (size_t c = begin; c < end; c++) {
+         for (size_t j = 0; j < k; j++) {
+            if (sums[j] < 1) {
+               components[c * k + j] = -components[c * k + j];
+            }
+         }
+      }
+   }, "pca.gram_signs");
+   return 0;
+}
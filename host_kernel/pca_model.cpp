@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "parallel.h"
+
+// Standardising and projecting is folded into a single affine map:
+//    out[j] = sum_c ((x[c] - mean[c]) / stddev[c]) * W[c][j]
+//           = sum_c x[c] * (W[c][j] / stddev[c]) - sum_c (mean[c] / stddev[c]) * W[c][j]
+// so transform is one GEMM (or a set of dot products for small k) plus a bias per component.
+// Columns with a stddev of 0 contribute nothing, as in gpu_assign_z_scores.
+
+static const char PCA_MODEL_MAGIC[4] = { 'P', 'C', 'A', 'M' };
+static const uint32_t PCA_MODEL_VERSION = 1;
+
+constexpr size_t PCA_TRANSFORM_ROWS = 256; // rows per work item
+constexpr size_t PCA_GEMM_MIN_K = 16;      // below this the dot product path is quicker
+
+static void pca_model_prepare( host_pca_model_t *model ) {
+   size_t cols = model->cols, k = model->k;
+   for (size_t j = 0; j < k; j++) {
+      double offset = 0;
+      for (size_t c = 0; c < cols; c++) {
+         float w = 0;
+         if (model->stddev[c] != 0) {
+            w = model->components[c * k + j] / model->stddev[c];
+         }
+         model->scaled[j * cols + c] = w;
+         offset -= (double)model->means[c] * w;
+      }
+      model->offset[j] = (float)offset;
+   }
+}
+
+host_pca_model_t *host_pca_model_create( size_t cols, size_t k, const float *means, const float *stddev, const float *components ) {
+   host_pca_model_t *model = (host_pca_model_t *)calloc(1, sizeof(host_pca_model_t));
+   if (model == NULL) {
+      return NULL;
+   }
+   model->cols = cols;
+   model->k = k;
+   model->means = (float *)host_alloc(sizeof(float) * cols);
+   model->stddev = (float *)host_alloc(sizeof(float) * cols);
+   model->components = (float *)host_alloc(sizeof(float) * cols * k);
+   model->scaled = (float *)host_alloc(sizeof(float) * cols * k);
+   model->offset = (float *)host_alloc(sizeof(float) * k);
+   if (model->means == NULL || model->stddev == NULL || model->components == NULL || model->scaled == NULL || model->offset == NULL) {
+      fprintf(stderr, "host_pca_model_create() : error, failed to allocate a %zu x %zu model.\n", cols, k);
+      host_pca_model_free(model);
+      return NULL;
+   }
+   if (means != NULL) {
+      memcpy(model->means, means, sizeof(float) * cols);
+      memcpy(model->stddev, stddev, sizeof(float) * cols);
+      memcpy(model->components, components, sizeof(float) * cols * k);
+      pca_model_prepare(model);
+   }
+   return model;
+}
+
+void host_pca_model_free( host_pca_model_t *model ) {
+   if (model == NULL) {
+      return;
+   }
+   host_free(model->means);
+   host_free(model->stddev);
+   host_free(model->components);
+   host_free(model->scaled);
+   host_free(model->offset);
+   free(model);
+}
+
+void host_pca_model_transform( const host_pca_model_t *model, const float *data, size_t rows, float *out ) {
+   HOST_PROFILE_SCOPE("pca.transform");
+   size_t cols = model->cols, k = model->k;
+   if (k >= PCA_GEMM_MIN_K) {
+      host_sgemm(0, 1, rows, k, cols, 1.0f, data, cols, model->scaled, cols, 0.0f, out, k);
+      host_parallel_for(rows, PCA_TRANSFORM_ROWS, [&](size_t begin, size_t end) {
+         for (size_t i = begin; i < end; i++) {
+            #pragma omp simd
+            for (size_t j = 0; j < k; j++) {
+               out[i * k + j] += model->offset[j];
+            }
+         }
+      }, "pca.transform");
+      return;
+   }
+   host_parallel_for(rows, PCA_TRANSFORM_ROWS, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+         const float *x = data + i * cols;
+         for (size_t j = 0; j < k; j++) {
+            const float *w = model->scaled + j * cols;
+            float sum = 0;
+            #pragma omp simd reduction(+:sum)
+            for (size_t c = 0; c < cols; c++) {
+               sum += x[c] * w[c];
+            }
+            out[i * k + j] = sum + model->offset[j];
+         }
+      }
+   }, "pca.transform");
+}
+
+int host_pca_model_save( const host_pca_model_t *model, const char *filename ) {
+   FILE *fh = fopen(filename, "wb");
+   if (fh == NULL) {
+      fprintf(stderr, "host_pca_model_save() : error, unable to open %s for writing.\n", filename);
+      return 1;
+   }
+   uint64_t cols = model->cols, k = model->k;
+   int ok = fwrite(PCA_MODEL_MAGIC, 1, sizeof(PCA_MODEL_MAGIC), fh) == sizeof(PCA_MODEL_MAGIC)
+         && fwrite(&PCA_MODEL_VERSION, sizeof(uint32_t), 1, fh) == 1
+         && fwrite(&cols, sizeof(uint64_t), 1, fh) == 1
+         && fwrite(&k, sizeof(uint64_t), 1, fh) == 1
+         && fwrite(model->means, sizeof(float), cols, fh) == cols
+         && fwrite(model->stddev, sizeof(float), cols, fh) == cols
+         && fwrite(model->components, sizeof(float), cols * k, fh) == cols * k;
+   if (fclose(fh) != 0 || !ok) {
+      fprintf(stderr, "host_pca_model_save() : error, failed writing %s.\n", filename);
+      return 1;
+   }
+   return 0;
+}
+
+host_pca_model_t *host_pca_model_load( const char *filename ) {
+   FILE *fh = fopen(filename, "rb");
+   if (fh == NULL) {
+      fprintf(stderr, "host_pca_model_load() : error, unable to open %s.\n", filename);
+      return NULL;
+   }
+   char magic[4];
+   uint32_t version;
+   uint64_t cols, k;
+   if (fread(magic, 1, sizeof(magic), fh) != sizeof(magic) || memcmp(magic, PCA_MODEL_MAGIC, sizeof(magic)) != 0
+       || fread(&version, sizeof(uint32_t), 1, fh) != 1 || version != PCA_MODEL_VERSION
+       || fread(&cols, sizeof(uint64_t), 1, fh) != 1 || fread(&k, sizeof(uint64_t), 1, fh) != 1) {
+      fprintf(stderr, "host_pca_model_load() : error, %s is not a version %u PCA model.\n", filename, PCA_MODEL_VERSION);
+      fclose(fh);
+      return NULL;
+   }
+   host_pca_model_t *model = host_pca_model_create(cols, k, NULL, NULL, NULL);
+   if (model == NULL) {
+      fclose(fh);
+      return NULL;
+   }
+   if (fread(model->means, sizeof(float), cols, fh) != cols
+       || fread(model->stddev, sizeof(float), cols, fh) != cols
+       || fread(model->components, sizeof(float), cols * k, fh) != cols * k) {
+      fprintf(stderr, "host_pca_model_load() : error, %s is truncated.\n", filename);
+      fclose(fh);
+      host_pca_model_free(model);
+      return NULL;
+   }
+   fclose(fh);
+   pca_model_prepare(model);
+   return model;
+}
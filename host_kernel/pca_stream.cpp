@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+
+// Projection of more rows than fit in memory (or than are worth turning into Perl values), a block
+// of rows at a time.  Two output blocks are used in turn: a producer thread standardises and
+// projects block b + 1 (using the worker threads) while the calling thread hands block b to the
+// sink, so writing overlaps with the compute, and the sink runs on the caller's thread, which is
+// what a Perl callback needs.  Memory is two blocks of output; when the input is a mapped file the
+// pages of each block are dropped once it has been projected.
+
+constexpr size_t PCA_STREAM_BLOCK_ROWS = 1 << 16; // when the caller doesn't say
+
+typedef struct pca_stream_slot {
+   size_t first_row = 0, rows = 0;
+   bool full = false;
+   std::vector<float> out;
+} pca_stream_slot_t;
+
+static void pca_stream_release( const host_matrix_t *m, size_t first_row, size_t rows ) {
+   // drop the mapped pages wholly inside the rows just read, the file is still there if they're wanted again
+   static const size_t page = sysconf(_SC_PAGESIZE);
+   uintptr_t begin = (uintptr_t)(m->data + first_row * m->cols);
+   uintptr_t end = (uintptr_t)(m->data + (first_row + rows) * m->cols);
+   begin = (begin + page - 1) / page * page;
+   end = end / page * page;
+   if (end > begin) {
+      madvise((void *)begin, end - begin, MADV_DONTNEED);
+   }
+}
+
+int host_pca_model_stream( const host_pca_model_t *model, const host_matrix_t *m, size_t block_rows,
+                           host_block_sink_t sink, void *ctx ) {
+   HOST_PROFILE_SCOPE("pca.stream");
+   if (m->cols != model->cols) {
+      fprintf(stderr, "host_pca_model_stream() : error, model was fitted on %zu columns, the input has %zu.\n", model->cols, m->cols);
+      return 1;
+   }
+   if (block_rows == 0) {
+      block_rows = PCA_STREAM_BLOCK_ROWS;
+   }
+   block_rows = std::min(block_rows, std::max(m->rows, (size_t)1));
+   size_t k = model->k;
+   pca_stream_slot_t slot[2];
+   for (auto &s : slot) {
+      s.out.resize(block_rows * k);
+   }
+   HOST_PROFILE_COUNT("bytes_allocated", 2 * sizeof(float) * block_rows * k);
+   std::mutex lock;
+   std::condition_variable changed;
+   bool stop = false;
+
+   std::thread producer([&]() {
+      size_t b = 0;
+      for (size_t first = 0; first < m->rows; first += block_rows, b++) {
+         pca_stream_slot_t &s = slot[b % 2];
+         {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [&]() { return !s.full || stop; });
+            if (stop) {
+               return;
+            }
+         }
+         s.first_row = first;
+         s.rows = std::min(block_rows, m->rows - first);
+         host_pca_model_transform(model, m->data + first * m->cols, s.rows, s.out.data());
+         if (m->mapped) {
+            pca_stream_release(m, first, s.rows);
+         }
+         {
+            std::lock_guard<std::mutex> guard(lock);
+            s.full = true;
+         }
+         changed.notify_all();
+      }
+   });
+
+   int failed = 0;
+   size_t b = 0;
+   for (size_t first = 0; first < m->rows; first += block_rows, b++) {
+      pca_stream_slot_t &s = slot[b % 2];
+      {
+         std::unique_lock<std::mutex> guard(lock);
+         changed.wait(guard, [&]() { return s.full; });
+      }
+      HOST_PROFILE_BEGIN(write, "pca.stream_sink");
+      failed = sink(ctx, s.out.data(), s.first_row, s.rows, k);
+      HOST_PROFILE_END(write);
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         s.full = false;
+         stop = failed != 0;
+      }
+      changed.notify_all();
+      if (failed) {
+         break;
+      }
+   }
+   producer.join();
+   return failed != 0;
+}
+
+static int pca_stream_write( void *ctx, const float *block, size_t, size_t rows, size_t cols ) {
+   FILE *fh = (FILE *)ctx;
+   if (fwrite(block, sizeof(float) * cols, rows, fh) != rows) {
+      fprintf(stderr, "host_pca_model_project_file() : error, failed writing the projection.\n");
+      return 1;
+   }
+   HOST_PROFILE_COUNT("bytes_written", sizeof(float) * rows * cols);
+   return 0;
+}
+
+// the projection as raw native floats, k to a row, which host_matrix_map can map back
+int host_pca_model_project_file( const host_pca_model_t *model, const host_matrix_t *m, size_t block_rows, const char *filename ) {
+   FILE *fh = fopen(filename, "wb");
+   if (fh == NULL) {
+      fprintf(stderr, "host_pca_model_project_file() : error, unable to open %s for writing.\n", filename);
+      return 1;
+   }
+   setvbuf(fh, NULL, _IONBF, 0); // the blocks are big enough, skip stdio's copy
+   int failed = host_pca_model_stream(model, m, block_rows, pca_stream_write, fh);
+   if (fclose(fh) != 0 && !failed) {
+      fprintf(stderr, "host_pca_model_project_file() : error, failed writing %s.\n", filename);
+      failed = 1;
+   }
+   return failed;
+}
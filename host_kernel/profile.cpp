@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "HostProfile.h"
+
+// Each thread records into its own buffers, under a lock of its own which only a reader taking a
+// snapshot ever contends, so a timer never waits on another thread's timers.  When a thread exits
+// (a k-means job, the pool when it is resized) its buffers are merged into the retired totals.  The totals
+// are keyed by name pointer and index while recording and only turned into strings when read.
+// profile_lock covers the list of threads and the retired totals, and is always taken before a
+// thread's own lock.
+
+constexpr size_t PROFILE_MAX_EVENTS = 1 << 18; // per thread, for the trace; the totals are kept regardless
+
+std::atomic<int> host_profile_on{0};
+
+typedef struct profile_total {
+   uint64_t calls = 0, total_ns = 0, min_ns = UINT64_MAX, max_ns = 0;
+   void add( uint64_t ns ) {
+      calls++;
+      total_ns += ns;
+      min_ns = std::min(min_ns, ns);
+      max_ns = std::max(max_ns, ns);
+   }
+   void merge( const profile_total &o ) {
+      calls += o.calls;
+      total_ns += o.total_ns;
+      min_ns = std::min(min_ns, o.min_ns);
+      max_ns = std::max(max_ns, o.max_ns);
+   }
+} profile_total_t;
+
+typedef struct profile_task {
+   uint64_t calls = 0, wall_ns = 0, busy_ns = 0, slot_ns = 0, max_busy_ns = 0, workers = 0, steals = 0;
+   void merge( const profile_task &o ) {
+      calls += o.calls;
+      wall_ns += o.wall_ns;
+      busy_ns += o.busy_ns;
+      slot_ns += o.slot_ns;
+      max_busy_ns += o.max_busy_ns;
+      workers += o.workers;
+      steals += o.steals;
+   }
+} profile_task_t;
+
+typedef struct profile_event {
+   const char *name;
+   int index;
+   int tid;
+   uint64_t start_ns, end_ns;
+} profile_event_t;
+
+struct profile_key_hash {
+   size_t operator()( const std::pair<const char *, int> &k ) const {
+      return std::hash<const void *>()(k.first) ^ ((size_t)k.second * 0x9e3779b97f4a7c15ULL);
+   }
+};
+
+typedef std::unordered_map<std::pair<const char *, int>, profile_total_t, profile_key_hash> profile_totals_t;
+
+struct profile_thread;
+
+static std::mutex profile_lock;
+static std::vector<profile_thread *> profile_threads;   // live threads
+static std::vector<int> profile_free_tids;
+static int profile_next_tid = 0;
+static profile_totals_t retired_totals;
+static std::unordered_map<const char *, uint64_t> retired_counters;
+static std::unordered_map<const char *, profile_task_t> retired_tasks;
+static std::vector<profile_event_t> retired_events;
+static uint64_t profile_epoch = 0;
+
+struct profile_thread {
+   int tid;
+   std::mutex lock; // the buffers below, against a snapshot being taken while this thread records
+   profile_totals_t totals;
+   std::unordered_map<const char *, uint64_t> counters;
+   std::unordered_map<const char *, profile_task_t> tasks;
+   std::vector<profile_event_t> events;
+
+   profile_thread() {
+      std::lock_guard<std::mutex> guard(profile_lock);
+      if (profile_free_tids.empty()) {
+         tid = profile_next_tid++;
+      } else {
+         tid = profile_free_tids.back();
+         profile_free_tids.pop_back();
+      }
+      profile_threads.push_back(this);
+   }
+   ~profile_thread() {
+      std::lock_guard<std::mutex> guard(profile_lock);
+      for (auto &t : totals) {
+         retired_totals[t.first].merge(t.second);
+      }
+      for (auto &c : counters) {
+         retired_counters[c.first] += c.second;
+      }
+      for (auto &t : tasks) {
+         retired_tasks[t.first].merge(t.second);
+      }
+      size_t room = PROFILE_MAX_EVENTS * 4 - std::min(retired_events.size(), PROFILE_MAX_EVENTS * 4);
+      retired_events.insert(retired_events.end(), events.begin(), events.begin() + std::min(room, events.size()));
+      profile_threads.erase(std::find(profile_threads.begin(), profile_threads.end(), this));
+      profile_free_tids.push_back(tid);
+   }
+};
+
+static profile_thread &profile_this_thread() {
+   static thread_local profile_thread t;
+   return t;
+}
+
+uint64_t host_profile_now() {
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void host_profile_enable( int on ) {
+   if (on && profile_epoch == 0) {
+      profile_epoch = host_profile_now();
+   }
+   host_profile_on.store(on ? 1 : 0, std::memory_order_relaxed);
+}
+
+void host_profile_reset() {
+   // a scope open across the reset is still recorded when it closes
+   std::lock_guard<std::mutex> guard(profile_lock);
+   for (auto *t : profile_threads) {
+      std::lock_guard<std::mutex> thread_guard(t->lock);
+      t->totals.clear();
+      t->counters.clear();
+      t->tasks.clear();
+      t->events.clear();
+   }
+   retired_totals.clear();
+   retired_counters.clear();
+   retired_tasks.clear();
+   retired_events.clear();
+   profile_epoch = host_profile_now();
+}
+
+void host_profile_record( const char *name, int index, uint64_t start_ns, uint64_t end_ns ) {
+   profile_thread &t = profile_this_thread();
+   std::lock_guard<std::mutex> guard(t.lock);
+   t.totals[std::make_pair(name, index)].add(end_ns - start_ns);
+   if (t.events.size() < PROFILE_MAX_EVENTS) {
+      t.events.push_back({ name, index, t.tid, start_ns, end_ns });
+   }
+}
+
+void host_profile_count( const char *counter, uint64_t amount ) {
+   profile_thread &t = profile_this_thread();
+   std::lock_guard<std::mutex> guard(t.lock);
+   t.counters[counter] += amount;
+}
+
+void host_profile_record_task( const char *name, uint64_t wall_ns, uint64_t busy_ns, uint64_t max_busy_ns,
+                               size_t slots, size_t workers, size_t steals ) {
+   // the sums are kept so the ratios come out weighted by time rather than averaged per call
+   profile_thread &thread = profile_this_thread();
+   std::lock_guard<std::mutex> guard(thread.lock);
+   profile_task_t &t = thread.tasks[name];
+   t.calls++;
+   t.wall_ns += wall_ns;
+   t.busy_ns += busy_ns;
+   t.slot_ns += wall_ns * slots;
+   t.max_busy_ns += max_busy_ns * slots;
+   t.workers += workers;
+   t.steals += steals;
+}
+
+static std::string profile_name( const char *name, int index ) {
+   return index < 0 ? std::string(name) : std::string(name) + "[" + std::to_string(index) + "]";
+}
+
+// the last snapshot, read by index from the glue
+static std::vector<std::pair<std::string, profile_total_t>> stage_snapshot;
+static std::vector<std::pair<std::string, uint64_t>> counter_snapshot;
+static std::vector<std::pair<std::string, profile_task_t>> task_snapshot;
+
+size_t host_profile_stage_count() {
+   std::lock_guard<std::mutex> guard(profile_lock);
+   std::map<std::string, profile_total_t> merged;
+   for (auto &t : retired_totals) {
+      merged[profile_name(t.first.first, t.first.second)].merge(t.second);
+   }
+   for (auto *thread : profile_threads) {
+      std::lock_guard<std::mutex> thread_guard(thread->lock);
+      for (auto &t : thread->totals) {
+         merged[profile_name(t.first.first, t.first.second)].merge(t.second);
+      }
+   }
+   stage_snapshot.assign(merged.begin(), merged.end());
+   return stage_snapshot.size();
+}
+
+int host_profile_stage( size_t i, const char **name, uint64_t *calls, uint64_t *total_ns, uint64_t *min_ns, uint64_t *max_ns ) {
+   if (i >= stage_snapshot.size()) {
+      return 1;
+   }
+   *name = stage_snapshot[i].first.c_str();
+   *calls = stage_snapshot[i].second.calls;
+   *total_ns = stage_snapshot[i].second.total_ns;
+   *min_ns = stage_snapshot[i].second.min_ns;
+   *max_ns = stage_snapshot[i].second.max_ns;
+   return 0;
+}
+
+size_t host_profile_counter_count() {
+   std::lock_guard<std::mutex> guard(profile_lock);
+   std::map<std::string, uint64_t> merged;
+   for (auto &c : retired_counters) {
+      merged[c.first] += c.second;
+   }
+   for (auto *thread : profile_threads) {
+      std::lock_guard<std::mutex> thread_guard(thread->lock);
+      for (auto &c : thread->counters) {
+         merged[c.first] += c.second;
+      }
+   }
+   counter_snapshot.assign(merged.begin(), merged.end());
+   return counter_snapshot.size();
+}
+
+int host_profile_counter( size_t i, const char **name, uint64_t *value ) {
+   if (i >= counter_snapshot.size()) {
+      return 1;
+   }
+   *name = counter_snapshot[i].first.c_str();
+   *value = counter_snapshot[i].second;
+   return 0;
+}
+
+size_t host_profile_task_count() {
+   std::lock_guard<std::mutex> guard(profile_lock);
+   std::map<std::string, profile_task_t> merged;
+   for (auto &t : retired_tasks) {
+      merged[t.first].merge(t.second);
+   }
+   for (auto *thread : profile_threads) {
+      std::lock_guard<std::mutex> thread_guard(thread->lock);
+      for (auto &t : thread->tasks) {
+         merged[t.first].merge(t.second);
+      }
+   }
+   task_snapshot.assign(merged.begin(), merged.end());
+   return task_snapshot.size();
+}
+
+int host_profile_task( size_t i, const char **name, uint64_t *calls, uint64_t *wall_ns, double *utilisation,
+                       double *imbalance, double *workers, uint64_t *steals ) {
+   if (i >= task_snapshot.size()) {
+      return 1;
+   }
+   const profile_task_t &t = task_snapshot[i].second;
+   *name = task_snapshot[i].first.c_str();
+   *calls = t.calls;
+   *wall_ns = t.wall_ns;
+   *utilisation = t.slot_ns ? (double)t.busy_ns / t.slot_ns : 0;
+   *imbalance = t.busy_ns ? (double)t.max_busy_ns / t.busy_ns : 0;
+   *workers = t.calls ? (double)t.workers / t.calls : 0;
+   *steals = t.steals;
+   return 0;
+}
+
+int host_profile_write_trace( const char *filename ) {
+   // Chrome trace event format, one complete ("X") event per timed scope, loadable in
+   // chrome://tracing or Perfetto; the counters go in otherData
+   size_t counters = host_profile_counter_count();
+   std::lock_guard<std::mutex> guard(profile_lock);
+   FILE *fh = fopen(filename, "w");
+   if (fh == NULL) {
+      fprintf(stderr, "host_profile_write_trace() : error, unable to open %s for writing.\n", filename);
+      return 1;
+   }
+   fprintf(fh, "{\"traceEvents\":[");
+   bool first = true;
+   auto write_events = [&](const std::vector<profile_event_t> &events) {
+      for (const auto &e : events) {
+         if (e.start_ns < profile_epoch) {
+            continue;
+         }
+         fprintf(fh, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                 first ? "" : ",", profile_name(e.name, e.index).c_str(), e.tid,
+                 (e.start_ns - profile_epoch) / 1000.0, (e.end_ns - e.start_ns) / 1000.0);
+         if (e.index >= 0) {
+            fprintf(fh, ",\"args\":{\"index\":%d}", e.index);
+         }
+         fprintf(fh, "}");
+         first = false;
+      }
+   };
+   write_events(retired_events);
+   for (auto *thread : profile_threads) {
+      std::lock_guard<std::mutex> thread_guard(thread->lock);
+      write_events(thread->events);
+   }
+   fprintf(fh, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{");
+   for (size_t i = 0; i < counters; i++) {
+      fprintf(fh, "%s\"%s\":%llu", i ? "," : "", counter_snapshot[i].first.c_str(), (unsigned long long)counter_snapshot[i].second);
+   }
+   fprintf(fh, "}}\n");
+   if (fclose(fh) != 0) {
+      fprintf(stderr, "host_profile_write_trace() : error, failed writing %s.\n", filename);
+      return 1;
+   }
+   return 0;
+}
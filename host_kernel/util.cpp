@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "HostKernel.h"
+#include "HostProfile.h"
+#include "parallel.h"
+
+// The array helpers behind ML::Util (matmul is host_dgemm), in double as Perl keeps its numbers.
+
+constexpr size_t TRANSPOSE_TILE = 32; // a 32 x 32 tile of each side is 16k, well inside L1
+
+void host_dtranspose( const double *a, size_t rows, size_t cols, double *out ) {
+   HOST_PROFILE_SCOPE("util.transpose");
+   // tiles of rows go to the threads; within one, both sides stay in cache
+   host_parallel_for(rows, TRANSPOSE_TILE, [&](size_t begin, size_t end) {
+      for (size_t j0 = 0; j0 < cols; j0 += TRANSPOSE_TILE) {
+         size_t j1 = std::min(j0 + TRANSPOSE_TILE, cols);
+         for (size_t i = begin; i < end; i++) {
+            for (size_t j = j0; j < j1; j++) {
+               out[j * rows + i] = a[i * cols + j];
+            }
+         }
+      }
+   }, "util.transpose");
+}
+
+size_t host_conv2d_size( size_t n, size_t k, int mode ) {
+   size_t offset = k / 2;
+   switch (mode) {
+   case 1: // expand
+      return n + 2 * offset;
+   case 2: // reduce
+      n += k % 2 == 0 ? 1 : 0; // an even filter has no centre cell, one more fits
+      return n > 2 * offset ? n - 2 * offset : 0;
+   default:
+      return n; // padded
+   }
+}
+
+void host_dconv2d( const double *in, size_t n, const double *filter, size_t k, int mode, double *out ) {
+   HOST_PROFILE_SCOPE("util.conv2d");
+   size_t out_n = host_conv2d_size(n, k, mode);
+   if (out_n == 0 || k == 0) {
+      std::fill(out, out + out_n * out_n, 0.0);
+      return;
+   }
+   // output (i, j) takes input (i + u - in_offset, j + v - in_offset) for the rotated filter's
+   // (u, v), so the input is copied once into a zero border wide enough for every (i + u, j + v),
+   // and the loops then run without bounds checks, with j innermost for the SIMD lanes
+   size_t in_offset = mode == 1 ? 2 * (k / 2) : mode == 2 ? 0 : k / 2;
+   size_t side = out_n + k - 1;
+   std::vector<double> padded(side * side, 0.0), rotated(k * k);
+   for (size_t i = 0; i < n && i + in_offset < side; i++) {
+      size_t cols = std::min(n, side - in_offset);
+      std::copy(in + i * n, in + i * n + cols, padded.data() + (i + in_offset) * side + in_offset);
+   }
+   for (size_t u = 0; u < k; u++) { // convolution rather than correlation
+      for (size_t v = 0; v < k; v++) {
+         rotated[u * k + v] = filter[(k - 1 - u) * k + (k - 1 - v)];
+      }
+   }
+   host_parallel_for(out_n, 8, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+         double *orow = out + i * out_n;
+         std::fill(orow, orow + out_n, 0.0);
+         for (size_t u = 0; u < k; u++) {
+            for (size_t v = 0; v < k; v++) {
+               double w = rotated[u * k + v];
+               const double *prow = padded.data() + (i + u) * side + v;
+               #pragma omp simd
+               for (size_t j = 0; j < out_n; j++) {
+                  orow[j] += w * prow[j];
+               }
+            }
+         }
+      }
+   }, "util.conv2d");
+}
@@ -8,5 +8,9 @@ cd $MLDIR/nvidia_kernel
 cmake -S . -B build
 cmake --build build
 cmake --install build
+cd $MLDIR/host_kernel
+cmake -S . -B build
+cmake --build build
+cmake --install build
 cd $MLDIR
 
@@ -1,8 +1,8 @@
 use Modern::Perl;
-use Text::CSV qw(csv);
 use Data::Dumper;
 use lib '.';
 use ML::Util qw(print_2d_array);
+use ML::Matrix;
 use ML::PCA;
 use ML::KMeans;
 use List::Util qw(zip);
@@ -26,12 +26,9 @@ sub save_chart
 }
 
 my $cluster_count = 3;
-my $csv = Text::CSV->new();
-my $fh;
-open $fh, "<", "iris_truncated.csv";
-my $data = $csv->fragment($fh, "col=1-4");
-close $fh;
-#my $headers = shift @$data;
+my $density_threshold = 100_000; # points, above which the plot is binned
+my $data = ML::Matrix->load_csv("iris_truncated.csv", columns => [0 .. 3]);
+say "loaded " . $data->rows . " rows at " . sprintf("%.1f", $data->mb_per_sec) . " MB/s" if $debug;
 
 
 my $pca = ML::PCA->new(#GPU => "ROCM", 
@@ -47,43 +44,48 @@ my $clusters = $kmeans->clusterise(data => $coords, clusters => $cluster_count);
 my $centroids = $kmeans->centroids();
 print_2d_array("final centroids", $centroids) if $debug;
 
-my @graph_data;
 my @legend_labels;
 my $my_graph = Chart::Scatter->new( 800, 600 );
-foreach (zip $coords, $clusters) {
-   my ($coord, $cluster) = @$_;
-   #say join(",",@$coord) . ",$cluster";
-   push @{$graph_data[0]}, $coord->[0];
-   foreach my $i (1 .. $cluster_count ) {
-      if (($i - 1) == $cluster ) {
-         push @{$graph_data[$i]}, $coord->[1];
-      } else {
-         push @{$graph_data[$i]}, undef;
-      }
-   }
-}
-foreach my $i (0 .. $#{$graph_data[0]}) {
-   push @{$graph_data[$cluster_count + 1]}, undef;
-}
 foreach my $i (0 .. $cluster_count - 1) {
    push @legend_labels, "Cluster $i";
 }
-foreach my $c (@$centroids) {
-   push @{$graph_data[0]}, $c->[0];
-   foreach my $i (1 .. $cluster_count) {
-      push @{$graph_data[$i]}, undef;
-   }
-   push @{$graph_data[$cluster_count + 1]}, $c->[1];
-}
 push @legend_labels, "Centroids";
 
 $my_graph->set(legend_labels => \@legend_labels,
                skip_x_ticks => 10,
                f_x_tick => sub { sprintf("%.3f", $_[0]) },
                max_x_ticks => 5);
-           
-foreach my $g (@graph_data) {
-   $my_graph->add_dataset($g);
+
+if (@$coords > $density_threshold) {
+   # too many points to draw one at a time, bin them into the chart's pixels instead
+   $my_graph->add_density($coords, labels => $clusters, clusters => $cluster_count, overlay => $centroids);
+} else {
+   my @graph_data;
+   foreach (zip $coords, $clusters) {
+      my ($coord, $cluster) = @$_;
+      #say join(",",@$coord) . ",$cluster";
+      push @{$graph_data[0]}, $coord->[0];
+      foreach my $i (1 .. $cluster_count ) {
+         if (($i - 1) == $cluster ) {
+            push @{$graph_data[$i]}, $coord->[1];
+         } else {
+            push @{$graph_data[$i]}, undef;
+         }
+      }
+   }
+   foreach my $i (0 .. $#{$graph_data[0]}) {
+      push @{$graph_data[$cluster_count + 1]}, undef;
+   }
+   foreach my $c (@$centroids) {
+      push @{$graph_data[0]}, $c->[0];
+      foreach my $i (1 .. $cluster_count) {
+         push @{$graph_data[$i]}, undef;
+      }
+      push @{$graph_data[$cluster_count + 1]}, $c->[1];
+   }
+   foreach my $g (@graph_data) {
+      $my_graph->add_dataset($g);
+   }
 }
 my $file_name = "cluster_plot_$$.png";
 $my_graph->png($file_name);
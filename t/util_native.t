@@ -0,0 +1,69 @@
+use Modern::Perl;
+
+use Test::More;
+use List::Util qw(max);
+
+use lib '.';
+use ML::Util qw(matmul transpose add_2_arrays conv2d);
+
+# The native matmul, transpose, add_2_arrays and conv2d (ML::UtilNative) against the Perl loops in
+# ML::Util they stand in for, on fixed inputs, and the inputs the native versions turn down so
+# that ML::Util falls back to Perl.
+
+plan skip_all => "ML::UtilNative isn't built" unless $ML::Util::native;
+
+sub perl_only {
+   my $f = shift;
+   local $ML::Util::native = 0;
+   return $f->(@_);
+}
+
+sub max_diff {
+   my ($a, $b) = @_;
+   return 1e9 unless @$a == @$b;
+   my $diff = 0;
+   foreach my $i (0 .. $#$a) {
+      return 1e9 unless @{$a->[$i]} == @{$b->[$i]};
+      $diff = max($diff, map { abs($a->[$i][$_] - $b->[$i][$_]) } 0 .. $#{$a->[$i]});
+   }
+   return $diff;
+}
+
+sub grid {
+   # rows x cols of fixed, uneven values
+   my ($rows, $cols, $seed) = @_;
+   return [ map { my $i = $_; [ map { sin($seed + 3 * $i + 7 * $_) * ($i + 1) } 0 .. $cols - 1 ] } 0 .. $rows - 1 ];
+}
+
+my $A = grid(7, 5, 1);
+my $B = grid(5, 3, 2);
+my $C = grid(7, 5, 3);
+
+ok(max_diff(ML::UtilNative::matmul($A, $B), perl_only(\&matmul, $A, $B)) < 1e-9, "matmul 7x5 . 5x3");
+ok(max_diff(ML::UtilNative::matmul([[2]], [[3]]), perl_only(\&matmul, [[2]], [[3]])) < 1e-12, "matmul 1x1");
+ok(max_diff(ML::UtilNative::transpose($A), perl_only(\&transpose, $A)) == 0, "transpose 7x5");
+ok(max_diff(ML::UtilNative::transpose([[1, 2, 3]]), perl_only(\&transpose, [[1, 2, 3]])) == 0, "transpose of a single row");
+ok(max_diff(ML::UtilNative::add_2_arrays($A, $C), perl_only(\&add_2_arrays, $A, $C)) < 1e-12, "add_2_arrays 7x5");
+
+foreach my $k (1, 2, 3, 4, 5) {
+   my $in = grid(9, 9, $k);
+   my $filter = grid($k, $k, 10 + $k);
+   foreach my $mode (qw(padded expand reduce)) {
+      my $native = ML::UtilNative::conv2d($in, $filter, $mode);
+      ok(max_diff($native, perl_only(\&conv2d, $in, $filter, $mode)) < 1e-9, "conv2d $mode, 9x9 by ${k}x$k");
+   }
+}
+
+# turned down natively, and so left to the Perl versions
+my $ragged = [[1, 2, 3], [4, 5], [6, 7, 8]];
+is(ML::UtilNative::transpose($ragged), undef, "ragged rows aren't transposed natively");
+is_deeply(transpose($ragged), perl_only(\&transpose, $ragged), "ragged rows are transposed by the Perl version");
+is(ML::UtilNative::matmul($ragged, $B), undef, "ragged rows aren't multiplied natively");
+is(ML::UtilNative::matmul($A, $A), undef, "mismatched shapes aren't multiplied natively");
+ok(!eval { matmul($A, $A); 1 }, "mismatched shapes die in the Perl version");
+is(ML::UtilNative::transpose([]), undef, "an empty input isn't transposed natively");
+is_deeply(transpose([]), [], "an empty input transposes to an empty array");
+is(ML::UtilNative::add_2_arrays([], []), undef, "empty inputs aren't added natively");
+is(ML::UtilNative::conv2d("not an array", [[1]], "padded"), undef, "a non-array isn't convolved natively");
+
+done_testing();